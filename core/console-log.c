@@ -27,6 +27,77 @@
 #include "console.h"
 #include "timebase.h"
 #include <debug_descriptor.h>
+#include <trace.h>
+
+/*
+ * Record a message as a TRACE_PRLOG entry instead of formatting it, it's
+ * rendered later from the trace buffer by external/trace/dump_trace.
+ * Like vsnprintf() every conversion consumes one pointer sized argument,
+ * strings are copied as they may not be around by then. Returns false
+ * if the message doesn't fit and has to be formatted after all.
+ */
+static bool prlog_trace(int log_level, const char *fmt, va_list ap)
+{
+	union trace t;
+	struct trace_prlog *p = &t.prlog;
+	const char *f;
+	unsigned int nargs = 0, slen = 0, i;
+	const char *strs[TRACE_PRLOG_MAX_ARGS];
+	char *sbuf;
+
+	for (f = fmt; *f; f++) {
+		if (*f != '%')
+			continue;
+		/* A conversion ends where vsnprintf() thinks it does */
+		do {
+			f++;
+		} while (*f && !strchr("diuxXpcsoO%", *f));
+		if (!*f)
+			return false;
+		if (*f == '%')
+			continue;
+		if (nargs == TRACE_PRLOG_MAX_ARGS)
+			return false;
+		strs[nargs] = NULL;
+		if (*f == 's') {
+			strs[nargs] = va_arg(ap, const char *);
+			if (!strs[nargs])
+				strs[nargs] = "(null)";
+		} else {
+			p->data[nargs] = cpu_to_be64((u64)va_arg(ap, void *));
+		}
+		nargs++;
+	}
+
+	sbuf = (char *)&p->data[nargs];
+	for (i = 0; i < nargs; i++) {
+		unsigned int room = sizeof(p->data) - nargs * 8 - slen;
+		size_t n;
+
+		if (!strs[i])
+			continue;
+		n = strlen(strs[i]);
+		if (n >= room)
+			return false;
+		memcpy(sbuf + slen, strs[i], n);
+		sbuf[slen + n] = '\0';
+		p->data[i] = cpu_to_be64(nargs * 8 + slen);
+		slen += n + 1;
+	}
+	/* Keep the padding clean so repeats are spotted */
+	while (slen & 7)
+		sbuf[slen++] = '\0';
+
+	p->fmt = cpu_to_be64((u64)fmt);
+	p->level = log_level;
+	p->nargs = nargs;
+	memset(p->unused, 0, sizeof(p->unused));
+	memset(t.hdr.unused, 0, sizeof(t.hdr.unused));
+	trace_add(&t, TRACE_PRLOG, offsetof(struct trace_prlog, data) +
+		  nargs * 8 + slen);
+
+	return true;
+}
 
 static int vprlog(int log_level, const char *fmt, va_list ap)
 {
@@ -34,6 +105,7 @@ static int vprlog(int log_level, const char *fmt, va_list ap)
 	char buffer[320];
 	bool flush_to_drivers = true;
 	unsigned long tb = mftb();
+	va_list aq;
 
 	/* It's safe to return 0 when we "did" something here
 	 * as only printf cares about how much we wrote, and
@@ -45,6 +117,21 @@ static int vprlog(int log_level, const char *fmt, va_list ap)
 	if (log_level > (debug_descriptor.console_log_levels >> 4))
 		return 0;
 
+	/*
+	 * With TRACE_PRLOG enabled in the trace mask, messages that only
+	 * go to memory are kept in binary form in the trace buffers.
+	 */
+	if (log_level > (debug_descriptor.console_log_levels & 0x0f) &&
+	    (debug_descriptor.trace_mask & (1ul << TRACE_PRLOG))) {
+		bool done;
+
+		va_copy(aq, ap);
+		done = prlog_trace(log_level, fmt, aq);
+		va_end(aq);
+		if (done)
+			return 0;
+	}
+
 	count = snprintf(buffer, sizeof(buffer), "[%5lu.%09lu,%d] ",
 			 tb_to_secs(tb), tb_remaining_nsecs(tb), log_level);
 	count+= vsnprintf(buffer+count, sizeof(buffer)-count, fmt, ap);
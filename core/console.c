@@ -186,17 +186,42 @@ bool flush_console(void)
 	return ret;
 }
 
-static void inmem_write(char c)
+/*
+ * Append a span of characters to the in-memory console, with at most
+ * two memcpy()s around the wrap point. The new position is made visible
+ * to memcons readers by inmem_publish().
+ */
+static void inmem_write(const char *buf, size_t len)
 {
-	uint32_t opos;
-
-	if (!c)
-		return;
-	con_buf[con_in++] = c;
-	if (con_in >= INMEM_CON_OUT_LEN) {
-		con_in = 0;
-		con_wrapped = true;
+	size_t space, n;
+
+	/* Room before we run into the unflushed tail */
+	space = (con_out + INMEM_CON_OUT_LEN - con_in) % INMEM_CON_OUT_LEN;
+	if (!space)
+		space = INMEM_CON_OUT_LEN;
+
+	while (len) {
+		n = INMEM_CON_OUT_LEN - con_in;
+		if (n > len)
+			n = len;
+		memcpy(con_buf + con_in, buf, n);
+		buf += n;
+		len -= n;
+		con_in += n;
+		if (con_in >= INMEM_CON_OUT_LEN) {
+			con_in = 0;
+			con_wrapped = true;
+		}
+		/* If head reaches tail, push tail around & drop chars */
+		if (n >= space)
+			con_out = (con_in + 1) % INMEM_CON_OUT_LEN;
+		space = n >= space ? 1 : space - n;
 	}
+}
+
+static void inmem_publish(void)
+{
+	uint32_t opos;
 
 	/*
 	 * We must always re-generate memcons.out_pos because
@@ -204,16 +229,14 @@ static void inmem_write(char c)
 	 * use a broken putmemproc that does RMW on the full
 	 * 8 bytes containing out_pos and in_prod, thus corrupting
 	 * out_pos
+	 *
+	 * The lwsync orders the buffer contents before the new position.
 	 */
 	opos = con_in;
 	if (con_wrapped)
 		opos |= MEMCONS_OUT_POS_WRAP;
 	lwsync();
 	memcons.out_pos = opos;
-
-	/* If head reaches tail, push tail around & drop chars */
-	if (con_in == con_out)
-		con_out = (con_in + 1) % INMEM_CON_OUT_LEN;
 }
 
 static size_t inmem_read(char *buf, size_t req)
@@ -231,12 +254,12 @@ static size_t inmem_read(char *buf, size_t req)
 	return read;
 }
 
-static void write_char(char c)
+static void write_span(const char *buf, size_t len)
 {
 #ifdef MAMBO_DEBUG_CONSOLE
-	mambo_console_write(&c, 1);
+	mambo_console_write(buf, len);
 #endif
-	inmem_write(c);
+	inmem_write(buf, len);
 }
 
 ssize_t console_write(bool flush_to_drivers, const void *buf, size_t count)
@@ -246,13 +269,25 @@ ssize_t console_write(bool flush_to_drivers, const void *buf, size_t count)
 	 */
 	bool need_unlock = lock_recursive(&con_lock);
 	const char *cbuf = buf;
+	size_t left = count, n;
 
-	while(count--) {
-		char c = *(cbuf++);
-		if (c == '\n')
-			write_char('\r');
-		write_char(c);
+	/*
+	 * Copy runs of plain characters in one go, breaking only to
+	 * expand '\n' into "\r\n" and to drop NUL characters.
+	 */
+	while (left) {
+		for (n = 0; n < left && cbuf[n] != '\n' && cbuf[n]; n++)
+			;
+		if (n)
+			write_span(cbuf, n);
+		if (n == left)
+			break;
+		if (cbuf[n] == '\n')
+			write_span("\r\n", 2);
+		cbuf += n + 1;
+		left -= n + 1;
 	}
+	inmem_publish();
 
 	__flush_console(flush_to_drivers, need_unlock);
 
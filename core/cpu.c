@@ -32,6 +32,7 @@
 #include <ccan/str/str.h>
 #include <ccan/container_of/container_of.h>
 #include <xscom.h>
+#include <pool.h>
 
 /* The cpu_threads array is static and indexed by PIR in
  * order to speed up lookup from asm entry points
@@ -66,10 +67,21 @@ struct cpu_job {
 	void			(*func)(void *data);
 	void			*data;
 	const char		*name;
+	struct cpu_job_group	*group;
 	bool			complete;
 	bool		        no_return;
+	bool			pinned;
 };
 
+/*
+ * Jobs come from a pool rather than the heap, there are rarely more
+ * than a handful per CPU in flight. We fall back to zalloc if it runs
+ * dry.
+ */
+#define CPU_JOB_POOL_SIZE	256
+static struct pool cpu_job_pool;
+static struct lock cpu_job_pool_lock = LOCK_UNLOCKED;
+
 /* attribute const as cpu_stacks is constant. */
 unsigned long __attrconst cpu_stack_bottom(unsigned int pir)
 {
@@ -106,6 +118,67 @@ static void cpu_wake(struct cpu_thread *cpu)
 	}
 }
 
+static struct cpu_job *cpu_job_alloc(void)
+{
+	struct cpu_job *job = NULL;
+
+	lock(&cpu_job_pool_lock);
+	if (!cpu_job_pool.buf &&
+	    pool_init(&cpu_job_pool, sizeof(struct cpu_job),
+		      CPU_JOB_POOL_SIZE, 0))
+		prlog_once(PR_WARNING, "CPU: Failed to allocate job pool\n");
+	if (cpu_job_pool.buf)
+		job = pool_get(&cpu_job_pool, POOL_NORMAL);
+	unlock(&cpu_job_pool_lock);
+
+	if (!job)
+		job = zalloc(sizeof(struct cpu_job));
+	return job;
+}
+
+static void cpu_job_free(struct cpu_job *job)
+{
+	void *buf = cpu_job_pool.buf;
+
+	if ((void *)job < buf ||
+	    (void *)job >= buf + CPU_JOB_POOL_SIZE * cpu_job_pool.obj_size) {
+		free(job);
+		return;
+	}
+
+	lock(&cpu_job_pool_lock);
+	pool_free_object(&cpu_job_pool, job);
+	unlock(&cpu_job_pool_lock);
+}
+
+static void cpu_job_group_add(struct cpu_job_group *group, int32_t count)
+{
+	uint32_t old;
+
+	do {
+		old = group->pending;
+	} while (cmpxchg32(&group->pending, old, old + count) != old);
+}
+
+/*
+ * Mark a job as done. Jobs in a group are owned by the job engine and
+ * are freed here, the last thing we touch is the group counter as the
+ * waiter may return (and its group go away) as soon as it hits zero.
+ */
+static void cpu_job_complete(struct cpu_job *job)
+{
+	struct cpu_job_group *group = job->group;
+
+	if (!group) {
+		lwsync();
+		job->complete = true;
+		return;
+	}
+
+	cpu_job_free(job);
+	cpu_job_group_add(group, -1);
+}
+
 static struct cpu_thread *cpu_find_job_target(void)
 {
 	struct cpu_thread *cpu, *best, *me = this_cpu();
@@ -167,32 +240,42 @@ static struct cpu_thread *cpu_find_job_target(void)
 	return NULL;
 }
 
-struct cpu_job *__cpu_queue_job(struct cpu_thread *cpu,
-				const char *name,
-				void (*func)(void *data), void *data,
-				bool no_return)
+static bool cpu_job_check_target(struct cpu_thread *cpu)
 {
-	struct cpu_job *job;
-
-#ifdef DEBUG_SERIALIZE_CPU_JOBS
-	if (cpu == NULL)
-		cpu = this_cpu();
-#endif
-
 	if (cpu && !cpu_is_available(cpu)) {
 		prerror("CPU: Tried to queue job on unavailable CPU 0x%04x\n",
 			cpu->pir);
-		return NULL;
+		return false;
 	}
+	return true;
+}
 
-	job = zalloc(sizeof(struct cpu_job));
+static struct cpu_job *cpu_job_new(const char *name,
+				   void (*func)(void *data), void *data,
+				   bool no_return, struct cpu_job_group *group)
+{
+	struct cpu_job *job;
+
+	job = cpu_job_alloc();
 	if (!job)
 		return NULL;
 	job->func = func;
 	job->data = data;
 	job->name = name;
+	job->group = group;
 	job->complete = false;
 	job->no_return = no_return;
+	return job;
+}
+
+static void cpu_job_submit(struct cpu_thread *cpu, struct cpu_job *job)
+{
+#ifdef DEBUG_SERIALIZE_CPU_JOBS
+	if (cpu == NULL)
+		cpu = this_cpu();
+#endif
+	/* Jobs for a specific CPU must not be stolen by another one */
+	job->pinned = cpu != NULL;
 
 	/* Pick a candidate. Returns with target queue locked */
 	if (cpu == NULL)
@@ -205,10 +288,10 @@ struct cpu_job *__cpu_queue_job(struct cpu_thread *cpu,
 	/* Can't be scheduled, run it now */
 	if (cpu == NULL) {
 		if (!this_cpu()->job_has_no_return)
-			this_cpu()->job_has_no_return = no_return;
-		func(data);
-		job->complete = true;
-		return job;
+			this_cpu()->job_has_no_return = job->no_return;
+		job->func(job->data);
+		cpu_job_complete(job);
+		return;
 	}
 
 	/* That's bad, the job will never run */
@@ -219,17 +302,51 @@ struct cpu_job *__cpu_queue_job(struct cpu_thread *cpu,
 		backtrace();
 	}
 	list_add_tail(&cpu->job_queue, &job->link);
-	if (no_return)
+	if (job->no_return)
 		cpu->job_has_no_return = true;
 	else
 		cpu->job_count++;
 	if (pm_enabled)
 		cpu_wake(cpu);
 	unlock(&cpu->job_lock);
+}
 
+struct cpu_job *__cpu_queue_job(struct cpu_thread *cpu,
+				const char *name,
+				void (*func)(void *data), void *data,
+				bool no_return)
+{
+	struct cpu_job *job;
+
+	if (!cpu_job_check_target(cpu))
+		return NULL;
+
+	job = cpu_job_new(name, func, data, no_return, NULL);
+	if (!job)
+		return NULL;
+
+	cpu_job_submit(cpu, job);
 	return job;
 }
 
+bool cpu_queue_job_group(struct cpu_job_group *group,
+			 struct cpu_thread *cpu, const char *name,
+			 void (*func)(void *data), void *data)
+{
+	struct cpu_job *job;
+
+	if (!cpu_job_check_target(cpu))
+		return false;
+
+	job = cpu_job_new(name, func, data, false, group);
+	if (!job)
+		return false;
+
+	cpu_job_group_add(group, 1);
+	cpu_job_submit(cpu, job);
+	return true;
+}
+
 bool cpu_poll_job(struct cpu_job *job)
 {
 	lwsync();
@@ -256,7 +373,95 @@ void cpu_wait_job(struct cpu_job *job, bool free_it)
 		      job->name, time_waited);
 
 	if (free_it)
-		free(job);
+		cpu_job_free(job);
+}
+
+/*
+ * Move a job that is waiting behind a busy CPU's current job onto our
+ * own queue. Only jobs that weren't queued for a specific CPU can be
+ * stolen. Look at the CPUs on our own chip first. If group is set,
+ * only steal jobs belonging to it.
+ */
+static bool __cpu_steal_job(struct cpu_thread *me,
+			    struct cpu_job_group *group, bool same_chip)
+{
+	struct cpu_thread *cpu;
+	struct cpu_job *job, *found;
+
+	for_each_available_cpu(cpu) {
+		if (cpu == me || (cpu->chip_id == me->chip_id) != same_chip)
+			continue;
+		if (!cpu->in_job || !cpu_check_jobs(cpu))
+			continue;
+
+		found = NULL;
+		lock(&cpu->job_lock);
+		list_for_each(&cpu->job_queue, job, link) {
+			if (job->pinned || job->no_return)
+				continue;
+			if (group && job->group != group)
+				continue;
+			found = job;
+			list_del(&job->link);
+			cpu->job_count--;
+			break;
+		}
+		unlock(&cpu->job_lock);
+
+		if (!found)
+			continue;
+
+		prlog(PR_TRACE, "CPU 0x%x stole job %s from 0x%x\n",
+		      me->pir, found->name, cpu->pir);
+		lock(&me->job_lock);
+		list_add_tail(&me->job_queue, &found->link);
+		me->job_count++;
+		unlock(&me->job_lock);
+		return true;
+	}
+
+	return false;
+}
+
+static bool cpu_steal_job_group(struct cpu_thread *me,
+				struct cpu_job_group *group)
+{
+	if (me->job_has_no_return)
+		return false;
+
+	return __cpu_steal_job(me, group, true) ||
+		__cpu_steal_job(me, group, false);
+}
+
+bool cpu_steal_job(struct cpu_thread *me)
+{
+	return cpu_steal_job_group(me, NULL);
+}
+
+void cpu_wait_job_group(struct cpu_job_group *group)
+{
+	struct cpu_thread *cpu = this_cpu();
+	unsigned long start = mftb();
+
+	for (;;) {
+		sync();
+		if (!group->pending)
+			break;
+
+		/* Rather than just wait, help out with the group's jobs */
+		if (cpu_steal_job_group(cpu, group)) {
+			cpu_process_jobs();
+			continue;
+		}
+
+		/* This will call OPAL pollers for us */
+		time_wait_ms(1);
+	}
+	lwsync();
+
+	if (tb_to_msecs(mftb() - start) > 1000)
+		prlog(PR_DEBUG, "cpu_wait_job_group() for %lums\n",
+		      tb_to_msecs(mftb() - start));
 }
 
 bool cpu_check_jobs(struct cpu_thread *cpu)
@@ -289,8 +494,10 @@ void cpu_process_jobs(void)
 		unlock(&cpu->job_lock);
 		prlog(PR_TRACE, "running job %s on %x\n", job->name, cpu->pir);
 		if (no_return)
-			free(job);
+			cpu_job_free(job);
+		cpu->in_job = true;
 		func(data);
+		cpu->in_job = false;
 		if (!list_empty(&cpu->locks_held)) {
 			prlog(PR_ERR, "OPAL job %s returning with locks held\n",
 			      job->name);
@@ -299,8 +506,7 @@ void cpu_process_jobs(void)
 		lock(&cpu->job_lock);
 		if (!no_return) {
 			cpu->job_count--;
-			lwsync();
-			job->complete = true;
+			cpu_job_complete(job);
 		}
 	}
 	unlock(&cpu->job_lock);
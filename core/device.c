@@ -17,6 +17,7 @@
 #include <device.h>
 #include <stdlib.h>
 #include <skiboot.h>
+#include <lock.h>
 #include <libfdt/libfdt.h>
 #include <libfdt/libfdt_internal.h>
 #include <ccan/str/str.h>
@@ -29,22 +30,375 @@ u32 last_phandle = 0;
 struct dt_node *dt_root;
 struct dt_node *dt_chosen;
 
+/* FNV-1a, names are short so anything fancier doesn't pay */
+static u32 dt_hash(const char *name, size_t len)
+{
+	u32 hash = 2166136261u;
+
+	while (len--)
+		hash = (hash ^ (u8)*name++) * 16777619u;
+	return hash;
+}
+
+/*
+ * Names which aren't in .rodata are interned: the same handful of
+ * property names (and plenty of node names) come up on every node that
+ * is expanded from an fdt or built by hdata, so share one refcounted
+ * copy of each instead of strdup()ing them all.
+ *
+ * Nodes and properties are added from jobs running on several CPUs
+ * (e.g. PHB probing), so the table has its own lock.
+ */
+struct dt_name {
+	struct dt_name *next;
+	u32 hash;
+	u32 refs;
+	char str[];
+};
+
+static struct dt_name **dt_names;
+static unsigned int dt_names_size, dt_names_count;
+static struct lock dt_names_lock = LOCK_UNLOCKED;
+
+static void dt_names_grow(void)
+{
+	unsigned int i, size = dt_names_size ? dt_names_size * 2 : 256;
+	struct dt_name **table, *n;
+
+	table = zalloc(size * sizeof(*table));
+	if (!table) {
+		prerror("Failed to allocate name table\n");
+		abort();
+	}
+	for (i = 0; i < dt_names_size; i++) {
+		while ((n = dt_names[i])) {
+			dt_names[i] = n->next;
+			n->next = table[n->hash & (size - 1)];
+			table[n->hash & (size - 1)] = n;
+		}
+	}
+	free(dt_names);
+	dt_names = table;
+	dt_names_size = size;
+}
+
 static const char *take_name(const char *name)
 {
-	if (!is_rodata(name) && !(name = strdup(name))) {
+	struct dt_name *n, **bucket;
+	size_t len;
+	u32 hash;
+
+	if (is_rodata(name))
+		return name;
+
+	len = strlen(name);
+	hash = dt_hash(name, len);
+
+	lock(&dt_names_lock);
+	if (dt_names_count >= dt_names_size)
+		dt_names_grow();
+	bucket = &dt_names[hash & (dt_names_size - 1)];
+	for (n = *bucket; n; n = n->next) {
+		if (n->hash == hash && !strcmp(n->str, name)) {
+			n->refs++;
+			unlock(&dt_names_lock);
+			return n->str;
+		}
+	}
+
+	n = malloc(sizeof(*n) + len + 1);
+	if (!n) {
 		prerror("Failed to allocate copy of name");
 		abort();
 	}
-	return name;
+	memcpy(n->str, name, len + 1);
+	n->hash = hash;
+	n->refs = 1;
+	n->next = *bucket;
+	*bucket = n;
+	dt_names_count++;
+	unlock(&dt_names_lock);
+
+	return n->str;
 }
 
 static void free_name(const char *name)
 {
-	if (!is_rodata(name))
-		free((char *)name);
+	struct dt_name *n, **pp;
+
+	if (is_rodata(name))
+		return;
+
+	n = (struct dt_name *)(name - offsetof(struct dt_name, str));
+	lock(&dt_names_lock);
+	assert(n->refs);
+	if (--n->refs) {
+		unlock(&dt_names_lock);
+		return;
+	}
+
+	for (pp = &dt_names[n->hash & (dt_names_size - 1)]; *pp != n;
+	     pp = &(*pp)->next)
+		assert(*pp);
+	*pp = n->next;
+	dt_names_count--;
+	unlock(&dt_names_lock);
+	free(n);
+}
+
+/*
+ * Per-node name index for properties and children: open addressed with
+ * linear probing, built when a node reaches DT_INDEX_MIN entries and kept
+ * up to date from then on. Only adding or removing entries touches it, so
+ * lookups never write to the tree. The lists stay authoritative for
+ * ordering.
+ */
+#define DT_INDEX_MIN	16
+
+struct dt_index_ent {
+	u32 hash;
+	void *obj;
+};
+
+struct dt_index {
+	unsigned int mask;
+	unsigned int count;
+	size_t name_off;	/* offset of the name pointer in obj */
+	struct dt_index_ent ent[];
+};
+
+static inline const char *dt_index_name(const struct dt_index *idx,
+					const struct dt_index_ent *e)
+{
+	return *(const char **)((char *)e->obj + idx->name_off);
+}
+
+static struct dt_index *dt_index_alloc(unsigned int size, size_t name_off)
+{
+	struct dt_index *idx;
+
+	idx = zalloc(sizeof(*idx) + size * sizeof(struct dt_index_ent));
+	if (!idx) {
+		prerror("Failed to allocate DT index\n");
+		abort();
+	}
+	idx->mask = size - 1;
+	idx->name_off = name_off;
+	return idx;
+}
+
+static void __dt_index_insert(struct dt_index *idx, u32 hash, void *obj)
+{
+	unsigned int i = hash & idx->mask;
+
+	while (idx->ent[i].obj)
+		i = (i + 1) & idx->mask;
+	idx->ent[i].hash = hash;
+	idx->ent[i].obj = obj;
+	idx->count++;
+}
+
+static void dt_index_add(struct dt_index **idxp, const char *name, void *obj)
+{
+	struct dt_index *idx = *idxp, *new;
+	unsigned int i;
+
+	/* Keep the load under 3/4 */
+	if ((idx->count + 1) * 4 > (idx->mask + 1) * 3) {
+		new = dt_index_alloc((idx->mask + 1) * 2, idx->name_off);
+		for (i = 0; i <= idx->mask; i++)
+			if (idx->ent[i].obj)
+				__dt_index_insert(new, idx->ent[i].hash,
+						  idx->ent[i].obj);
+		free(idx);
+		*idxp = idx = new;
+	}
+	__dt_index_insert(idx, dt_hash(name, strlen(name)), obj);
+}
+
+/* Look up a name which isn't necessarily NUL terminated */
+static struct dt_index_ent *dt_index_find(const struct dt_index *idx,
+					  const char *name, size_t len)
+{
+	u32 hash = dt_hash(name, len);
+	unsigned int i;
+
+	for (i = hash & idx->mask; idx->ent[i].obj; i = (i + 1) & idx->mask) {
+		const char *n = dt_index_name(idx, &idx->ent[i]);
+
+		if (idx->ent[i].hash == hash && !strncmp(n, name, len) &&
+		    n[len] == 0)
+			return (struct dt_index_ent *)&idx->ent[i];
+	}
+	return NULL;
 }
 
-static struct dt_node *new_node(const char *name)
+static void dt_index_del(struct dt_index *idx, const char *name)
+{
+	struct dt_index_ent *e = dt_index_find(idx, name, strlen(name));
+	unsigned int i, j, home;
+
+	assert(e);
+
+	/* Shift back any later entry of the run that may now be unreachable */
+	i = e - idx->ent;
+	for (j = (i + 1) & idx->mask; idx->ent[j].obj; j = (j + 1) & idx->mask) {
+		home = idx->ent[j].hash & idx->mask;
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		idx->ent[i] = idx->ent[j];
+		i = j;
+	}
+	idx->ent[i].obj = NULL;
+	idx->count--;
+}
+
+static inline struct dt_index *prop_index(const struct dt_node *node)
+{
+	return node->prop_index;
+}
+
+static inline struct dt_index *child_index(const struct dt_node *node)
+{
+	return node->child_index;
+}
+
+/* These are called with prop/child already on (or still on) the list */
+static void index_property(struct dt_node *node, struct dt_property *prop)
+{
+	struct dt_property *p;
+
+	node->num_props++;
+	if (node->prop_index) {
+		dt_index_add(&node->prop_index, prop->name, prop);
+	} else if (node->num_props >= DT_INDEX_MIN) {
+		node->prop_index = dt_index_alloc(DT_INDEX_MIN * 2,
+					offsetof(struct dt_property, name));
+		list_for_each(&node->properties, p, list)
+			dt_index_add(&node->prop_index, p->name, p);
+	}
+}
+
+static void unindex_property(struct dt_node *node, struct dt_property *prop)
+{
+	node->num_props--;
+	if (node->prop_index)
+		dt_index_del(node->prop_index, prop->name);
+}
+
+static void index_child(struct dt_node *parent, struct dt_node *child)
+{
+	struct dt_node *c;
+
+	parent->num_children++;
+	if (parent->child_index) {
+		dt_index_add(&parent->child_index, child->name, child);
+	} else if (parent->num_children >= DT_INDEX_MIN) {
+		parent->child_index = dt_index_alloc(DT_INDEX_MIN * 2,
+					offsetof(struct dt_node, name));
+		list_for_each(&parent->children, c, list)
+			dt_index_add(&parent->child_index, c->name, c);
+	}
+}
+
+static void unindex_child(struct dt_node *parent, struct dt_node *child)
+{
+	parent->num_children--;
+	if (parent->child_index)
+		dt_index_del(parent->child_index, child->name);
+}
+
+/*
+ * The live tree is changed from several CPUs, so the journal ring is
+ * protected by dt_journal_lock. Readers of the journal take it with
+ * dt_journal_lock() to get a consistent view of a range of generations.
+ */
+static struct dt_change *dt_journal;
+static u64 dt_journal_last;
+static void (*dt_journal_notify)(u64 gen);
+static struct lock dt_journal_lk = LOCK_UNLOCKED;
+
+void dt_journal_lock(void)
+{
+	lock(&dt_journal_lk);
+}
+
+void dt_journal_unlock(void)
+{
+	unlock(&dt_journal_lk);
+}
+
+void dt_journal_start(void (*notify)(u64 gen))
+{
+	unsigned int i;
+
+	lock(&dt_journal_lk);
+	if (!dt_journal) {
+		dt_journal = zalloc(DT_JOURNAL_SIZE * sizeof(*dt_journal));
+		if (!dt_journal) {
+			unlock(&dt_journal_lk);
+			prerror("DT: Failed to allocate change journal\n");
+			return;
+		}
+	}
+	for (i = 0; i < DT_JOURNAL_SIZE; i++) {
+		if (dt_journal[i].name)
+			free_name(dt_journal[i].name);
+		dt_journal[i].gen = 0;
+		dt_journal[i].name = NULL;
+	}
+	dt_journal_last = 0;
+	dt_journal_notify = notify;
+	unlock(&dt_journal_lk);
+}
+
+u64 dt_journal_gen(void)
+{
+	return dt_journal_last;
+}
+
+const struct dt_change *dt_journal_get(u64 gen)
+{
+	struct dt_change *c;
+
+	if (!dt_journal || !gen)
+		return NULL;
+
+	c = &dt_journal[(gen - 1) % DT_JOURNAL_SIZE];
+	return c->gen == gen ? c : NULL;
+}
+
+/* Only the live tree is journalled, not scratch trees */
+static bool dt_in_live_tree(const struct dt_node *node)
+{
+	while (node->parent)
+		node = node->parent;
+	return node == dt_root;
+}
+
+static void dt_journal_add(enum dt_change_type type,
+			   const struct dt_node *node, const char *name)
+{
+	struct dt_change *c;
+
+	if (!dt_journal || !dt_in_live_tree(node))
+		return;
+
+	lock(&dt_journal_lk);
+	c = &dt_journal[dt_journal_last % DT_JOURNAL_SIZE];
+	if (c->name)
+		free_name(c->name);
+	c->gen = ++dt_journal_last;
+	c->type = type;
+	c->phandle = node->phandle;
+	c->name = name ? take_name(name) : NULL;
+
+	if (dt_journal_notify)
+		dt_journal_notify(c->gen);
+	unlock(&dt_journal_lk);
+}
+
+static struct dt_node *new_node(const char *name, bool phandle)
 {
 	struct dt_node *node = malloc(sizeof *node);
 	if (!node) {
@@ -56,14 +410,18 @@ static struct dt_node *new_node(const char *name)
 	node->parent = NULL;
 	list_head_init(&node->properties);
 	list_head_init(&node->children);
+	node->num_props = 0;
+	node->num_children = 0;
+	node->prop_index = NULL;
+	node->child_index = NULL;
 	/* FIXME: locking? */
-	node->phandle = new_phandle();
+	node->phandle = phandle ? new_phandle() : 0;
 	return node;
 }
 
 struct dt_node *dt_new_root(const char *name)
 {
-	return new_node(name);
+	return new_node(name, true);
 }
 
 static const char *get_unitname(const struct dt_node *node)
@@ -101,6 +459,7 @@ int dt_cmp_subnodes(const struct dt_node *a, const struct dt_node *b)
 
 bool dt_attach_root(struct dt_node *parent, struct dt_node *root)
 {
+	struct dt_index *idx;
 	struct dt_node *node;
 
 	assert(!root->parent);
@@ -108,6 +467,26 @@ bool dt_attach_root(struct dt_node *parent, struct dt_node *root)
 	if (list_empty(&parent->children)) {
 		list_add(&parent->children, &root->list);
 		root->parent = parent;
+		index_child(parent, root);
+		dt_journal_add(DT_CHANGE_NODE_ADD, root, NULL);
+
+		return true;
+	}
+
+	idx = child_index(parent);
+	if (idx && dt_index_find(idx, root->name, strlen(root->name))) {
+		prerror("DT: %s failed, duplicate %s\n",
+			__func__, root->name);
+		return false;
+	}
+
+	/* Nodes are mostly created in order, try the end first */
+	node = list_tail(&parent->children, struct dt_node, list);
+	if (dt_cmp_subnodes(node, root) < 0) {
+		list_add_tail(&parent->children, &root->list);
+		root->parent = parent;
+		index_child(parent, root);
+		dt_journal_add(DT_CHANGE_NODE_ADD, root, NULL);
 
 		return true;
 	}
@@ -130,6 +509,8 @@ bool dt_attach_root(struct dt_node *parent, struct dt_node *root)
 
 	list_add_before(&parent->children, &root->list, &node->list);
 	root->parent = parent;
+	index_child(parent, root);
+	dt_journal_add(DT_CHANGE_NODE_ADD, root, NULL);
 
 	return true;
 }
@@ -140,22 +521,31 @@ static inline void dt_destroy(struct dt_node *dn)
 		return;
 
 	free_name(dn->name);
+	free(dn->prop_index);
+	free(dn->child_index);
 	free(dn);
 }
 	
-struct dt_node *dt_new(struct dt_node *parent, const char *name)
+struct dt_node *__dt_new(struct dt_node *parent, const char *name,
+			 bool phandle)
 {
 	struct dt_node *new;
-	assert(parent);
 
-	new = new_node(name);
-	if (!dt_attach_root(parent, new)) {
+	new = new_node(name, phandle);
+	if (parent && !dt_attach_root(parent, new)) {
 		dt_destroy(new);
 		return NULL;
 	}
 	return new;
 }
 
+struct dt_node *dt_new(struct dt_node *parent, const char *name)
+{
+	assert(parent);
+
+	return __dt_new(parent, name, true);
+}
+
 /*
  * low level variant, we export this because there are "weird" address
  * formats, such as LPC/ISA bus addresses which have a letter to identify
@@ -164,11 +554,32 @@ struct dt_node *dt_new(struct dt_node *parent, const char *name)
 struct dt_node *__dt_find_by_name_addr(struct dt_node *parent, const char *name,
 	const char *addr)
 {
+	struct dt_index *idx;
 	struct dt_node *node;
 
 	if (list_empty(&parent->children))
 		return NULL;
 
+	/*
+	 * An index holds every child, so a miss there means we only need
+	 * to look further down. Node names are at most 31 characters, keys
+	 * that don't fit take the slow path.
+	 */
+	idx = child_index(parent);
+	if (idx) {
+		char full[32 + 17];
+		struct dt_index_ent *e;
+		int len;
+
+		len = snprintf(full, sizeof(full), "%s@%s", name, addr);
+		if (len < sizeof(full)) {
+			e = dt_index_find(idx, full, len);
+			if (e)
+				return e->obj;
+			goto descend;
+		}
+	}
+
 	dt_for_each_child(parent, node) {
 		const char *unit = get_unitname(node);
 		int len;
@@ -186,6 +597,7 @@ struct dt_node *__dt_find_by_name_addr(struct dt_node *parent, const char *name,
 			return node;
 	}
 
+descend:
 	dt_for_each_child(parent, node) {
 		struct dt_node *ret = __dt_find_by_name_addr(node, name, addr);
 
@@ -218,7 +630,7 @@ struct dt_node *dt_new_addr(struct dt_node *parent, const char *name,
 	if (!lname)
 		return NULL;
 	snprintf(lname, len, "%s@%llx", name, (long long)addr);
-	new = new_node(lname);
+	new = new_node(lname, true);
 	free(lname);
 	if (!dt_attach_root(parent, new)) {
 		dt_destroy(new);
@@ -241,7 +653,7 @@ struct dt_node *dt_new_2addr(struct dt_node *parent, const char *name,
 		return NULL;
 	snprintf(lname, len, "%s@%llx,%llx",
 		 name, (long long)addr0, (long long)addr1);
-	new = new_node(lname);
+	new = new_node(lname, true);
 	free(lname);
 	if (!dt_attach_root(parent, new)) {
 		dt_destroy(new);
@@ -364,6 +776,17 @@ struct dt_node *dt_find_by_path(struct dt_node *root, const char *path)
 		if (pnl == 0 && pal == 0)
 			break;
 
+		/* A full name@addr can only ever match exactly */
+		if (pnl && pal && child_index(root)) {
+			struct dt_index_ent *e;
+
+			e = dt_index_find(root->child_index, pn, pnl + 1 + pal);
+			if (!e)
+				return NULL;
+			root = e->obj;
+			continue;
+		}
+
 		/* Compare with each child node */
 		match = false;
 		list_for_each(&root->children, n, list) {
@@ -451,6 +874,8 @@ static struct dt_property *new_property(struct dt_node *node,
 	p->name = take_name(name);
 	p->len = size;
 	list_add_tail(&node->properties, &p->list);
+	index_property(node, p);
+	dt_journal_add(DT_CHANGE_PROP_ADD, node, p->name);
 	return p;
 }
 
@@ -479,15 +904,30 @@ struct dt_property *dt_add_property(struct dt_node *node,
 	return p;
 }
 
-void dt_resize_property(struct dt_property **prop, size_t len)
+void dt_resize_property(struct dt_node *node, struct dt_property **prop,
+			size_t len)
 {
 	size_t new_len = sizeof(**prop) + len;
+	struct dt_property *old = *prop;
+	struct dt_index_ent *e = NULL;
+
+	/* Find the index slot while the old name can still be compared */
+	if (node->prop_index) {
+		e = dt_index_find(node->prop_index, old->name,
+				  strlen(old->name));
+		assert(e && e->obj == old);
+	}
 
 	*prop = realloc(*prop, new_len);
+	if (*prop == old)
+		return;
 
 	/* Fix up linked lists in case we moved. (note: not an empty list). */
 	(*prop)->list.next->prev = &(*prop)->list;
 	(*prop)->list.prev->next = &(*prop)->list;
+
+	if (e)
+		e->obj = *prop;
 }
 
 struct dt_property *dt_add_property_string(struct dt_node *node,
@@ -586,6 +1026,8 @@ struct dt_property *__dt_add_property_strings(struct dt_node *node,
 
 void dt_del_property(struct dt_node *node, struct dt_property *prop)
 {
+	dt_journal_add(DT_CHANGE_PROP_DEL, node, prop->name);
+	unindex_property(node, prop);
 	list_del_from(&node->properties, &prop->list);
 	free_name(prop->name);
 	free(prop);
@@ -642,8 +1084,15 @@ struct dt_node *dt_next(const struct dt_node *root,
 
 struct dt_property *__dt_find_property(struct dt_node *node, const char *name)
 {
+	struct dt_index *idx = prop_index(node);
+	struct dt_index_ent *e;
 	struct dt_property *i;
 
+	if (idx) {
+		e = dt_index_find(idx, name, strlen(name));
+		return e ? e->obj : NULL;
+	}
+
 	list_for_each(&node->properties, i, list)
 		if (strcmp(i->name, name) == 0)
 			return i;
@@ -653,12 +1102,7 @@ struct dt_property *__dt_find_property(struct dt_node *node, const char *name)
 const struct dt_property *dt_find_property(const struct dt_node *node,
 					   const char *name)
 {
-	const struct dt_property *i;
-
-	list_for_each(&node->properties, i, list)
-		if (strcmp(i->name, name) == 0)
-			return i;
-	return NULL;
+	return __dt_find_property((struct dt_node *)node, name);
 }
 
 void dt_check_del_prop(struct dt_node *node, const char *name)
@@ -823,24 +1267,35 @@ u32 dt_prop_get_cell_def(const struct dt_node *node, const char *prop,
 	return dt_property_get_cell(p, cell);
 }
 
-void dt_free(struct dt_node *node)
+/* Only the top of a freed subtree is journalled */
+static void __dt_free(struct dt_node *node, bool journal)
 {
 	struct dt_node *child;
 	struct dt_property *p;
 
+	if (journal && node->parent)
+		dt_journal_add(DT_CHANGE_NODE_DEL, node, NULL);
+
 	while ((child = list_top(&node->children, struct dt_node, list)))
-		dt_free(child);
+		__dt_free(child, false);
 
 	while ((p = list_pop(&node->properties, struct dt_property, list))) {
 		free_name(p->name);
 		free(p);
 	}
 
-	if (node->parent)
+	if (node->parent) {
+		unindex_child(node->parent, node);
 		list_del_from(&node->parent->children, &node->list);
+	}
 	dt_destroy(node);
 }
 
+void dt_free(struct dt_node *node)
+{
+	__dt_free(node, true);
+}
+
 int dt_expand_node(struct dt_node *node, const void *fdt, int fdt_node)
 {
 	const struct fdt_property *prop;
@@ -17,17 +17,17 @@
 #include <skiboot.h>
 #include <stdarg.h>
 #include <libfdt.h>
+#include <libfdt/libfdt_internal.h>
 #include <device.h>
 #include <cpu.h>
 #include <opal.h>
+#include <opal-msg.h>
 #include <interrupts.h>
 #include <fsp.h>
 #include <cec.h>
 #include <vpd.h>
 #include <ccan/str/str.h>
 
-static int fdt_error;
-
 #undef DEBUG_FDT
 #ifdef DEBUG_FDT
 #define FDT_DBG(fmt, a...)	prlog(PR_DEBUG, "FDT: " fmt, ##a)
@@ -35,37 +35,279 @@ static int fdt_error;
 #define FDT_DBG(fmt, a...)
 #endif
 
-static void __save_err(int err, const char *str)
+/*
+ * The tree is flattened in two walks: the first works out the exact size
+ * of the structure block and builds a deduplicated string table, the
+ * second writes the blob straight into a buffer of exactly that size.
+ * That avoids both guessing at a buffer size (and retrying) and libfdt's
+ * sequential write interface, which searches the whole string table
+ * for every property it adds.
+ */
+struct fdt_string {
+	const char *str;
+	u32 hash;
+	u32 off;
+};
+
+struct fdt_layout {
+	const struct dt_node *root;
+	bool exclusive;
+	const struct dt_property *rsv;	/* reserved-ranges, if any */
+	u32 struct_size;
+	u32 strings_size;
+	struct fdt_string *strings;
+	unsigned int strings_mask;
+	unsigned int strings_count;
+};
+
+static u32 fdt_string_hash(const char *str)
+{
+	u32 hash = 2166136261u;
+
+	while (*str)
+		hash = (hash ^ (u8)*str++) * 16777619u;
+	return hash;
+}
+
+static struct fdt_string *fdt_string_find(const struct fdt_layout *l,
+					  const char *str, u32 hash)
 {
-	FDT_DBG("rc: %d from \"%s\"\n", err, str);
-	if (err && !fdt_error) {
-		prerror("FDT: Error %d from \"%s\"\n", err, str);
-		fdt_error = err;
+	unsigned int i;
+
+	for (i = hash & l->strings_mask; l->strings[i].str;
+	     i = (i + 1) & l->strings_mask) {
+		if (l->strings[i].hash == hash &&
+		    (l->strings[i].str == str || !strcmp(l->strings[i].str, str)))
+			return &l->strings[i];
 	}
+	return &l->strings[i];
 }
 
-#define save_err(...) __save_err(__VA_ARGS__, #__VA_ARGS__)
+static bool fdt_string_grow(struct fdt_layout *l)
+{
+	unsigned int i, size = (l->strings_mask + 1) * 2;
+	struct fdt_string *old = l->strings;
+	unsigned int old_mask = l->strings_mask;
+
+	l->strings = zalloc(size * sizeof(*l->strings));
+	if (!l->strings) {
+		l->strings = old;
+		return false;
+	}
+	l->strings_mask = size - 1;
+	for (i = 0; i <= old_mask; i++)
+		if (old[i].str)
+			*fdt_string_find(l, old[i].str, old[i].hash) = old[i];
+	free(old);
+	return true;
+}
 
-static void dt_property_cell(void *fdt, const char *name, u32 cell)
+static bool fdt_string_add(struct fdt_layout *l, const char *str)
 {
-	save_err(fdt_property_cell(fdt, name, cell));
+	u32 hash = fdt_string_hash(str);
+	struct fdt_string *s = fdt_string_find(l, str, hash);
+
+	if (s->str)
+		return true;
+
+	/* Keep the load under 3/4 */
+	if ((l->strings_count + 1) * 4 > (l->strings_mask + 1) * 3) {
+		if (!fdt_string_grow(l))
+			return false;
+		s = fdt_string_find(l, str, hash);
+	}
+	s->str = str;
+	s->hash = hash;
+	s->off = l->strings_size;
+	l->strings_size += strlen(str) + 1;
+	l->strings_count++;
+	return true;
 }
 
-static void dt_begin_node(void *fdt, const struct dt_node *dn)
+static u32 fdt_string_off(const struct fdt_layout *l, const char *str)
 {
-	save_err(fdt_begin_node(fdt, dn->name));
+	struct fdt_string *s = fdt_string_find(l, str, fdt_string_hash(str));
 
-	dt_property_cell(fdt, "phandle", dn->phandle);
+	assert(s->str);
+	return s->off;
 }
 
-static void dt_property(void *fdt, const struct dt_property *p)
+static bool measure_dt_node(struct fdt_layout *l, const struct dt_node *dn,
+			    bool exclusive)
 {
-	save_err(fdt_property(fdt, p->name, p->prop, p->len));
+	const struct dt_property *p;
+	const struct dt_node *i;
+
+	if (!exclusive) {
+		l->struct_size += FDT_TAGSIZE + FDT_TAGALIGN(strlen(dn->name) + 1);
+		if (dn->phandle)
+			l->struct_size += sizeof(struct fdt_property) +
+				sizeof(u32);
+
+		list_for_each(&dn->properties, p, list) {
+			if (strstarts(p->name, DT_PRIVATE))
+				continue;
+			if (!fdt_string_add(l, p->name))
+				return false;
+			l->struct_size += sizeof(struct fdt_property) +
+				FDT_TAGALIGN(p->len);
+		}
+	}
+
+	list_for_each(&dn->children, i, list)
+		if (!measure_dt_node(l, i, false))
+			return false;
+
+	if (!exclusive)
+		l->struct_size += FDT_TAGSIZE;
+
+	return true;
+}
+
+static u32 fdt_layout_rsvmap_size(const struct fdt_layout *l)
+{
+	unsigned int n = 0;
+
+	if (l->rsv)
+		n = l->rsv->len / (sizeof(uint64_t) * 2);
+
+	return (n + 1) * sizeof(struct fdt_reserve_entry);
+}
+
+static u32 fdt_layout_off_struct(const struct fdt_layout *l)
+{
+	return FDT_ALIGN(sizeof(struct fdt_header),
+			 sizeof(struct fdt_reserve_entry)) +
+		fdt_layout_rsvmap_size(l);
+}
+
+/* Returns the size of the blob, or 0 if we ran out of memory */
+static u32 measure_dtb(struct fdt_layout *l, const struct dt_node *root,
+		       bool exclusive)
+{
+	memset(l, 0, sizeof(*l));
+	l->root = root;
+	l->exclusive = exclusive;
+	if (root == dt_root && !exclusive)
+		l->rsv = dt_find_property(root, "reserved-ranges");
+
+	l->strings_mask = 63;
+	l->strings = zalloc((l->strings_mask + 1) * sizeof(*l->strings));
+	if (!l->strings || !fdt_string_add(l, "phandle") ||
+	    !measure_dt_node(l, root, exclusive)) {
+		free(l->strings);
+		l->strings = NULL;
+		return 0;
+	}
+	l->struct_size += FDT_TAGSIZE;	/* FDT_END */
+
+	return fdt_layout_off_struct(l) + l->struct_size + l->strings_size;
 }
 
-static void dt_end_node(void *fdt)
+static void *fdt_put_tag(void *p, u32 tag)
 {
-	save_err(fdt_end_node(fdt));
+	*(uint32_t *)p = cpu_to_fdt32(tag);
+	return p + FDT_TAGSIZE;
+}
+
+static void *fdt_put_prop(void *p, u32 nameoff, const void *val, u32 len)
+{
+	struct fdt_property *prop = p;
+
+	prop->tag = cpu_to_fdt32(FDT_PROP);
+	prop->len = cpu_to_fdt32(len);
+	prop->nameoff = cpu_to_fdt32(nameoff);
+	memcpy(prop->data, val, len);
+	memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
+
+	return p + sizeof(*prop) + FDT_TAGALIGN(len);
+}
+
+static void *flatten_dt_node(const struct fdt_layout *l, void *p,
+			     const struct dt_node *dn, bool exclusive)
+{
+	const struct dt_property *prop;
+	const struct dt_node *i;
+	uint32_t phandle;
+	size_t len;
+
+	if (!exclusive) {
+		FDT_DBG("node: %s\n", dn->name);
+		p = fdt_put_tag(p, FDT_BEGIN_NODE);
+		len = strlen(dn->name) + 1;
+		memcpy(p, dn->name, len);
+		memset(p + len, 0, FDT_TAGALIGN(len) - len);
+		p += FDT_TAGALIGN(len);
+
+		/* Scratch nodes (eg. in a delta) have none */
+		if (dn->phandle) {
+			phandle = cpu_to_fdt32(dn->phandle);
+			p = fdt_put_prop(p, fdt_string_off(l, "phandle"),
+					 &phandle, sizeof(phandle));
+		}
+
+		list_for_each(&dn->properties, prop, list) {
+			if (strstarts(prop->name, DT_PRIVATE))
+				continue;
+
+			FDT_DBG("  prop: %s size: %ld\n", prop->name, prop->len);
+			p = fdt_put_prop(p, fdt_string_off(l, prop->name),
+					 prop->prop, prop->len);
+		}
+	}
+
+	list_for_each(&dn->children, i, list)
+		p = flatten_dt_node(l, p, i, false);
+
+	if (!exclusive)
+		p = fdt_put_tag(p, FDT_END_NODE);
+
+	return p;
+}
+
+/* Write the blob measured by measure_dtb() and free the layout */
+static void __create_dtb(void *fdt, u32 size, struct fdt_layout *l)
+{
+	struct fdt_reserve_entry *re;
+	const uint64_t *ranges;
+	unsigned int i;
+	void *p;
+
+	memset(fdt, 0, sizeof(struct fdt_header));
+	fdt_set_magic(fdt, FDT_MAGIC);
+	fdt_set_version(fdt, FDT_LAST_SUPPORTED_VERSION);
+	fdt_set_last_comp_version(fdt, FDT_FIRST_SUPPORTED_VERSION);
+	fdt_set_totalsize(fdt, size);
+	fdt_set_off_mem_rsvmap(fdt, FDT_ALIGN(sizeof(struct fdt_header),
+					      sizeof(struct fdt_reserve_entry)));
+	fdt_set_off_dt_struct(fdt, fdt_layout_off_struct(l));
+	fdt_set_size_dt_struct(fdt, l->struct_size);
+	fdt_set_off_dt_strings(fdt, fdt_layout_off_struct(l) + l->struct_size);
+	fdt_set_size_dt_strings(fdt, l->strings_size);
+
+	/* Duplicate the reserved-ranges property into the fdt reservemap */
+	re = fdt + fdt_off_mem_rsvmap(fdt);
+	if (l->rsv) {
+		ranges = (const void *)l->rsv->prop;
+		for (i = 0; i < l->rsv->len / (sizeof(uint64_t) * 2); i++, re++) {
+			re->address = cpu_to_fdt64(*(ranges++));
+			re->size = cpu_to_fdt64(*(ranges++));
+		}
+	}
+	re->address = 0;
+	re->size = 0;
+
+	p = flatten_dt_node(l, fdt + fdt_off_dt_struct(fdt), l->root,
+			    l->exclusive);
+	p = fdt_put_tag(p, FDT_END);
+	assert(p == fdt + fdt_off_dt_strings(fdt));
+
+	for (i = 0; i <= l->strings_mask; i++)
+		if (l->strings[i].str)
+			strcpy(p + l->strings[i].off, l->strings[i].str);
+
+	free(l->strings);
+	l->strings = NULL;
 }
 
 #ifdef DEBUG_FDT
@@ -112,148 +354,379 @@ static void dump_fdt(void *fdt)
 static inline void dump_fdt(void *fdt __unused) { }
 #endif
 
-static void flatten_dt_properties(void *fdt, const struct dt_node *dn)
+void *create_dtb(const struct dt_node *root, bool exclusive)
 {
-	const struct dt_property *p;
-
-	list_for_each(&dn->properties, p, list) {
-		if (strstarts(p->name, DT_PRIVATE))
-			continue;
+	struct fdt_layout layout;
+	void *fdt;
+	u32 size;
+
+	size = measure_dtb(&layout, root, exclusive);
+	if (!size) {
+		prerror("dtb: could not measure device tree\n");
+		return NULL;
+	}
 
-		FDT_DBG("  prop: %s size: %ld\n", p->name, p->len);
-		dt_property(fdt, p);
+	fdt = malloc(size);
+	if (!fdt) {
+		prerror("dtb: could not malloc %lu\n", (long)size);
+		free(layout.strings);
+		return NULL;
 	}
+
+	__create_dtb(fdt, size, &layout);
+	dump_fdt(fdt);
+
+	return fdt;
 }
 
-static void flatten_dt_node(void *fdt, const struct dt_node *root,
-			    bool exclusive)
+static int64_t opal_get_device_tree(uint32_t phandle,
+				    uint64_t buf, uint64_t len)
 {
-	const struct dt_node *i;
+	struct fdt_layout layout;
+	struct dt_node *root;
+	void *fdt = (void *)buf;
+	u32 size;
 
-	if (!exclusive) {
-		FDT_DBG("node: %s\n", root->name);
-		dt_begin_node(fdt, root);
-		flatten_dt_properties(fdt, root);
+	if (!opal_addr_valid(fdt))
+		return OPAL_PARAMETER;
+
+	root = dt_find_by_phandle(dt_root, phandle);
+	if (!root)
+		return OPAL_PARAMETER;
+
+	/* Only asking for the size, no need to build it */
+	if (!fdt) {
+		size = measure_dtb(&layout, root, true);
+		if (!size)
+			return OPAL_INTERNAL_ERROR;
+		free(layout.strings);
+		return size;
 	}
 
-	list_for_each(&root->children, i, list)
-		flatten_dt_node(fdt, i, false);
+	if (!len)
+		return OPAL_PARAMETER;
 
-	if (!exclusive)
-		dt_end_node(fdt);
+	size = measure_dtb(&layout, root, true);
+	if (!size)
+		return OPAL_EMPTY;
+	if (size > len) {
+		free(layout.strings);
+		return OPAL_NO_MEM;
+	}
+
+	__create_dtb(fdt, size, &layout);
+
+	return OPAL_SUCCESS;
 }
+opal_call(OPAL_GET_DEVICE_TREE, opal_get_device_tree, 3);
 
-static void create_dtb_reservemap(void *fdt, const struct dt_node *root)
+/*
+ * Device tree deltas: once the OS has its tree, changes to dt_root are
+ * journalled (see dt_journal_start()) and OPAL_GET_DEVICE_TREE_DELTA
+ * hands back everything changed since a given generation as an overlay.
+ * The first change after the OS last fetched a delta raises an
+ * OPAL_MSG_DT_UPDATE so it knows to come and get the next one.
+ */
+static bool dt_delta_notified;
+
+static void dt_delta_notify(u64 gen)
 {
-	uint64_t base, size;
-	const uint64_t *ranges;
-	const struct dt_property *prop;
-	int i;
+	if (dt_delta_notified)
+		return;
+	dt_delta_notified = true;
+	opal_queue_msg(OPAL_MSG_DT_UPDATE, NULL, NULL, gen);
+}
 
-	/* Duplicate the reserved-ranges property into the fdt reservemap */
-	prop = dt_find_property(root, "reserved-ranges");
-	if (prop) {
-		ranges = (const void *)prop->prop;
-
-		for (i = 0; i < prop->len / (sizeof(uint64_t) * 2); i++) {
-			base = *(ranges++);
-			size = *(ranges++);
-			save_err(fdt_add_reservemap_entry(fdt, base, size));
-		}
-	}
+void dt_delta_init(void)
+{
+	dt_delta_notified = false;
+	dt_journal_start(dt_delta_notify);
+}
 
-	save_err(fdt_finish_reservemap(fdt));
+/* Everything the journal says about one node, keyed by phandle */
+struct dt_delta_ent {
+	u32 phandle;
+	bool added;
+	bool deleted;
+	struct dt_node *node;		/* still in the tree */
+	struct dt_node *overlay;	/* its __overlay__ in the delta */
+};
+
+struct dt_delta {
+	struct dt_node *root;
+	struct dt_delta_ent *ents;
+	unsigned int mask;
+	unsigned int fragments;
+	u32 *deleted;
+	unsigned int num_deleted;
+};
+
+static struct dt_delta_ent *__dt_delta_ent(struct dt_delta *d, u32 phandle)
+{
+	unsigned int i;
+
+	for (i = (phandle * 2654435761u) & d->mask; d->ents[i].phandle;
+	     i = (i + 1) & d->mask)
+		if (d->ents[i].phandle == phandle)
+			break;
+	return &d->ents[i];
 }
 
-static int __create_dtb(void *fdt, size_t len,
-			const struct dt_node *root,
-			bool exclusive)
+static struct dt_delta_ent *dt_delta_find(struct dt_delta *d, u32 phandle)
 {
-	fdt_create(fdt, len);
-	if (root == dt_root && !exclusive)
-		create_dtb_reservemap(fdt, root);
-	else
-		fdt_finish_reservemap(fdt);
+	struct dt_delta_ent *e = __dt_delta_ent(d, phandle);
+
+	return e->phandle ? e : NULL;
+}
+
+static struct dt_delta_ent *dt_delta_ent(struct dt_delta *d, u32 phandle)
+{
+	struct dt_delta_ent *e = __dt_delta_ent(d, phandle);
+
+	e->phandle = phandle;
+	return e;
+}
 
-	flatten_dt_node(fdt, root, exclusive);
+/* Copy a new node into the delta, keeping its phandles */
+static bool dt_delta_copy(struct dt_node *parent, const struct dt_node *node)
+{
+	const struct dt_property *p;
+	const struct dt_node *child;
+	struct dt_node *copy;
+
+	copy = __dt_new(parent, node->name, false);
+	if (!copy)
+		return false;
+	copy->phandle = node->phandle;
+
+	list_for_each(&node->properties, p, list)
+		dt_add_property(copy, p->name, p->prop, p->len);
+	list_for_each(&node->children, child, list)
+		if (!dt_delta_copy(copy, child))
+			return false;
+	return true;
+}
 
-	save_err(fdt_finish(fdt));
-	if (fdt_error) {
-		prerror("dtb: error %s\n", fdt_strerror(fdt_error));
-		return fdt_error;
+static struct dt_node *dt_delta_overlay(struct dt_delta *d,
+					struct dt_delta_ent *e)
+{
+	char name[sizeof("fragment@") + 8];
+	struct dt_node *frag;
+
+	if (e->overlay)
+		return e->overlay;
+
+	snprintf(name, sizeof(name), "fragment@%x", d->fragments++);
+	frag = __dt_new(d->root, name, false);
+	assert(frag);
+	dt_add_property_cells(frag, "target", e->phandle);
+	e->overlay = __dt_new(frag, "__overlay__", false);
+	assert(e->overlay);
+
+	return e->overlay;
+}
+
+static void dt_delta_del_prop(struct dt_node *overlay, const char *name)
+{
+	struct dt_node *frag = overlay->parent;
+	struct dt_property *p;
+	size_t len;
+
+	p = __dt_find_property(frag, "ibm,deleted-properties");
+	if (!p) {
+		dt_add_property_string(frag, "ibm,deleted-properties", name);
+		return;
 	}
+	if (dt_prop_find_string(p, name))
+		return;
 
-	dump_fdt(fdt);
-	return 0;
+	len = p->len;
+	dt_resize_property(frag, &p, len + strlen(name) + 1);
+	strcpy(p->prop + len, name);
+	p->len = len + strlen(name) + 1;
 }
 
-void *create_dtb(const struct dt_node *root, bool exclusive)
+static bool dt_delta_has_new_ancestor(struct dt_delta *d,
+				      const struct dt_node *node)
 {
-	void *fdt = NULL;
-	size_t len = DEVICE_TREE_MAX_SIZE;
-	uint32_t old_last_phandle = get_last_phandle();
-	int ret;
-
-	do {
-		set_last_phandle(old_last_phandle);
-		fdt_error = 0;
-		fdt = malloc(len);
-		if (!fdt) {
-			prerror("dtb: could not malloc %lu\n", (long)len);
-			return NULL;
-		}
+	struct dt_delta_ent *e;
+
+	for (node = node->parent; node; node = node->parent) {
+		e = dt_delta_find(d, node->phandle);
+		if (e && e->added)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Build the delta covering generations (since, dt_journal_gen()] as a
+ * scratch tree:
+ *
+ *  / {
+ *	ibm,dt-generation = <generation covered up to>;
+ *	ibm,deleted-phandles = <nodes removed>;
+ *	fragment@N {
+ *		target = <phandle of a node in the OS's tree>;
+ *		ibm,deleted-properties = "...";
+ *		__overlay__ { properties and new subtrees };
+ *	};
+ *  };
+ *
+ * Returns NULL with *rc set if there's nothing we can give.
+ */
+static struct dt_node *dt_delta_build(u64 since, int64_t *rc)
+{
+	u64 gen, last = dt_journal_gen();
+	const struct dt_change *c;
+	struct dt_delta_ent *e;
+	struct dt_node *n, *overlay;
+	const struct dt_property *p;
+	struct dt_delta d;
+	unsigned int i, size;
+
+	if (since > last) {
+		*rc = OPAL_PARAMETER;
+		return NULL;
+	}
+	if (since < last && !dt_journal_get(since + 1)) {
+		*rc = OPAL_WRONG_STATE;
+		return NULL;
+	}
+
+	memset(&d, 0, sizeof(d));
+	for (size = 64; size < (last - since) * 4; size <<= 1)
+		;
+	d.mask = size - 1;
+	d.ents = zalloc(size * sizeof(*d.ents));
+	d.deleted = zalloc((last - since + 1) * sizeof(*d.deleted));
+	if (!d.ents || !d.deleted) {
+		free(d.ents);
+		free(d.deleted);
+		*rc = OPAL_NO_MEM;
+		return NULL;
+	}
 
-		ret = __create_dtb(fdt, len, root, exclusive);
-		if (ret) {
-			free(fdt);
-			fdt = NULL;
+	/* What happened to each node, and which are still around */
+	for (gen = since + 1; gen <= last; gen++) {
+		c = dt_journal_get(gen);
+		e = dt_delta_ent(&d, c->phandle);
+		if (c->type == DT_CHANGE_NODE_ADD)
+			e->added = true;
+		else if (c->type == DT_CHANGE_NODE_DEL)
+			e->deleted = true;
+	}
+	e = dt_delta_find(&d, dt_root->phandle);
+	if (e)
+		e->node = dt_root;
+	dt_for_each_node(dt_root, n) {
+		e = dt_delta_find(&d, n->phandle);
+		if (e)
+			e->node = n;
+	}
+
+	/* Scratch nodes take no phandles, other CPUs may be allocating */
+	d.root = __dt_new(NULL, "", false);
+	dt_add_property_u64(d.root, "ibm,dt-generation", last);
+
+	for (gen = since + 1; gen <= last; gen++) {
+		c = dt_journal_get(gen);
+		e = dt_delta_ent(&d, c->phandle);
+		n = e->node;
+
+		switch (c->type) {
+		case DT_CHANGE_NODE_ADD:
+			/* Already sent, gone again, or part of a new subtree */
+			if (!n || e->overlay || dt_delta_has_new_ancestor(&d, n))
+				break;
+			overlay = dt_delta_overlay(&d,
+					dt_delta_ent(&d, n->parent->phandle));
+			dt_delta_copy(overlay, n);
+			e->overlay = overlay;
+			break;
+		case DT_CHANGE_NODE_DEL:
+			/* The OS never saw nodes added since */
+			if (!n && !e->added) {
+				for (i = 0; i < d.num_deleted; i++)
+					if (d.deleted[i] == c->phandle)
+						break;
+				if (i == d.num_deleted)
+					d.deleted[d.num_deleted++] = c->phandle;
+			}
+			break;
+		case DT_CHANGE_PROP_ADD:
+		case DT_CHANGE_PROP_DEL:
+			/* Send the property as it is now */
+			if (!n || e->added || dt_delta_has_new_ancestor(&d, n))
+				break;
+			overlay = dt_delta_overlay(&d, e);
+			p = dt_find_property(n, c->name);
+			if (!p)
+				dt_delta_del_prop(overlay, c->name);
+			else if (!dt_find_property(overlay, c->name))
+				dt_add_property(overlay, p->name, p->prop,
+						p->len);
+			break;
 		}
+	}
 
-		len *= 2;
-	} while (ret == -FDT_ERR_NOSPACE);
+	for (i = 0; i < d.num_deleted; i++)
+		d.deleted[i] = cpu_to_fdt32(d.deleted[i]);
+	if (d.num_deleted)
+		dt_add_property(d.root, "ibm,deleted-phandles", d.deleted,
+				d.num_deleted * sizeof(u32));
 
-	return fdt;
+	free(d.ents);
+	free(d.deleted);
+
+	return d.root;
 }
 
-static int64_t opal_get_device_tree(uint32_t phandle,
-				    uint64_t buf, uint64_t len)
+static int64_t opal_get_device_tree_delta(uint64_t since, uint64_t buf,
+					  uint64_t len)
 {
 	struct dt_node *root;
 	void *fdt = (void *)buf;
-	uint32_t old_last_phandle;
-	int64_t totalsize;
-	int ret;
+	int64_t rc = OPAL_SUCCESS;
+	void *delta;
+	u32 size;
 
 	if (!opal_addr_valid(fdt))
 		return OPAL_PARAMETER;
 
-	root = dt_find_by_phandle(dt_root, phandle);
-	if (!root)
-		return OPAL_PARAMETER;
-
-	if (!fdt) {
-		fdt = create_dtb(root, true);
-		if (!fdt)
-			return OPAL_INTERNAL_ERROR;
-		totalsize = fdt_totalsize(fdt);
-		free(fdt);
-		return totalsize;
+	/*
+	 * The journal lock keeps the generations we look at from being
+	 * recycled and serialises against the notification state below.
+	 * It doesn't stop other CPUs changing the tree: a change is made
+	 * before it is journalled and the delta reads the live nodes, so
+	 * it may already include changes of later generations.
+	 */
+	dt_journal_lock();
+	root = dt_delta_build(since, &rc);
+	if (!root) {
+		dt_journal_unlock();
+		return rc;
+	}
+	delta = create_dtb(root, false);
+	dt_free(root);
+	if (!delta) {
+		dt_journal_unlock();
+		return OPAL_INTERNAL_ERROR;
 	}
 
-	if (!len)
-		return OPAL_PARAMETER;
-
-	fdt_error = 0;
-	old_last_phandle = get_last_phandle();
-	ret = __create_dtb(fdt, len, root, true);
-	if (ret) {
-		set_last_phandle(old_last_phandle);
-		if (ret == -FDT_ERR_NOSPACE)
-			return OPAL_NO_MEM;
-
-		return OPAL_EMPTY;
+	size = fdt_totalsize(delta);
+	if (!fdt)
+		rc = size;
+	else if (size > len)
+		rc = OPAL_NO_MEM;
+	else {
+		memcpy(fdt, delta, size);
+		/* Tell them again when something else changes */
+		dt_delta_notified = false;
 	}
+	dt_journal_unlock();
+	free(delta);
 
-	return OPAL_SUCCESS;
+	return rc;
 }
-opal_call(OPAL_GET_DEVICE_TREE, opal_get_device_tree, 3);
+opal_call(OPAL_GET_DEVICE_TREE_DELTA, opal_get_device_tree_delta, 3);
@@ -15,6 +15,7 @@
  */
 
 #include <skiboot.h>
+#include <inttypes.h>
 #include <cpu.h>
 #include <lock.h>
 #include <opal.h>
@@ -28,6 +29,41 @@
 #include <libstb/secureboot.h>
 #include <libstb/trustedboot.h>
 #include <elf.h>
+#include <timer.h>
+#include <timebase.h>
+
+enum flash_op {
+	FLASH_OP_READ,
+	FLASH_OP_WRITE,
+	FLASH_OP_ERASE,
+};
+
+/*
+ * OPAL_FLASH_READ/WRITE/ERASE return straight away and the work is done
+ * from a timer, FLASH_ASYNC_CHUNK bytes (or one erase block) per run, so
+ * neither the OPAL call nor any timer run keeps a CPU in firmware for
+ * long. The timer is re-armed FLASH_ASYNC_DELAY_MS into the future: one
+ * that is already due would be run again by the same check_timers().
+ * Backends that are temporarily unavailable (FLASH_ERR_AGAIN) are
+ * retried a few times before giving up.
+ */
+#define FLASH_ASYNC_CHUNK	0x4000
+#define FLASH_ASYNC_DELAY_MS	1
+#define FLASH_ASYNC_RETRIES	16
+#define FLASH_ASYNC_RETRY_MS	10
+
+struct flash_async_info {
+	struct timer		poller;
+	bool			active;
+	bool			cancel;
+	enum flash_op		op;
+	uint64_t		token;
+	uint64_t		pos;
+	uint64_t		len;
+	uint64_t		buf;
+	uint64_t		done;
+	int			retries;
+};
 
 struct flash {
 	struct list_node	list;
@@ -37,14 +73,27 @@ struct flash {
 	uint64_t		size;
 	uint32_t		block_size;
 	int			id;
+	struct flash_async_info	async;
 };
 
+/*
+ * Read cache in front of each flash. Partition lookups, NVRAM and resource
+ * loading tend to re-read the same few blocks. It only lives until the OS
+ * is booted: after that the BMC may reflash the PNOR behind our back and
+ * only some backends would tell us.
+ */
+#define FLASH_CACHE_SIZE	0x20000
+#define FLASH_CACHE_READAHEAD	1
+
 static LIST_HEAD(flashes);
 static struct flash *system_flash;
 
 /* Using a single lock as we only have one flash at present. */
 static struct lock flash_lock;
 
+/* Set once the caches are dropped, protected by flash_lock */
+static bool flash_no_cache;
+
 /* nvram-on-flash support */
 static struct flash *nvram_flash;
 static u32 nvram_offset, nvram_size;
@@ -69,10 +118,35 @@ bool flash_reserve(void)
 	return rc;
 }
 
+/* Must be called with flash_lock held */
+static void flash_drop_cache(struct flash *flash)
+{
+	if (flash_no_cache && !flash->busy)
+		blocklevel_cache_free(flash->bl);
+}
+
 void flash_release(void)
 {
 	lock(&flash_lock);
 	system_flash->busy = false;
+	/* Whoever had the flash may have changed it */
+	blocklevel_cache_invalidate(system_flash->bl);
+	flash_drop_cache(system_flash);
+	unlock(&flash_lock);
+}
+
+/*
+ * Called before handing over to the OS. A flash that is busy right now
+ * loses its cache when the operation completes.
+ */
+void flash_cache_disable(void)
+{
+	struct flash *flash;
+
+	lock(&flash_lock);
+	flash_no_cache = true;
+	list_for_each(&flashes, flash, list)
+		flash_drop_cache(flash);
 	unlock(&flash_lock);
 }
 
@@ -383,6 +457,104 @@ static int num_flashes(void)
 	return i;
 }
 
+static void flash_async_complete(struct flash *flash, int64_t rc)
+{
+	struct flash_async_info *async = &flash->async;
+	uint64_t token = async->token, done = async->done;
+
+	/*
+	 * This runs from the timer, which can't sync with itself. Just make
+	 * sure it isn't pending: with active clear a late run does nothing.
+	 */
+	cancel_timer_async(&async->poller);
+
+	/* A new op may start as soon as the lock is dropped */
+	lock(&flash_lock);
+	async->active = false;
+	flash->busy = false;
+	flash_drop_cache(flash);
+	unlock(&flash_lock);
+
+	opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, NULL, token, rc, done);
+}
+
+/*
+ * The flash is marked busy for the whole operation, nothing else touches
+ * it or the async state, so the flash work is done without flash_lock.
+ */
+static void flash_async_poll(struct timer *t __unused, void *data,
+		uint64_t now __unused)
+{
+	struct flash *flash = data;
+	struct flash_async_info *async = &flash->async;
+	uint64_t len;
+	int rc;
+
+	/* Nothing to do, the op completed before this run was cancelled */
+	if (!async->active)
+		return;
+
+	if (async->cancel) {
+		prlog(PR_DEBUG, "FLASH: op %d cancelled at 0x%" PRIx64 "\n",
+				async->op, async->pos);
+		flash_async_complete(flash, OPAL_PARTIAL);
+		return;
+	}
+
+	if (async->op == FLASH_OP_ERASE)
+		len = flash->block_size;
+	else
+		len = FLASH_ASYNC_CHUNK;
+	len = MIN(len, async->len);
+
+	/*
+	 * These ops intentionally have no smarts (ecc correction or erase
+	 * before write) to them.
+	 * Skiboot is simply exposing the PNOR flash to the host.
+	 * The host is expected to understand that this is a raw flash
+	 * device and treat it as such.
+	 */
+	switch (async->op) {
+	case FLASH_OP_READ:
+		rc = blocklevel_raw_read(flash->bl, async->pos,
+				(void *)async->buf, len);
+		break;
+	case FLASH_OP_WRITE:
+		rc = blocklevel_raw_write(flash->bl, async->pos,
+				(void *)async->buf, len);
+		break;
+	case FLASH_OP_ERASE:
+		rc = blocklevel_erase(flash->bl, async->pos, len);
+		break;
+	default:
+		assert(0);
+	}
+
+	if (rc == FLASH_ERR_AGAIN && async->retries++ < FLASH_ASYNC_RETRIES) {
+		schedule_timer(&async->poller,
+				msecs_to_tb(FLASH_ASYNC_RETRY_MS));
+		return;
+	}
+	if (rc) {
+		prlog(PR_ERR, "FLASH: op %d failed at 0x%" PRIx64 ": %d\n",
+				async->op, async->pos, rc);
+		flash_async_complete(flash, OPAL_HARDWARE);
+		return;
+	}
+
+	async->retries = 0;
+	async->pos += len;
+	async->buf += len;
+	async->len -= len;
+	async->done += len;
+	if (!async->len) {
+		flash_async_complete(flash, OPAL_SUCCESS);
+		return;
+	}
+
+	schedule_timer(&async->poller, msecs_to_tb(FLASH_ASYNC_DELAY_MS));
+}
+
 int flash_register(struct blocklevel_device *bl)
 {
 	uint64_t size;
@@ -398,7 +570,7 @@ int flash_register(struct blocklevel_device *bl)
 		return rc;
 
 	prlog(PR_INFO, "FLASH: registering flash device %s "
-			"(size 0x%llx, blocksize 0x%x)\n",
+			"(size 0x%" PRIx64 ", blocksize 0x%x)\n",
 			name ?: "(unnamed)", size, block_size);
 
 	lock(&flash_lock);
@@ -416,6 +588,18 @@ int flash_register(struct blocklevel_device *bl)
 	flash->size = size;
 	flash->block_size = block_size;
 	flash->id = num_flashes();
+	flash->async.active = false;
+	init_timer(&flash->async.poller, flash_async_poll, flash);
+
+	/* Not fatal, the flash just works uncached */
+	if (!flash_no_cache) {
+		rc = blocklevel_cache_init(bl,
+				MAX(2u, FLASH_CACHE_SIZE / MAX(block_size, 0x1000u)),
+				FLASH_CACHE_READAHEAD);
+		if (rc)
+			prlog(PR_WARNING, "FLASH: Couldn't set up read cache: %d\n",
+					rc);
+	}
 
 	list_add(&flashes, &flash->list);
 
@@ -444,12 +628,6 @@ int flash_register(struct blocklevel_device *bl)
 	return OPAL_SUCCESS;
 }
 
-enum flash_op {
-	FLASH_OP_READ,
-	FLASH_OP_WRITE,
-	FLASH_OP_ERASE,
-};
-
 static int64_t opal_flash_op(enum flash_op op, uint64_t id, uint64_t offset,
 		uint64_t buf, uint64_t size, uint64_t token)
 {
@@ -474,41 +652,26 @@ static int64_t opal_flash_op(enum flash_op op, uint64_t id, uint64_t offset,
 		goto err;
 	}
 
-	if (size >= flash->size || offset >= flash->size
+	if (!size || size >= flash->size || offset >= flash->size
 			|| offset + size > flash->size) {
 		rc = OPAL_PARAMETER;
 		goto err;
 	}
 
-	/*
-	 * These ops intentionally have no smarts (ecc correction or erase
-	 * before write) to them.
-	 * Skiboot is simply exposing the PNOR flash to the host.
-	 * The host is expected to understand that this is a raw flash
-	 * device and treat it as such.
-	 */
-	switch (op) {
-	case FLASH_OP_READ:
-		rc = blocklevel_raw_read(flash->bl, offset, (void *)buf, size);
-		break;
-	case FLASH_OP_WRITE:
-		rc = blocklevel_raw_write(flash->bl, offset, (void *)buf, size);
-		break;
-	case FLASH_OP_ERASE:
-		rc = blocklevel_erase(flash->bl, offset, size);
-		break;
-	default:
-		assert(0);
-	}
-
-	if (rc) {
-		rc = OPAL_HARDWARE;
-		goto err;
-	}
+	flash->busy = true;
+	flash->async.active = true;
+	flash->async.cancel = false;
+	flash->async.op = op;
+	flash->async.token = token;
+	flash->async.pos = offset;
+	flash->async.len = size;
+	flash->async.buf = buf;
+	flash->async.done = 0;
+	flash->async.retries = 0;
+	schedule_timer(&flash->async.poller, 0);
 
 	unlock(&flash_lock);
 
-	opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, NULL, token, rc);
 	return OPAL_ASYNC_COMPLETION;
 
 err:
@@ -544,17 +707,40 @@ opal_call(OPAL_FLASH_READ, opal_flash_read, 5);
 opal_call(OPAL_FLASH_WRITE, opal_flash_write, 5);
 opal_call(OPAL_FLASH_ERASE, opal_flash_erase, 4);
 
+static int64_t opal_flash_cancel(uint64_t id, uint64_t token)
+{
+	struct flash *flash;
+	int64_t rc = OPAL_PARAMETER;
+
+	lock(&flash_lock);
+	list_for_each(&flashes, flash, list) {
+		if (flash->id != id)
+			continue;
+		if (flash->async.active && flash->async.token == token) {
+			/* Stops at the next chunk, before any more I/O */
+			flash->async.cancel = true;
+			rc = OPAL_SUCCESS;
+		}
+		break;
+	}
+	unlock(&flash_lock);
+
+	return rc;
+}
+opal_call(OPAL_FLASH_CANCEL, opal_flash_cancel, 2);
+
 /* flash resource API */
 static struct {
 	enum resource_id	id;
 	uint32_t		subid;
 	char			name[PART_NAME_MAX+1];
+	int			prio; /* Preload order, lowest first */
 } part_name_map[] = {
-	{ RESOURCE_ID_KERNEL,	RESOURCE_SUBID_NONE,		"BOOTKERNEL" },
-	{ RESOURCE_ID_INITRAMFS,RESOURCE_SUBID_NONE,		"ROOTFS" },
-	{ RESOURCE_ID_CAPP,	RESOURCE_SUBID_SUPPORTED,	"CAPP" },
-	{ RESOURCE_ID_IMA_CATALOG,  RESOURCE_SUBID_SUPPORTED,	"IMA_CATALOG" },
-	{ RESOURCE_ID_VERSION,	RESOURCE_SUBID_NONE,		"VERSION" },
+	{ RESOURCE_ID_KERNEL,	RESOURCE_SUBID_NONE,		"BOOTKERNEL",	0 },
+	{ RESOURCE_ID_INITRAMFS,RESOURCE_SUBID_NONE,		"ROOTFS",	1 },
+	{ RESOURCE_ID_CAPP,	RESOURCE_SUBID_SUPPORTED,	"CAPP",		2 },
+	{ RESOURCE_ID_IMA_CATALOG,  RESOURCE_SUBID_SUPPORTED,	"IMA_CATALOG",	2 },
+	{ RESOURCE_ID_VERSION,	RESOURCE_SUBID_NONE,		"VERSION",	3 },
 };
 
 const char *flash_map_resource_name(enum resource_id id)
@@ -604,9 +790,14 @@ static size_t sizeof_elf_from_hdr(void *buf)
  * For trusted boot, the whole partition containing the subpart is measured.
  *
  * Additionally, the logic to work out how much to read from flash is insane.
+ *
+ * Verifying and measuring is left to flash_verify_resource() so it can
+ * run without holding the flash. For a subpartition *subpart and
+ * *subpart_len say where it ended up in buf.
  */
-static int flash_load_resource(enum resource_id id, uint32_t subid,
-			       void *buf, size_t *len)
+static int flash_read_resource(enum resource_id id, uint32_t subid,
+			       void *buf, size_t *len, void **subpart,
+			       size_t *subpart_len)
 {
 	int i;
 	int rc = OPAL_RESOURCE;
@@ -813,19 +1004,8 @@ static int flash_load_resource(enum resource_id id, uint32_t subid,
 	}
 
 done_reading:
-	/*
-	 * Verify and measure the retrieved PNOR partition as part of the
-	 * secure boot and trusted boot requirements
-	 */
-	secureboot_verify(id, buf, *len);
-	trustedboot_measure(id, buf, *len);
-
-	/* Find subpartition */
-	if (subid != RESOURCE_SUBID_NONE) {
-		memmove(buf, bufp, content_size);
-		*len = content_size;
-	}
-
+	*subpart = bufp;
+	*subpart_len = content_size;
 	status = true;
 
 out_free_ffs:
@@ -839,12 +1019,33 @@ out_unlock:
 struct flash_load_resource_item {
 	enum resource_id id;
 	uint32_t subid;
+	int prio;
 	int result;
 	void *buf;
 	size_t *len;
+	void *subpart;
+	size_t subpart_len;
 	struct list_node link;
 };
 
+/*
+ * Verify and measure the retrieved PNOR partition as part of the
+ * secure boot and trusted boot requirements, then move a subpartition
+ * into place for the caller.
+ */
+static void flash_verify_resource(void *data)
+{
+	struct flash_load_resource_item *r = data;
+
+	secureboot_verify(r->id, r->buf, *r->len);
+	trustedboot_measure(r->id, r->buf, *r->len);
+
+	if (r->subid != RESOURCE_SUBID_NONE) {
+		memmove(r->buf, r->subpart, r->subpart_len);
+		*r->len = r->subpart_len;
+	}
+}
+
 static LIST_HEAD(flash_load_resource_queue);
 static LIST_HEAD(flash_loaded_resources);
 static struct lock flash_load_resource_lock = LOCK_UNLOCKED;
@@ -880,32 +1081,103 @@ int flash_resource_loaded(enum resource_id id, uint32_t subid)
 	return rc;
 }
 
+/* Called with flash_load_resource_lock held */
+static void flash_resource_done(struct flash_load_resource_item *r, int result)
+{
+	r->result = result;
+	list_del(&r->link);
+	list_add_tail(&flash_loaded_resources, &r->link);
+}
+
+/*
+ * Pick a CPU to verify on. The boot CPU only drains its job queue when
+ * it gets around to it, and it may be spinning in
+ * wait_for_resource_loaded() waiting on us, so never hand it work.
+ */
+static struct cpu_thread *flash_verify_target(void)
+{
+	struct cpu_thread *cpu, *best = NULL;
+
+	for_each_available_cpu(cpu) {
+		if (cpu == this_cpu() || cpu == boot_cpu ||
+		    cpu->job_has_no_return)
+			continue;
+		if (!cpu->job_count)
+			return cpu;
+		if (!best || cpu->job_count < best->job_count)
+			best = cpu;
+	}
+	return best;
+}
+
+/*
+ * Resources are read from flash one at a time in priority order, the
+ * flash itself is serialised by flash_lock. Verifying and measuring a
+ * resource is pushed to another CPU so the read of the next resource
+ * can overlap with it. Measurements still happen one at a time in load
+ * order, the TPM event log depends on it.
+ *
+ * Items stay on flash_load_resource_queue until their result is posted
+ * so the queue only becomes empty once this job is about to finish.
+ */
 static void flash_load_resources(void *data __unused)
 {
-	struct flash_load_resource_item *r;
-	int result;
+	struct flash_load_resource_item *r, *verifying = NULL;
+	struct cpu_job *verify_job = NULL;
+	struct cpu_thread *cpu;
+	int result = OPAL_SUCCESS;
 
 	lock(&flash_load_resource_lock);
-	do {
-		if (list_empty(&flash_load_resource_queue)) {
+	for (;;) {
+		bool found = false;
+
+		list_for_each(&flash_load_resource_queue, r, link) {
+			if (r->result == OPAL_EMPTY) {
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			r = NULL;
+		if (!r && !verifying)
 			break;
+		if (r)
+			r->result = OPAL_BUSY;
+		unlock(&flash_load_resource_lock);
+
+		if (r)
+			result = flash_read_resource(r->id, r->subid, r->buf,
+						     r->len, &r->subpart,
+						     &r->subpart_len);
+
+		cpu_wait_job(verify_job, true);
+		verify_job = NULL;
+
+		lock(&flash_load_resource_lock);
+		if (verifying) {
+			flash_resource_done(verifying, OPAL_SUCCESS);
+			verifying = NULL;
 		}
-		r = list_top(&flash_load_resource_queue,
-			     struct flash_load_resource_item, link);
-		if (r->result != OPAL_EMPTY)
-			prerror("flash_load_resources() list_top unexpected "
-				" result %d\n", r->result);
-		r->result = OPAL_BUSY;
+		if (!r)
+			continue;
+		if (result != OPAL_SUCCESS) {
+			flash_resource_done(r, result);
+			continue;
+		}
+
+		verifying = r;
 		unlock(&flash_load_resource_lock);
 
-		result = flash_load_resource(r->id, r->subid, r->buf, r->len);
+		cpu = flash_verify_target();
+		if (cpu)
+			verify_job = cpu_queue_job(cpu, "flash_verify_resource",
+						   flash_verify_resource, r);
+		/* Nobody to hand it to, do it ourselves */
+		if (!verify_job)
+			flash_verify_resource(r);
 
 		lock(&flash_load_resource_lock);
-		r = list_pop(&flash_load_resource_queue,
-			     struct flash_load_resource_item, link);
-		r->result = result;
-		list_add_tail(&flash_loaded_resources, &r->link);
-	} while(true);
+	}
 	unlock(&flash_load_resource_lock);
 }
 
@@ -923,8 +1195,9 @@ static void start_flash_load_resource_job(void)
 int flash_start_preload_resource(enum resource_id id, uint32_t subid,
 				 void *buf, size_t *len)
 {
-	struct flash_load_resource_item *r;
-	bool start_thread = false;
+	struct flash_load_resource_item *r, *q;
+	bool start_thread = false, queued = false;
+	int i;
 
 	r = malloc(sizeof(struct flash_load_resource_item));
 
@@ -934,6 +1207,13 @@ int flash_start_preload_resource(enum resource_id id, uint32_t subid,
 	r->buf = buf;
 	r->len = len;
 	r->result = OPAL_EMPTY;
+	r->prio = INT_MAX;
+	for (i = 0; i < ARRAY_SIZE(part_name_map); i++) {
+		if (part_name_map[i].id == id) {
+			r->prio = part_name_map[i].prio;
+			break;
+		}
+	}
 
 	prlog(PR_DEBUG, "FLASH: Queueing preload of %x/%x\n",
 	      r->id, r->subid);
@@ -942,7 +1222,17 @@ int flash_start_preload_resource(enum resource_id id, uint32_t subid,
 	if (list_empty(&flash_load_resource_queue)) {
 		start_thread = true;
 	}
-	list_add_tail(&flash_load_resource_queue, &r->link);
+	/* Ahead of anything less urgent that hasn't been started yet */
+	list_for_each(&flash_load_resource_queue, q, link) {
+		if (q->result == OPAL_EMPTY && q->prio > r->prio) {
+			list_add_before(&flash_load_resource_queue, &r->link,
+					&q->link);
+			queued = true;
+			break;
+		}
+	}
+	if (!queued)
+		list_add_tail(&flash_load_resource_queue, &r->link);
 	unlock(&flash_load_resource_lock);
 
 	if (start_thread)
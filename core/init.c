@@ -533,6 +533,9 @@ void __noreturn load_and_boot_kernel(bool is_reboot)
 		nvram_reinit();
 	}
 
+	/* The OS may let the BMC reflash the PNOR under us */
+	flash_cache_disable();
+
 	fsp_console_select_stdout();
 
 	/* Use nvram bootargs over device tree */
@@ -553,6 +556,12 @@ void __noreturn load_and_boot_kernel(bool is_reboot)
 		abort();
 	}
 
+	/* From here on the OS can ask for what changed since */
+	dt_delta_init();
+
+	/* The previous OS's message ring, if any, is in the new OS's memory */
+	opal_drop_msg_ring();
+
 	op_display(OP_LOG, OP_MOD_INIT, 0x000C);
 
 	/* Start the kernel */
@@ -708,6 +717,11 @@ static void console_log_level(void)
 		prlog(PR_NOTICE, "console: Setting memory log level to %i\n",
 		      level & 0x0f);
 	}
+	/* Keep memory only messages unformatted in the trace buffers */
+	if (nvram_query_eq("log-binary", "true")) {
+		debug_descriptor.trace_mask |= 1ul << TRACE_PRLOG;
+		prlog(PR_NOTICE, "console: Binary memory log enabled\n");
+	}
 }
 
 typedef void (*ctorcall_t)(void);
@@ -932,6 +946,12 @@ void __noreturn __nomcount main_cpu_entry(const void *fdt)
 	 */
 	init_chips();
 
+	/*
+	 * The boot thread only gets its chip ID from the device-tree in
+	 * init_all_cpus(), but XSCOM needs it for the issuer lock now.
+	 */
+	this_cpu()->chip_id = pir_to_chip_id(this_cpu()->pir);
+
 	xscom_init();
 	mfsi_init();
 
@@ -979,6 +999,9 @@ void __noreturn __nomcount main_cpu_entry(const void *fdt)
 	if (proc_gen == proc_gen_p9)
 		cpu_set_ipi_enable(true);
 
+	/* Serve small allocations from slabs from now on */
+	malloc_slab_init();
+
 	/* Add the /opal node to the device-tree */
 	add_opal_node();
 
@@ -1066,6 +1089,10 @@ void __noreturn __nomcount main_cpu_entry(const void *fdt)
 	/* Set the console level */
 	console_log_level();
 
+	/* Gather lock statistics if requested, see OPAL_LOCK_PROFILE */
+	if (nvram_query_eq("lock-profile", "true"))
+		lock_profile_start();
+
 	/* Secure/Trusted Boot init. We look for /ibm,secureboot in DT */
 	secureboot_init();
 	trustedboot_init();
@@ -1179,7 +1206,7 @@ void __noreturn __secondary_cpu_entry(void)
 
 	/* Wait for work to do */
 	while(true) {
-		if (cpu_check_jobs(cpu))
+		if (cpu_check_jobs(cpu) || cpu_steal_job(cpu))
 			cpu_process_jobs();
 		else
 			cpu_idle_job();
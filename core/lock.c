@@ -17,10 +17,13 @@
 #include <skiboot.h>
 #include <lock.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <processor.h>
 #include <cpu.h>
 #include <console.h>
 #include <timebase.h>
+#include <opal.h>
+#include <opal-internal.h>
 
 /* Set to bust locks. Note, this is initialized to true because our
  * lock debugging code is not going to work until we have the per
@@ -35,7 +38,7 @@ static void lock_error(struct lock *l, const char *reason, uint16_t err)
 {
 	bust_locks = true;
 
-	fprintf(stderr, "LOCK ERROR: %s @%p (state: 0x%016llx)\n",
+	fprintf(stderr, "LOCK ERROR: %s @%p (state: 0x%016"PRIx64")\n",
 		reason, l, l->lock_val);
 	op_display(OP_FATAL, OP_MOD_LOCK, err);
 
@@ -163,6 +166,154 @@ static inline void remove_lock_request(void) { };
 static inline bool lock_timeout(unsigned long s) { return false; }
 #endif /* DEBUG_LOCKS */
 
+/*
+ * Lock profiling. Statistics are kept per lock() call site, which is
+ * what ends up in lock->owner, in a fixed open addressed table so that
+ * recording never needs to allocate or take a lock itself. It's off by
+ * default and costs a single flag test in lock() when disabled.
+ */
+#define LOCK_PROFILE_ENTRIES	512
+
+struct lock_profile {
+	const char	*owner;
+	uint64_t	acquired;
+	uint64_t	contended;
+	uint64_t	spin_tb;
+	uint64_t	max_spin_tb;
+};
+
+static bool lock_profiling;
+static struct lock_profile lock_profiles[LOCK_PROFILE_ENTRIES];
+
+static inline void lock_profile_add(uint64_t *mem, uint64_t val)
+{
+	uint64_t old;
+
+	do {
+		old = *mem;
+	} while (__cmpxchg64(mem, old, old + val) != old);
+}
+
+static inline void lock_profile_max(uint64_t *mem, uint64_t val)
+{
+	uint64_t old;
+
+	do {
+		old = *mem;
+		if (old >= val)
+			return;
+	} while (__cmpxchg64(mem, old, val) != old);
+}
+
+static struct lock_profile *lock_profile_get(const char *owner)
+{
+	unsigned long hash = ((unsigned long)owner * 0x9e3779b97f4a7c15ul) >> 32;
+	struct lock_profile *p;
+	unsigned int i;
+
+	for (i = 0; i < LOCK_PROFILE_ENTRIES; i++) {
+		p = &lock_profiles[(hash + i) % LOCK_PROFILE_ENTRIES];
+		if (p->owner == owner)
+			return p;
+		if (!p->owner &&
+		    __cmpxchg64((uint64_t *)&p->owner, 0, (uint64_t)owner) == 0)
+			return p;
+		/* Someone may have just claimed it for the same owner */
+		if (p->owner == owner)
+			return p;
+	}
+
+	/* Table full, this call site goes unaccounted */
+	return NULL;
+}
+
+static void lock_profile_record(const char *owner, bool contended,
+				uint64_t spin_tb)
+{
+	struct lock_profile *p = lock_profile_get(owner);
+
+	if (!p)
+		return;
+
+	lock_profile_add(&p->acquired, 1);
+	if (!contended)
+		return;
+	lock_profile_add(&p->contended, 1);
+	lock_profile_add(&p->spin_tb, spin_tb);
+	lock_profile_max(&p->max_spin_tb, spin_tb);
+}
+
+void lock_profile_start(void)
+{
+	prlog(PR_NOTICE, "LOCK: Profiling enabled\n");
+	lock_profiling = true;
+}
+
+void lock_profile_dump(void)
+{
+	struct lock_profile *p;
+	unsigned int i;
+
+	prlog(PR_NOTICE, "LOCK: %-40s %12s %12s %12s %10s\n", "owner",
+	      "acquired", "contended", "spin(us)", "max(us)");
+
+	for (i = 0; i < LOCK_PROFILE_ENTRIES; i++) {
+		p = &lock_profiles[i];
+		if (!p->owner)
+			continue;
+		prlog(PR_NOTICE, "LOCK: %-40s %12"PRIu64" %12"PRIu64
+		      " %12lu %10lu\n",
+		      p->owner, p->acquired, p->contended,
+		      tb_to_usecs(p->spin_tb), tb_to_usecs(p->max_spin_tb));
+	}
+}
+
+static int64_t opal_lock_profile(uint64_t op, struct opal_lock_stat *stats,
+				 uint64_t count)
+{
+	struct lock_profile *p;
+	unsigned int i, n;
+
+	switch (op) {
+	case OPAL_LOCK_PROFILE_STOP:
+		lock_profiling = false;
+		return OPAL_SUCCESS;
+	case OPAL_LOCK_PROFILE_START:
+		lock_profile_start();
+		return OPAL_SUCCESS;
+	case OPAL_LOCK_PROFILE_RESET:
+		/* Counts racing with this may be lost, that's fine */
+		memset(lock_profiles, 0, sizeof(lock_profiles));
+		return OPAL_SUCCESS;
+	case OPAL_LOCK_PROFILE_DUMP:
+		lock_profile_dump();
+		return OPAL_SUCCESS;
+	case OPAL_LOCK_PROFILE_READ:
+		break;
+	default:
+		return OPAL_PARAMETER;
+	}
+
+	if (!opal_addr_valid(stats))
+		return OPAL_PARAMETER;
+
+	for (i = n = 0; i < LOCK_PROFILE_ENTRIES && n < count; i++) {
+		p = &lock_profiles[i];
+		if (!p->owner)
+			continue;
+		memset(&stats[n], 0, sizeof(stats[n]));
+		strncpy(stats[n].owner, p->owner, sizeof(stats[n].owner) - 1);
+		stats[n].acquired = cpu_to_be64(p->acquired);
+		stats[n].contended = cpu_to_be64(p->contended);
+		stats[n].spin_tb = cpu_to_be64(p->spin_tb);
+		stats[n].max_spin_tb = cpu_to_be64(p->max_spin_tb);
+		n++;
+	}
+
+	return n;
+}
+opal_call(OPAL_LOCK_PROFILE, opal_lock_profile, 3);
+
 bool lock_held_by_me(struct lock *l)
 {
 	uint64_t pir64 = this_cpu()->pir;
@@ -170,6 +321,54 @@ bool lock_held_by_me(struct lock *l)
 	return l->lock_val == ((pir64 << 32) | 1);
 }
 
+/*
+ * Fair locks. A waiter takes a ticket and waits for it to be served,
+ * unlock() serves the next one. lock_val is still set by the owner once
+ * it has been served, so lock_held_by_me() and the lock debugging code
+ * work the same for both kinds of lock.
+ */
+static inline uint32_t ticket_serving(struct lock *l)
+{
+	return l->tickets & 0xffffffff;
+}
+
+static inline bool __try_ticket(struct lock *l)
+{
+	uint64_t old = l->tickets;
+
+	/* Only take it if nobody is queued */
+	if ((old >> 32) != (old & 0xffffffff))
+		return false;
+
+	barrier();
+	if (__cmpxchg64(&l->tickets, old, old + (1ul << 32)) == old) {
+		sync();
+		return true;
+	}
+	return false;
+}
+
+static inline uint32_t __take_ticket(struct lock *l)
+{
+	uint64_t old;
+
+	do {
+		old = l->tickets;
+	} while (__cmpxchg64(&l->tickets, old, old + (1ul << 32)) != old);
+
+	return old >> 32;
+}
+
+static inline void __serve_next_ticket(struct lock *l)
+{
+	uint64_t old, new;
+
+	do {
+		old = l->tickets;
+		new = (old & ~0xfffffffful) | ((old + 1) & 0xffffffff);
+	} while (__cmpxchg64(&l->tickets, old, new) != old);
+}
+
 static inline bool __try_lock(struct cpu_thread *cpu, struct lock *l)
 {
 	uint64_t val;
@@ -178,6 +377,13 @@ static inline bool __try_lock(struct cpu_thread *cpu, struct lock *l)
 	val <<= 32;
 	val |= 1;
 
+	if (l->fair) {
+		if (!__try_ticket(l))
+			return false;
+		l->lock_val = val;
+		return true;
+	}
+
 	barrier();
 	if (__cmpxchg64(&l->lock_val, 0, val) == 0) {
 		sync();
@@ -186,6 +392,15 @@ static inline bool __try_lock(struct cpu_thread *cpu, struct lock *l)
 	return false;
 }
 
+static void lock_acquired(struct cpu_thread *cpu, struct lock *l,
+			  const char *owner)
+{
+	l->owner = owner;
+	if (l->in_con_path)
+		cpu->con_suspend++;
+	list_add(&cpu->locks_held, &l->list);
+}
+
 bool try_lock_caller(struct lock *l, const char *owner)
 {
 	struct cpu_thread *cpu = this_cpu();
@@ -194,29 +409,62 @@ bool try_lock_caller(struct lock *l, const char *owner)
 		return true;
 
 	if (__try_lock(cpu, l)) {
-		l->owner = owner;
-		if (l->in_con_path)
-			cpu->con_suspend++;
-		list_add(&cpu->locks_held, &l->list);
+		lock_acquired(cpu, l, owner);
 		return true;
 	}
 	return false;
 }
 
+/* Wait for our turn on a fair lock */
+static void lock_fair(struct lock *l, const char *owner, unsigned long start)
+{
+	struct cpu_thread *cpu = this_cpu();
+	bool timeout_warn = false;
+	uint32_t ticket;
+	uint64_t val;
+
+	ticket = __take_ticket(l);
+	for (;;) {
+		if (ticket_serving(l) == ticket)
+			break;
+		smt_lowest();
+		while (ticket_serving(l) != ticket)
+			barrier();
+		smt_medium();
+
+		if (start && !timeout_warn)
+			timeout_warn = lock_timeout(start);
+	}
+	sync();
+
+	val = cpu->pir;
+	val <<= 32;
+	val |= 1;
+	l->lock_val = val;
+	lock_acquired(cpu, l, owner);
+}
+
 void lock_caller(struct lock *l, const char *owner)
 {
 	bool timeout_warn = false;
 	unsigned long start = 0;
+	unsigned long spin_start = 0;
 
 	if (bust_locks)
 		return;
 
 	lock_check(l);
 
-	if (try_lock(l))
+	if (try_lock_caller(l, owner)) {
+		if (lock_profiling)
+			lock_profile_record(owner, false, 0);
 		return;
+	}
 	add_lock_request(l);
 
+	if (lock_profiling)
+		spin_start = mftb();
+
 #ifdef DEBUG_LOCKS
 	/*
 	 * Ensure that we get a valid start value
@@ -227,7 +475,9 @@ void lock_caller(struct lock *l, const char *owner)
 		start = tb_to_msecs(mftb());
 #endif
 
-	for (;;) {
+	if (l->fair)
+		lock_fair(l, owner, start);
+	else for (;;) {
 		if (try_lock_caller(l, owner))
 			break;
 		smt_lowest();
@@ -240,6 +490,9 @@ void lock_caller(struct lock *l, const char *owner)
 	}
 
 	remove_lock_request();
+
+	if (lock_profiling && spin_start)
+		lock_profile_record(owner, true, mftb() - spin_start);
 }
 
 void unlock(struct lock *l)
@@ -256,6 +509,12 @@ void unlock(struct lock *l)
 	lwsync();
 	l->lock_val = 0;
 
+	/* The next owner sets lock_val once served, so clear it first */
+	if (l->fair) {
+		lwsync();
+		__serve_next_ticket(l);
+	}
+
 	/* WARNING: On fast reboot, we can be reset right at that
 	 * point, so the reset_lock in there cannot be in the con path
 	 */
@@ -14,13 +14,320 @@
  * limitations under the License.
  */
 /* Wrappers for malloc, et. al. */
+#include <skiboot.h>
 #include <mem_region.h>
 #include <lock.h>
+#include <cpu.h>
 #include <string.h>
 #include <mem_region-malloc.h>
 
 #define DEFAULT_ALIGN __alignof__(long)
 
+/*
+ * Small allocations are served from per size class slabs rather than
+ * going through the first fit walk of the heap free list.
+ *
+ * Slab pages are carved out of skiboot_heap, aligned on their size, and
+ * recorded in a bitmap covering the heap so that free() can tell slab
+ * objects from regular heap allocations: a page covers its whole
+ * aligned window, so no heap allocation can start within it. Every object keeps a small
+ * header with the location of its last malloc/free, just like heap
+ * allocations do. Pages are never given back to the heap.
+ *
+ * The smaller classes additionally have a per-CPU magazine of free
+ * objects, so that the most common allocations don't even have to take
+ * the class lock.
+ */
+#define SLAB_PAGE_SHIFT		15
+#define SLAB_PAGE_SIZE		(1ul << SLAB_PAGE_SHIFT)
+#define SLAB_MIN_SHIFT		4
+#define SLAB_CLASSES		9	/* 16 to 4096 bytes */
+#define SLAB_MAX_SIZE		(1ul << (SLAB_MIN_SHIFT + SLAB_CLASSES - 1))
+#define SLAB_MAG_CLASSES	6	/* 16 to 512 bytes */
+#define SLAB_MAG_SIZE		16
+
+#define SLAB_ALLOCATED		0x51ab0a11
+#define SLAB_FREE		0x51ab0f4e
+
+#ifdef DEBUG
+#define SLAB_POISON		1
+#else
+#define SLAB_POISON		0
+#endif
+
+struct slab_obj {
+	const char		*location;
+	uint32_t		class;
+	uint32_t		state;
+	/* Payload follows, the first word links free objects */
+};
+
+struct slab_class {
+	struct lock		lock;
+	size_t			size;
+	void			*free;
+	uint64_t		pages;
+};
+
+struct slab_magazine {
+	unsigned int		count;
+	struct slab_obj		*objs[SLAB_MAG_SIZE];
+};
+
+struct slab_magazines {
+	struct slab_magazine	mag[SLAB_MAG_CLASSES];
+};
+
+static bool slab_enabled;
+static struct slab_class slab_classes[SLAB_CLASSES];
+static unsigned long *slab_page_map;	/* Protected by the heap lock */
+
+static void *slab_payload(struct slab_obj *o)
+{
+	return o + 1;
+}
+
+static struct slab_obj *slab_obj(void *p)
+{
+	return (struct slab_obj *)p - 1;
+}
+
+static unsigned long slab_page_index(const void *p)
+{
+	return ((unsigned long)p >> SLAB_PAGE_SHIFT) -
+		(skiboot_heap.start >> SLAB_PAGE_SHIFT);
+}
+
+static bool slab_owns(const void *p)
+{
+	unsigned long idx;
+
+	if (!slab_enabled || (unsigned long)p < skiboot_heap.start ||
+	    (unsigned long)p >= skiboot_heap.start + skiboot_heap.len)
+		return false;
+
+	idx = slab_page_index(p);
+	return slab_page_map[idx / BITS_PER_LONG] &
+		(1ul << (idx % BITS_PER_LONG));
+}
+
+static unsigned int slab_class_of(size_t bytes)
+{
+	unsigned int c = 0;
+
+	while ((1ul << (SLAB_MIN_SHIFT + c)) < bytes)
+		c++;
+	return c;
+}
+
+/* Called with the class lock held */
+static bool slab_grow(struct slab_class *sc, unsigned int c)
+{
+	size_t stride = sizeof(struct slab_obj) + sc->size;
+	struct slab_obj *o;
+	unsigned long idx;
+	void *page, *p;
+
+	lock(&skiboot_heap.free_list_lock);
+	page = mem_alloc(&skiboot_heap, SLAB_PAGE_SIZE, SLAB_PAGE_SIZE,
+			 __location__);
+	if (page) {
+		idx = slab_page_index(page);
+		slab_page_map[idx / BITS_PER_LONG] |=
+			1ul << (idx % BITS_PER_LONG);
+	}
+	unlock(&skiboot_heap.free_list_lock);
+	if (!page)
+		return false;
+
+	for (p = page; p + stride <= page + SLAB_PAGE_SIZE; p += stride) {
+		o = p;
+		o->class = c;
+		o->state = SLAB_FREE;
+		o->location = __location__;
+		*(void **)slab_payload(o) = sc->free;
+		sc->free = o;
+	}
+	sc->pages++;
+
+	return true;
+}
+
+/* Called with the class lock held */
+static struct slab_obj *slab_get(struct slab_class *sc, unsigned int c)
+{
+	struct slab_obj *o;
+
+	if (!sc->free && !slab_grow(sc, c))
+		return NULL;
+
+	o = sc->free;
+	sc->free = *(void **)slab_payload(o);
+	return o;
+}
+
+/* Called with the class lock held */
+static void slab_put(struct slab_class *sc, struct slab_obj *o)
+{
+	*(void **)slab_payload(o) = sc->free;
+	sc->free = o;
+}
+
+static struct slab_magazine *slab_cpu_magazine(unsigned int c)
+{
+	struct cpu_thread *cpu = this_cpu();
+
+	if (c >= SLAB_MAG_CLASSES)
+		return NULL;
+
+	if (!cpu->slab_mags) {
+		lock(&skiboot_heap.free_list_lock);
+		cpu->slab_mags = mem_alloc(&skiboot_heap,
+					   sizeof(struct slab_magazines),
+					   DEFAULT_ALIGN, __location__);
+		unlock(&skiboot_heap.free_list_lock);
+		if (!cpu->slab_mags)
+			return NULL;
+		memset(cpu->slab_mags, 0, sizeof(struct slab_magazines));
+	}
+
+	return &cpu->slab_mags->mag[c];
+}
+
+static void *slab_alloc(size_t bytes, const char *location)
+{
+	unsigned int c = slab_class_of(bytes);
+	struct slab_class *sc = &slab_classes[c];
+	struct slab_magazine *mag = slab_cpu_magazine(c);
+	struct slab_obj *o;
+
+	if (mag && !mag->count) {
+		/* Refill half the magazine in one go */
+		lock(&sc->lock);
+		while (mag->count < SLAB_MAG_SIZE / 2) {
+			o = slab_get(sc, c);
+			if (!o)
+				break;
+			mag->objs[mag->count++] = o;
+		}
+		unlock(&sc->lock);
+	}
+
+	if (mag && mag->count) {
+		o = mag->objs[--mag->count];
+	} else {
+		lock(&sc->lock);
+		o = slab_get(sc, c);
+		unlock(&sc->lock);
+		if (!o)
+			return NULL;
+	}
+
+	assert(o->state == SLAB_FREE);
+	o->state = SLAB_ALLOCATED;
+	o->location = location;
+
+	return slab_payload(o);
+}
+
+static void slab_free(void *p, const char *location)
+{
+	struct slab_obj *o = slab_obj(p);
+	struct slab_magazine *mag;
+	struct slab_class *sc;
+	unsigned int i;
+
+	if (o->state != SLAB_ALLOCATED || o->class >= SLAB_CLASSES) {
+		if (o->state == SLAB_FREE)
+			prerror("%p (in slab) re-freed at %s, previously %s\n",
+				p, location, o->location);
+		else
+			prerror("%p (in slab) freed at %s, corrupt header\n",
+				p, location);
+		abort();
+	}
+
+	sc = &slab_classes[o->class];
+	if (SLAB_POISON)
+		memset(p, 0x99, sc->size);
+	o->state = SLAB_FREE;
+	o->location = location;
+
+	mag = slab_cpu_magazine(o->class);
+	if (!mag) {
+		lock(&sc->lock);
+		slab_put(sc, o);
+		unlock(&sc->lock);
+		return;
+	}
+
+	if (mag->count == SLAB_MAG_SIZE) {
+		/* Give half the magazine back */
+		lock(&sc->lock);
+		for (i = 0; i < SLAB_MAG_SIZE / 2; i++)
+			slab_put(sc, mag->objs[--mag->count]);
+		unlock(&sc->lock);
+	}
+	mag->objs[mag->count++] = o;
+}
+
+void malloc_slab_init(void)
+{
+	size_t map_size;
+	unsigned int c;
+
+	for (c = 0; c < SLAB_CLASSES; c++) {
+		init_lock(&slab_classes[c].lock);
+		slab_classes[c].size = 1ul << (SLAB_MIN_SHIFT + c);
+	}
+
+	map_size = (slab_page_index((void *)(skiboot_heap.start +
+					     skiboot_heap.len - 1)) /
+		    BITS_PER_LONG + 1) * sizeof(long);
+	lock(&skiboot_heap.free_list_lock);
+	slab_page_map = mem_alloc(&skiboot_heap, map_size, DEFAULT_ALIGN,
+				  __location__);
+	unlock(&skiboot_heap.free_list_lock);
+	if (!slab_page_map)
+		return;
+	memset(slab_page_map, 0, map_size);
+
+	slab_enabled = true;
+}
+
+void malloc_slab_dump_allocs(void)
+{
+	struct slab_obj *o;
+	unsigned long idx, pages;
+	size_t stride;
+	void *page, *p;
+
+	if (!slab_enabled)
+		return;
+
+	prlog(PR_INFO, "Slab allocations:\n");
+	pages = slab_page_index((void *)(skiboot_heap.start +
+					 skiboot_heap.len - 1)) + 1;
+	for (idx = 0; idx < pages; idx++) {
+		if (!(slab_page_map[idx / BITS_PER_LONG] &
+		      (1ul << (idx % BITS_PER_LONG))))
+			continue;
+		page = (void *)(((skiboot_heap.start >> SLAB_PAGE_SHIFT) + idx)
+				<< SLAB_PAGE_SHIFT);
+		o = page;
+		stride = sizeof(*o) + slab_classes[o->class].size;
+		for (p = page; p + stride <= page + SLAB_PAGE_SIZE;
+		     p += stride) {
+			o = p;
+			if (o->state != SLAB_ALLOCATED)
+				continue;
+			prlog(PR_INFO, "    0x%.8lx %s\n",
+			      (unsigned long)slab_classes[o->class].size,
+			      o->location);
+		}
+	}
+}
+
 void *__memalign(size_t blocksize, size_t bytes, const char *location)
 {
 	void *p;
@@ -29,16 +336,32 @@ void *__memalign(size_t blocksize, size_t bytes, const char *location)
 	p = mem_alloc(&skiboot_heap, bytes, blocksize, location);
 	unlock(&skiboot_heap.free_list_lock);
 
+	if (!p)
+		malloc_slab_dump_allocs();
+
 	return p;
 }
 
 void *__malloc(size_t bytes, const char *location)
 {
+	void *p;
+
+	if (slab_enabled && bytes && bytes <= SLAB_MAX_SIZE) {
+		p = slab_alloc(bytes, location);
+		if (p)
+			return p;
+	}
+
 	return __memalign(DEFAULT_ALIGN, bytes, location);
 }
 
 void __free(void *p, const char *location)
 {
+	if (slab_owns(p)) {
+		slab_free(p, location);
+		return;
+	}
+
 	lock(&skiboot_heap.free_list_lock);
 	mem_free(&skiboot_heap, p, location);
 	unlock(&skiboot_heap.free_list_lock);
@@ -56,6 +379,22 @@ void *__realloc(void *ptr, size_t size, const char *location)
 	if (!ptr)
 		return __malloc(size, location);
 
+	if (slab_owns(ptr)) {
+		struct slab_obj *o = slab_obj(ptr);
+		size_t copy = slab_classes[o->class].size;
+
+		if (size <= copy) {
+			o->location = location;
+			return ptr;
+		}
+		newptr = __malloc(size, location);
+		if (newptr) {
+			memcpy(newptr, ptr, copy);
+			__free(ptr, location);
+		}
+		return newptr;
+	}
+
 	lock(&skiboot_heap.free_list_lock);
 	if (mem_resize(&skiboot_heap, ptr, size, location)) {
 		newptr = ptr;
@@ -133,6 +133,35 @@ static struct alloc_hdr *next_hdr(const struct mem_region *region,
 	return next;
 }
 
+/* Has the allocator been set up for this region yet? */
+static bool region_alloc_ready(const struct mem_region *region)
+{
+	return region->free_list[0].n.next != NULL;
+}
+
+static unsigned int free_list_index(unsigned long num_longs)
+{
+	return 63 - __builtin_clzl(num_longs);
+}
+
+static void free_list_add(struct mem_region *region, struct free_hdr *f)
+{
+	unsigned int idx = free_list_index(f->hdr.num_longs);
+
+	list_add(&region->free_list[idx], &f->list);
+	region->free_list_map |= 1ull << idx;
+}
+
+/* The block must still have the size it was added with */
+static void free_list_del(struct mem_region *region, struct free_hdr *f)
+{
+	unsigned int idx = free_list_index(f->hdr.num_longs);
+
+	list_del(&f->list);
+	if (list_empty(&region->free_list[idx]))
+		region->free_list_map &= ~(1ull << idx);
+}
+
 #if POISON_MEM_REGION == 1
 static void mem_poison(struct free_hdr *f)
 {
@@ -153,17 +182,25 @@ static inline void mem_poison(struct free_hdr *f __unused) { }
 static void init_allocatable_region(struct mem_region *region)
 {
 	struct free_hdr *f = region_start(region);
+	unsigned int i;
+
 	assert(region->type == REGION_SKIBOOT_HEAP ||
 	       region->type == REGION_MEMORY);
 	f->hdr.num_longs = region->len / sizeof(long);
 	f->hdr.free = true;
 	f->hdr.prev_free = false;
 	*tailer(f) = f->hdr.num_longs;
-	list_head_init(&region->free_list);
-	list_add(&region->free_list, &f->list);
+	for (i = 0; i < MEM_REGION_FREE_LISTS; i++)
+		list_head_init(&region->free_list[i]);
+	region->free_list_map = 0;
+	free_list_add(region, f);
 	mem_poison(f);
 }
 
+/*
+ * Coalescing only needs the boundary tags: the tailer of a free block
+ * before us, and the header of the block after us.
+ */
 static void make_free(struct mem_region *region, struct free_hdr *f,
 		      const char *location, bool skip_poison)
 {
@@ -182,50 +219,91 @@ static void make_free(struct mem_region *region, struct free_hdr *f,
 		assert(!prev->hdr.prev_free);
 
 		/* Expand to cover the one we just freed. */
+		free_list_del(region, prev);
 		prev->hdr.num_longs += f->hdr.num_longs;
 		f = prev;
 	} else {
 		f->hdr.free = true;
 		f->hdr.location = location;
-		list_add(&region->free_list, &f->list);
 	}
 
-	/* Fix up tailer. */
-	*tailer(f) = f->hdr.num_longs;
-
 	/* If next is free, coalesce it */
 	next = next_hdr(region, &f->hdr);
-	if (next) {
-		next->prev_free = true;
-		if (next->free) {
-			struct free_hdr *next_free = (void *)next;
-			list_del_from(&region->free_list, &next_free->list);
-			/* Maximum of one level of recursion */
-			make_free(region, next_free, location, true);
-		}
+	if (next && next->free) {
+		free_list_del(region, (struct free_hdr *)next);
+		f->hdr.num_longs += next->num_longs;
+		next = next_hdr(region, &f->hdr);
 	}
+	if (next)
+		next->prev_free = true;
+
+	/* Fix up tailer. */
+	*tailer(f) = f->hdr.num_longs;
+
+	free_list_add(region, f);
 }
 
 /* Can we fit this many longs with this alignment in this free block? */
 static bool fits(struct free_hdr *f, size_t longs, size_t align, size_t *offset)
 {
-	*offset = 0;
+	unsigned long addr = (unsigned long)f + ALLOC_HDR_LONGS * sizeof(long);
+	size_t skip = (ALIGN_UP(addr, align) - addr) / sizeof(long);
 
-	while (f->hdr.num_longs >= *offset + longs) {
-		size_t addr;
+	/* Don't make tiny chunks! */
+	if (skip && skip < ALLOC_MIN_LONGS)
+		skip += ALIGN_UP((ALLOC_MIN_LONGS - skip) * sizeof(long),
+				 align) / sizeof(long);
 
-		addr = (unsigned long)f
-			+ (*offset + ALLOC_HDR_LONGS) * sizeof(long);
-		if ((addr & (align - 1)) == 0)
-			return true;
+	*offset = skip;
+	return f->hdr.num_longs >= skip + longs;
+}
 
-		/* Don't make tiny chunks! */
-		if (*offset == 0)
-			*offset = ALLOC_MIN_LONGS;
-		else
-			(*offset)++;
+/* How many free blocks of about the right size we try before going up */
+#define MEM_FIT_SCAN	8
+
+static struct free_hdr *find_free(struct mem_region *region, size_t longs,
+				  size_t align, size_t *offset)
+{
+	unsigned int first, enough, i, n = 0;
+	size_t worst = longs;
+	struct free_hdr *f;
+	uint64_t map;
+
+	/* The most we could have to skip to get the alignment */
+	if (align > sizeof(long))
+		worst += ALLOC_MIN_LONGS + align / sizeof(long);
+
+	first = free_list_index(longs);
+	enough = free_list_index(worst);
+	if (worst > (1ul << enough))
+		enough++;
+
+	/* A close fit is better for fragmentation, have a quick look */
+	list_for_each(&region->free_list[first], f, list) {
+		if (fits(f, longs, align, offset))
+			return f;
+		if (++n == MEM_FIT_SCAN)
+			break;
 	}
-	return false;
+
+	/* Anything from here up is guaranteed to fit */
+	map = enough < 64 ? region->free_list_map & ~((1ull << enough) - 1) : 0;
+	if (map) {
+		f = list_top(&region->free_list[__builtin_ctzll(map)],
+			     struct free_hdr, list);
+		if (fits(f, longs, align, offset))
+			return f;
+		assert(0);
+	}
+
+	/* Otherwise we have to look at every block that might do */
+	for (i = first; i < enough && i < MEM_REGION_FREE_LISTS; i++) {
+		list_for_each(&region->free_list[i], f, list)
+			if (fits(f, longs, align, offset))
+				return f;
+	}
+
+	return NULL;
 }
 
 static void discard_excess(struct mem_region *region,
@@ -297,7 +375,7 @@ void mem_dump_allocs(void)
 		       (long long)region->start,
 		       (long long)(region->start + region->len - 1),
 		       region->name);
-		if (region->free_list.n.next == NULL) {
+		if (!region_alloc_ready(region)) {
 			prlog(PR_INFO, "    no allocs\n");
 			continue;
 		}
@@ -326,7 +404,7 @@ int64_t mem_dump_free(void)
 			continue;
 		region_free = 0;
 
-		if (region->free_list.n.next == NULL) {
+		if (!region_alloc_ready(region)) {
 			continue;
 		}
 		for (hdr = region_start(region); hdr; hdr = next_hdr(region, hdr)) {
@@ -364,7 +442,7 @@ static void *__mem_alloc(struct mem_region *region, size_t size, size_t align,
 		return NULL;
 
 	/* First allocation? */
-	if (region->free_list.n.next == NULL)
+	if (!region_alloc_ready(region))
 		init_allocatable_region(region);
 
 	/* Don't do screwy sizes. */
@@ -382,21 +460,16 @@ static void *__mem_alloc(struct mem_region *region, size_t size, size_t align,
 	if (alloc_longs < ALLOC_MIN_LONGS)
 		alloc_longs = ALLOC_MIN_LONGS;
 
-	/* Walk free list. */
-	list_for_each(&region->free_list, f, list) {
-		/* We may have to skip some to meet alignment. */
-		if (fits(f, alloc_longs, align, &offset))
-			goto found;
-	}
-
-	return NULL;
+	/* We may have to skip some to meet alignment. */
+	f = find_free(region, alloc_longs, align, &offset);
+	if (!f)
+		return NULL;
 
-found:
 	assert(f->hdr.free);
 	assert(!f->hdr.prev_free);
 
 	/* This block is no longer free. */
-	list_del_from(&region->free_list, &f->list);
+	free_list_del(region, f);
 	f->hdr.free = false;
 	f->hdr.location = location;
 
@@ -522,7 +595,7 @@ bool mem_resize(struct mem_region *region, void *mem, size_t len,
 
 	/* OK, it's free and big enough, absorb it. */
 	f = (struct free_hdr *)next;
-	list_del_from(&region->free_list, &f->list);
+	free_list_del(region, f);
 	hdr->num_longs += next->num_longs;
 	hdr->location = location;
 
@@ -544,6 +617,7 @@ bool mem_resize(struct mem_region *region, void *mem, size_t len,
 bool mem_check(const struct mem_region *region)
 {
 	size_t frees = 0;
+	unsigned int i;
 	struct alloc_hdr *hdr, *prev_free = NULL;
 	struct free_hdr *f;
 
@@ -562,7 +636,7 @@ bool mem_check(const struct mem_region *region)
 	/* Not ours to play with, or empty?  Don't do anything. */
 	if (!(region->type == REGION_MEMORY ||
 	      region->type == REGION_SKIBOOT_HEAP) ||
-	    region->free_list.n.next == NULL)
+	    !region_alloc_ready(region))
 		return true;
 
 	/* Walk linearly. */
@@ -607,9 +681,29 @@ bool mem_check(const struct mem_region *region)
 		}
 	}
 
-	/* Now walk free list. */
-	list_for_each(&region->free_list, f, list)
-		frees ^= (unsigned long)f - region->start;
+	/* Now walk the free lists. */
+	for (i = 0; i < MEM_REGION_FREE_LISTS; i++) {
+		if (list_empty(&region->free_list[i]) ==
+		    !!(region->free_list_map & (1ull << i))) {
+			prerror("Region '%s' free list %u map bit %sset?\n",
+				region->name, i,
+				list_empty(&region->free_list[i]) ? "" : "un");
+			return false;
+		}
+		list_for_each(&region->free_list[i], f, list) {
+			if (!f->hdr.free ||
+			    free_list_index(f->hdr.num_longs) != i) {
+				prerror("Region '%s' %s %p (%s) size %zu"
+					" on free list %u\n",
+					region->name,
+					f->hdr.free ? "free" : "alloc",
+					f, hdr_location(&f->hdr),
+					f->hdr.num_longs * sizeof(long), i);
+				return false;
+			}
+			frees ^= (unsigned long)f - region->start;
+		}
+	}
 
 	if (frees) {
 		prerror("Region '%s' free list and walk do not match!\n",
@@ -647,7 +741,7 @@ static struct mem_region *new_region(const char *name,
 	region->len = len;
 	region->node = node;
 	region->type = type;
-	region->free_list.n.next = NULL;
+	region->free_list[0].n.next = NULL;
 	init_lock(&region->free_list_lock);
 
 	return region;
@@ -1097,14 +1191,17 @@ static uint64_t allocated_length(const struct mem_region *r)
 {
 	struct free_hdr *f, *last = NULL;
 
+	unsigned int i;
+
 	/* No allocations at all? */
-	if (r->free_list.n.next == NULL)
+	if (!region_alloc_ready(r))
 		return 0;
 
 	/* Find last free block. */
-	list_for_each(&r->free_list, f, list)
-		if (f > last)
-			last = f;
+	for (i = 0; i < MEM_REGION_FREE_LISTS; i++)
+		list_for_each(&r->free_list[i], f, list)
+			if (f > last)
+				last = f;
 
 	/* No free blocks? */
 	if (!last)
@@ -1151,7 +1248,7 @@ void mem_region_release_unused(void)
 			struct free_hdr *last = region_start(r) + used_len;
 
 			/* Remove the final free block. */
-			list_del_from(&r->free_list, &last->list);
+			free_list_del(r, last);
 
 			for_linux = split_region(r, r->start + used_len,
 						 REGION_OS);
@@ -22,26 +22,237 @@
 
 #define OPAL_MAX_MSGS		(OPAL_MSG_TYPE_MAX + OPAL_MAX_ASYNC_COMP - 1)
 
+/* Most messages OPAL_GET_MSGS hands back in one call */
+#define OPAL_GET_MSGS_BATCH	16
+
+/* Largest message ring we'll use, the host may register a bigger one */
+#define OPAL_MSG_RING_MAX	1024
+
 struct opal_msg_entry {
 	struct list_node link;
 	void (*consumed)(void *data);
 	void *data;
+	bool pooled;
 	struct opal_msg msg;
 };
 
+/*
+ * Entries come from a static pool so queueing a message doesn't need to
+ * allocate. Only when the pool is exhausted do we fall back to zalloc(),
+ * and those entries are freed again once consumed.
+ */
+static struct opal_msg_entry msg_pool[OPAL_MAX_MSGS];
 static LIST_HEAD(msg_free_list);
 static LIST_HEAD(msg_pending_list);
 
-static struct lock opal_msg_lock = LOCK_UNLOCKED;
+static struct lock opal_msg_lock = LOCK_UNLOCKED_FAIR;
+
+/*
+ * Host registered message ring. msg_ring_head is our copy of the
+ * producer index, msg_ring_reaped is how far we have run the consumed()
+ * callbacks of the messages the host has taken.
+ */
+struct opal_msg_done {
+	void (*consumed)(void *data);
+	void *data;
+};
+
+static struct opal_msg_ring *msg_ring;
+static struct opal_msg_done *msg_ring_done;
+static uint32_t msg_ring_mask;
+static uint64_t msg_ring_head;
+static uint64_t msg_ring_reaped;
+
+/* Called with opal_msg_lock held */
+static bool opal_msg_ring_empty(void)
+{
+	return !msg_ring || be64_to_cpu(msg_ring->tail) == msg_ring_head;
+}
+
+/*
+ * Called with opal_msg_lock held. Returns false if the message has to go
+ * on the pending list instead.
+ */
+static bool opal_msg_ring_put(const struct opal_msg *msg,
+			      void (*consumed)(void *data), void *data)
+{
+	uint64_t tail;
+	uint32_t slot;
+
+	if (!msg_ring)
+		return false;
+
+	/* Keep things in order, the host drains the ring before the list */
+	if (!list_empty(&msg_pending_list))
+		goto overflow;
+
+	tail = be64_to_cpu(msg_ring->tail);
+	lwsync();
+	if (msg_ring_head - tail > msg_ring_mask)
+		goto overflow;
+
+	slot = msg_ring_head & msg_ring_mask;
+	msg_ring->msgs[slot] = *msg;
+	msg_ring_done[slot].consumed = consumed;
+	msg_ring_done[slot].data = data;
+	lwsync();
+	msg_ring->head = cpu_to_be64(++msg_ring_head);
+
+	/* Only going non-empty needs the host's attention */
+	if (msg_ring_head - 1 == tail)
+		opal_update_pending_evt(OPAL_EVENT_MSG_PENDING,
+					OPAL_EVENT_MSG_PENDING);
+	return true;
+
+overflow:
+	msg_ring->overflows = cpu_to_be64(be64_to_cpu(msg_ring->overflows) + 1);
+	return false;
+}
+
+/*
+ * Run the consumed() callbacks for messages the host has taken off the
+ * ring and drop the event once there is nothing left for it.
+ */
+static void opal_msg_ring_poll(void *data __unused)
+{
+	struct opal_msg_done done[OPAL_GET_MSGS_BATCH];
+	uint64_t tail;
+	unsigned int i, n;
+
+	/* Nothing registered, don't bother with the lock */
+	if (!msg_ring)
+		return;
+
+	do {
+		n = 0;
+		lock(&opal_msg_lock);
+		if (!msg_ring) {
+			unlock(&opal_msg_lock);
+			return;
+		}
+		tail = be64_to_cpu(msg_ring->tail);
+		/* Don't trust the host further than what we produced */
+		if (tail - msg_ring_reaped > msg_ring_head - msg_ring_reaped)
+			tail = msg_ring_head;
+		while (msg_ring_reaped != tail && n < OPAL_GET_MSGS_BATCH)
+			done[n++] = msg_ring_done[msg_ring_reaped++ &
+						  msg_ring_mask];
+		if (tail == msg_ring_head && list_empty(&msg_pending_list))
+			opal_update_pending_evt(OPAL_EVENT_MSG_PENDING, 0);
+		unlock(&opal_msg_lock);
+
+		for (i = 0; i < n; i++)
+			if (done[i].consumed)
+				done[i].consumed(done[i].data);
+	} while (n == OPAL_GET_MSGS_BATCH);
+}
+
+static int64_t opal_register_msg_ring(uint64_t addr, uint64_t size)
+{
+	struct opal_msg_ring *ring = (struct opal_msg_ring *)addr;
+	struct opal_msg_done *done = NULL, *old_done;
+	uint64_t nr = 0;
+	int64_t rc = OPAL_SUCCESS;
+
+	if (ring) {
+		if (!opal_addr_valid(ring) || (addr & 7))
+			return OPAL_PARAMETER;
+		if (size < sizeof(*ring) + 2 * sizeof(struct opal_msg))
+			return OPAL_PARAMETER;
+
+		size = (size - sizeof(*ring)) / sizeof(struct opal_msg);
+		for (nr = 2; nr * 2 <= size && nr < OPAL_MSG_RING_MAX; nr <<= 1)
+			;
+		done = zalloc(nr * sizeof(*done));
+		if (!done)
+			return OPAL_NO_MEM;
+	}
+
+	/* Catch up with anything the host has already consumed */
+	opal_msg_ring_poll(NULL);
+
+	lock(&opal_msg_lock);
+	old_done = msg_ring_done;
+	if (msg_ring && msg_ring_reaped != msg_ring_head) {
+		/* Messages still on the old ring would be lost */
+		old_done = done;
+		rc = OPAL_BUSY;
+		goto out;
+	}
+
+	msg_ring = ring;
+	msg_ring_done = done;
+	msg_ring_mask = nr - 1;
+	msg_ring_head = msg_ring_reaped = 0;
+	if (ring) {
+		ring->head = ring->tail = 0;
+		ring->nr_msgs = cpu_to_be32(nr);
+		ring->overflows = 0;
+		lwsync();
+	}
+	prlog(PR_DEBUG, "%s message ring at %p, %u entries\n",
+	      ring ? "Registered" : "Unregistered", ring, (unsigned int)nr);
+out:
+	unlock(&opal_msg_lock);
+	free(old_done);
+	return rc;
+}
+opal_call(OPAL_REGISTER_MSG_RING, opal_register_msg_ring, 2);
+
+/*
+ * Called before booting an OS, including after a fast reboot. A ring
+ * left registered by the previous OS is in memory that now belongs to
+ * the next one, stop using it. Messages the host never took are lost,
+ * their consumed() callbacks still run.
+ */
+void opal_drop_msg_ring(void)
+{
+	struct opal_msg_done *done;
+	uint64_t i, head, reaped;
+	uint32_t mask;
+
+	lock(&opal_msg_lock);
+	done = msg_ring_done;
+	head = msg_ring_head;
+	reaped = msg_ring_reaped;
+	mask = msg_ring_mask;
+	msg_ring = NULL;
+	msg_ring_done = NULL;
+	msg_ring_head = msg_ring_reaped = 0;
+	if (list_empty(&msg_pending_list))
+		opal_update_pending_evt(OPAL_EVENT_MSG_PENDING, 0);
+	unlock(&opal_msg_lock);
+
+	if (!done)
+		return;
+	for (i = reaped; i != head; i++)
+		if (done[i & mask].consumed)
+			done[i & mask].consumed(done[i & mask].data);
+	free(done);
+}
 
 int _opal_queue_msg(enum opal_msg_type msg_type, void *data,
 		    void (*consumed)(void *data), size_t num_params,
 		    const u64 *params)
 {
 	struct opal_msg_entry *entry;
+	struct opal_msg msg;
+
+	if (num_params > ARRAY_SIZE(msg.params)) {
+		prerror("Discarding extra parameters\n");
+		num_params = ARRAY_SIZE(msg.params);
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_type = cpu_to_be32(msg_type);
+	memcpy(msg.params, params, num_params*sizeof(u64));
 
 	lock(&opal_msg_lock);
 
+	if (opal_msg_ring_put(&msg, consumed, data)) {
+		unlock(&opal_msg_lock);
+		return 0;
+	}
+
 	entry = list_pop(&msg_free_list, struct opal_msg_entry, link);
 	if (!entry) {
 		prerror("No available node in the free list, allocating\n");
@@ -51,17 +262,12 @@ int _opal_queue_msg(enum opal_msg_type msg_type, void *data,
 			unlock(&opal_msg_lock);
 			return OPAL_RESOURCE;
 		}
+		entry->pooled = false;
 	}
 
 	entry->consumed = consumed;
 	entry->data = data;
-	entry->msg.msg_type = cpu_to_be32(msg_type);
-
-	if (num_params > ARRAY_SIZE(entry->msg.params)) {
-		prerror("Discarding extra parameters\n");
-		num_params = ARRAY_SIZE(entry->msg.params);
-	}
-	memcpy(entry->msg.params, params, num_params*sizeof(u64));
+	entry->msg = msg;
 
 	list_add_tail(&msg_pending_list, &entry->link);
 	opal_update_pending_evt(OPAL_EVENT_MSG_PENDING,
@@ -72,11 +278,33 @@ int _opal_queue_msg(enum opal_msg_type msg_type, void *data,
 	return 0;
 }
 
-static int64_t opal_get_msg(uint64_t *buffer, uint64_t size)
+/* Called with opal_msg_lock held, entry is no longer on the pending list */
+static void opal_msg_release(struct opal_msg_entry *entry)
+{
+	if (entry->pooled)
+		list_add(&msg_free_list, &entry->link);
+	else
+		free(entry);
+
+	/* The host may still have messages to take off the ring */
+	if (list_empty(&msg_pending_list) && opal_msg_ring_empty())
+		opal_update_pending_evt(OPAL_EVENT_MSG_PENDING, 0);
+}
+
+/*
+ * Copy as many pending messages as fit in buffer, oldest first. The
+ * consumed() callbacks run once the lock has been dropped.
+ * Returns the number of messages copied.
+ */
+static int64_t opal_get_msgs(uint64_t *buffer, uint64_t size)
 {
+	struct {
+		void (*consumed)(void *data);
+		void *data;
+	} done[OPAL_GET_MSGS_BATCH];
+	struct opal_msg *msgs = (struct opal_msg *)buffer;
 	struct opal_msg_entry *entry;
-	void (*callback)(void *data);
-	void *data;
+	uint64_t i, n, max;
 
 	if (size < sizeof(struct opal_msg) || !buffer)
 		return OPAL_PARAMETER;
@@ -84,28 +312,42 @@ static int64_t opal_get_msg(uint64_t *buffer, uint64_t size)
 	if (!opal_addr_valid(buffer))
 		return OPAL_PARAMETER;
 
+	max = MIN(size / sizeof(struct opal_msg), (uint64_t)OPAL_GET_MSGS_BATCH);
+
 	lock(&opal_msg_lock);
+	for (n = 0; n < max; n++) {
+		entry = list_pop(&msg_pending_list, struct opal_msg_entry,
+				 link);
+		if (!entry)
+			break;
 
-	entry = list_pop(&msg_pending_list, struct opal_msg_entry, link);
-	if (!entry) {
-		unlock(&opal_msg_lock);
-		return OPAL_RESOURCE;
+		memcpy(&msgs[n], &entry->msg, sizeof(entry->msg));
+		done[n].consumed = entry->consumed;
+		done[n].data = entry->data;
+		opal_msg_release(entry);
 	}
+	unlock(&opal_msg_lock);
 
-	memcpy(buffer, &entry->msg, sizeof(entry->msg));
-	callback = entry->consumed;
-	data = entry->data;
+	if (!n)
+		return OPAL_RESOURCE;
 
-	list_add(&msg_free_list, &entry->link);
-	if (list_empty(&msg_pending_list))
-		opal_update_pending_evt(OPAL_EVENT_MSG_PENDING, 0);
+	for (i = 0; i < n; i++)
+		if (done[i].consumed)
+			done[i].consumed(done[i].data);
 
-	unlock(&opal_msg_lock);
+	return n;
+}
+opal_call(OPAL_GET_MSGS, opal_get_msgs, 2);
 
-	if (callback)
-		callback(data);
+static int64_t opal_get_msg(uint64_t *buffer, uint64_t size)
+{
+	int64_t rc;
+
+	if (size < sizeof(struct opal_msg))
+		return OPAL_PARAMETER;
 
-	return OPAL_SUCCESS;
+	rc = opal_get_msgs(buffer, sizeof(struct opal_msg));
+	return rc < 0 ? rc : OPAL_SUCCESS;
 }
 opal_call(OPAL_GET_MSG, opal_get_msg, 2);
 
@@ -127,18 +369,15 @@ static int64_t opal_check_completion(uint64_t *buffer, uint64_t size,
 			list_del(&entry->link);
 			callback = entry->consumed;
 			data = entry->data;
-			list_add(&msg_free_list, &entry->link);
-			if (list_empty(&msg_pending_list))
-				opal_update_pending_evt(OPAL_EVENT_MSG_PENDING,
-							0);
+			if (size >= sizeof(struct opal_msg))
+				memcpy(buffer, &entry->msg,
+				       sizeof(entry->msg));
+			opal_msg_release(entry);
 			rc = OPAL_SUCCESS;
 			break;
 		}
 	}
 
-	if (rc == OPAL_SUCCESS && size >= sizeof(struct opal_msg))
-		memcpy(buffer, &entry->msg, sizeof(entry->msg));
-
 	unlock(&opal_msg_lock);
 
 	if (callback)
@@ -151,22 +390,14 @@ opal_call(OPAL_CHECK_ASYNC_COMPLETION, opal_check_completion, 3);
 
 void opal_init_msg(void)
 {
-	struct opal_msg_entry *entry;
 	int i;
 
-	for (i = 0; i < OPAL_MAX_MSGS; i++, entry++) {
-                entry = zalloc(sizeof(*entry));
-                if (!entry)
-                        goto err;
-		list_add_tail(&msg_free_list, &entry->link);
-        }
-        return;
-
-err:
-        for (; i > 0; i--) {
-                entry = list_pop(&msg_free_list, struct opal_msg_entry, link);
-                if (entry)
-                        free(entry);
-        }
+	list_head_init(&msg_free_list);
+	for (i = 0; i < OPAL_MAX_MSGS; i++) {
+		msg_pool[i].pooled = true;
+		list_add_tail(&msg_free_list, &msg_pool[i].link);
+	}
+
+	opal_add_poller(opal_msg_ring_poll, NULL);
 }
 
@@ -497,12 +497,26 @@ struct opal_poll_entry {
 	struct list_node	link;
 	void			(*poller)(void *data);
 	void			*data;
+	const char		*name;
+	uint64_t		min_interval;	/* In timebase ticks */
+	uint64_t		next_run;
+
+	/*
+	 * Statistics. Pollers can run on several CPUs at once so these
+	 * are only approximate, which is good enough to find the expensive
+	 * ones.
+	 */
+	uint64_t		calls;
+	uint64_t		skipped;
+	uint64_t		total_tb;
+	uint64_t		max_tb;
 };
 
 static struct list_head opal_pollers = LIST_HEAD_INIT(opal_pollers);
 static struct lock opal_poll_lock = LOCK_UNLOCKED;
 
-void opal_add_poller(void (*poller)(void *data), void *data)
+void __opal_add_poller(void (*poller)(void *data), void *data,
+		       unsigned int min_ms, const char *name)
 {
 	struct opal_poll_entry *ent;
 
@@ -510,6 +524,8 @@ void opal_add_poller(void (*poller)(void *data), void *data)
 	assert(ent);
 	ent->poller = poller;
 	ent->data = data;
+	ent->name = name;
+	ent->min_interval = msecs_to_tb(min_ms);
 	lock(&opal_poll_lock);
 	list_add_tail(&opal_pollers, &ent->link);
 	unlock(&opal_poll_lock);
@@ -550,6 +566,7 @@ void opal_run_pollers(void)
 	static int pollers_with_lock_warnings = 0;
 	static int poller_recursion = 0;
 	struct opal_poll_entry *poll_ent;
+	uint64_t now, spent;
 	bool was_in_poller;
 
 	/* Don't re-enter on this CPU, unless it was an OPAL re-entry */
@@ -604,9 +621,25 @@ void opal_run_pollers(void)
 	check_timers(false);
 
 	/* The pollers are run lokelessly, see comment in opal_del_poller */
-	list_for_each(&opal_pollers, poll_ent, link)
+	list_for_each(&opal_pollers, poll_ent, link) {
+		now = mftb();
+		if (poll_ent->min_interval) {
+			if (tb_compare(now, poll_ent->next_run) == TB_ABEFOREB) {
+				poll_ent->skipped++;
+				continue;
+			}
+			poll_ent->next_run = now + poll_ent->min_interval;
+		}
+
 		poll_ent->poller(poll_ent->data);
 
+		spent = mftb() - now;
+		poll_ent->calls++;
+		poll_ent->total_tb += spent;
+		if (spent > poll_ent->max_tb)
+			poll_ent->max_tb = spent;
+	}
+
 	/* Disable poller flag */
 	this_cpu()->in_poller = was_in_poller;
 
@@ -614,6 +647,62 @@ void opal_run_pollers(void)
 	check_stacks();
 }
 
+void opal_poller_stats_dump(void)
+{
+	struct opal_poll_entry *ent;
+
+	prlog(PR_NOTICE, "POLL: %-32s %8s %12s %12s %12s %10s\n", "poller",
+	      "min(ms)", "calls", "skipped", "total(us)", "max(us)");
+
+	list_for_each(&opal_pollers, ent, link)
+		prlog(PR_NOTICE, "POLL: %-32s %8lu %12llu %12llu %12lu %10lu\n",
+		      ent->name, tb_to_msecs(ent->min_interval), ent->calls,
+		      ent->skipped, tb_to_usecs(ent->total_tb),
+		      tb_to_usecs(ent->max_tb));
+}
+
+static int64_t opal_poller_stats(uint64_t op, struct opal_poller_stat *stats,
+				 uint64_t count)
+{
+	struct opal_poll_entry *ent;
+	unsigned int n = 0;
+
+	switch (op) {
+	case OPAL_POLLER_STATS_RESET:
+		/* Counts racing with this may be off, that's fine */
+		list_for_each(&opal_pollers, ent, link)
+			ent->calls = ent->skipped = ent->total_tb =
+				ent->max_tb = 0;
+		return OPAL_SUCCESS;
+	case OPAL_POLLER_STATS_DUMP:
+		opal_poller_stats_dump();
+		return OPAL_SUCCESS;
+	case OPAL_POLLER_STATS_READ:
+		break;
+	default:
+		return OPAL_PARAMETER;
+	}
+
+	if (!opal_addr_valid(stats))
+		return OPAL_PARAMETER;
+
+	list_for_each(&opal_pollers, ent, link) {
+		if (n >= count)
+			break;
+		memset(&stats[n], 0, sizeof(stats[n]));
+		strncpy(stats[n].name, ent->name, sizeof(stats[n].name) - 1);
+		stats[n].min_interval_tb = cpu_to_be64(ent->min_interval);
+		stats[n].calls = cpu_to_be64(ent->calls);
+		stats[n].skipped = cpu_to_be64(ent->skipped);
+		stats[n].total_tb = cpu_to_be64(ent->total_tb);
+		stats[n].max_tb = cpu_to_be64(ent->max_tb);
+		n++;
+	}
+
+	return n;
+}
+opal_call(OPAL_POLLER_STATS, opal_poller_stats, 3);
+
 static int64_t opal_poll_events(__be64 *outstanding_event_mask)
 {
 
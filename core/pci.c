@@ -1692,34 +1692,26 @@ void pci_add_device_nodes(struct phb *phb,
 
 static void pci_do_jobs(void (*fn)(void *))
 {
-	struct cpu_job **jobs;
+	struct cpu_job_group group;
+	bool queued;
 	int i;
 
-	jobs = zalloc(sizeof(struct cpu_job *) * ARRAY_SIZE(phbs));
-	assert(jobs);
+	init_cpu_job_group(&group);
 	for (i = 0; i < ARRAY_SIZE(phbs); i++) {
-		if (!phbs[i]) {
-			jobs[i] = NULL;
+		if (!phbs[i])
 			continue;
-		}
-
-		jobs[i] = __cpu_queue_job(NULL, phbs[i]->dt_node->name,
-					  fn, phbs[i], false);
-		assert(jobs[i]);
 
+		queued = cpu_queue_job_group(&group, NULL,
+					     phbs[i]->dt_node->name,
+					     fn, phbs[i]);
+		assert(queued);
 	}
 
 	/* If no secondary CPUs, do everything sync */
 	cpu_process_local_jobs();
 
 	/* Wait until all tasks are done */
-	for (i = 0; i < ARRAY_SIZE(phbs); i++) {
-		if (!jobs[i])
-			continue;
-
-		cpu_wait_job(jobs[i], true);
-	}
-	free(jobs);
+	cpu_wait_job_group(&group);
 }
 
 static void __pci_init_slots(void)
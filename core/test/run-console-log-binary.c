@@ -0,0 +1,150 @@
+/* Copyright 2018 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Round trip TRACE_PRLOG records: written by prlog() in binary mode,
+ * rendered by dump_trace, compared with what vsnprintf() makes of them.
+ */
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define __TEST__
+
+unsigned long tb_hz = 512000000;
+
+static inline unsigned long mftb(void)
+{
+	return 42;
+}
+
+int _printf(const char* fmt, ...);
+
+#include "../console-log.c"
+
+#define main dump_trace_main
+int dump_trace_main(int argc, char *argv[]);
+#include "../../external/trace/dump_trace.c"
+#undef main
+
+struct debug_descriptor debug_descriptor;
+
+static union trace last_trace;
+
+void trace_add(union trace *trace, u8 type, u16 len)
+{
+	trace->hdr.type = type;
+	trace->hdr.len_div_8 = (len + 7) / 8;
+	last_trace = *trace;
+}
+
+static char console_buffer[1024];
+
+ssize_t console_write(bool flush_to_drivers __unused, const void *buf,
+		      size_t count)
+{
+	memcpy(console_buffer, buf, count);
+	console_buffer[count] = '\0';
+	return count;
+}
+
+/* The "image" the format strings are looked up in */
+static const char fmts[] =
+	"%s: %d %u %x %08llx%% %s\n\0"
+	"%-8s|%5d|%hx|%hhu|%lu|%zu|%c|%p\n\0"
+	"no args, no newline\0";
+
+/* Render last_trace with dump_trace, as printed on stdout */
+static void dump_last(char *out, size_t len)
+{
+	FILE *f = tmpfile();
+	int saved;
+	size_t n;
+
+	assert(f);
+	fflush(stdout);
+	saved = dup(1);
+	assert(saved >= 0);
+	assert(dup2(fileno(f), 1) == 1);
+
+	dump_prlog(&last_trace.prlog);
+
+	fflush(stdout);
+	assert(dup2(saved, 1) == 1);
+	close(saved);
+	rewind(f);
+	n = fread(out, 1, len - 1, f);
+	out[n] = '\0';
+	fclose(f);
+}
+
+static void check(const char *fmt, ...)
+{
+	static char expect[256], got[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(expect, sizeof(expect), fmt, ap);
+	va_end(ap);
+	if (!strlen(expect) || expect[strlen(expect) - 1] != '\n')
+		strcat(expect, "\n");
+
+	va_start(ap, fmt);
+	last_trace.hdr.type = 0;
+	vprlog(PR_DEBUG, fmt, ap);
+	va_end(ap);
+	assert(last_trace.hdr.type == TRACE_PRLOG);
+
+	dump_last(got, sizeof(got));
+	printf("%s", got);
+	assert(strncmp(got, "PRLOG [7] ", 10) == 0);
+	assert(strcmp(got + 10, expect) == 0);
+}
+
+int main(void)
+{
+	const char *f1 = fmts;
+	const char *f2 = f1 + strlen(f1) + 1;
+	const char *f3 = f2 + strlen(f2) + 1;
+
+	debug_descriptor.console_log_levels = 0x75;
+	debug_descriptor.trace_mask = 1ul << TRACE_PRLOG;
+
+	image = (char *)fmts;
+	image_base = (u64)fmts;
+	image_size = sizeof(fmts);
+
+	check(f1, "chatty", -5, 42u, 0xbeefu, 0x1234ull, "x");
+	check(f2, "pad", -1, 0x12345, 300, 7ul, (size_t)99, 'q',
+	      (void *)0x1000);
+	check(f3);
+
+	/* Without the image only the raw record can be shown */
+	{
+		static char got[256], expect[64];
+
+		image = NULL;
+		dump_last(got, sizeof(got));
+		snprintf(expect, sizeof(expect), "PRLOG [7] fmt=0x%016llx\n",
+			 (unsigned long long)f3);
+		assert(strcmp(got, expect) == 0);
+	}
+	return 0;
+}
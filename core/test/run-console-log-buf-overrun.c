@@ -53,6 +53,13 @@ static inline unsigned long mftb(void)
 char console_buffer[4096];
 struct debug_descriptor debug_descriptor;
 
+void trace_add(union trace *trace, u8 type, u16 len)
+{
+	(void)trace;
+	(void)type;
+	(void)len;
+}
+
 bool flushed_to_drivers;
 
 ssize_t console_write(bool flush_to_drivers, const void *buf, size_t count)
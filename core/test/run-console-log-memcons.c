@@ -0,0 +1,267 @@
+/* Copyright 2014-2017 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+#define __TEST__
+
+/* Count the barriers, each one is a memcons.out_pos update */
+static unsigned long nr_lwsync;
+#define lwsync()	do { nr_lwsync++; __sync_synchronize(); } while (0)
+
+/* Don't include this, it's PPC-specific */
+#define __CPU_H
+struct cpu_thread {
+	bool	con_suspend;
+	bool	con_need_flush;
+};
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
+
+#include <skiboot.h>
+#include <lock.h>
+
+/* A smaller console makes it easy to exercise the wrap */
+#undef INMEM_CON_START
+#undef INMEM_CON_LEN
+#define INMEM_CON_LEN		0x1000
+static char test_con_buf[INMEM_CON_LEN];
+#define INMEM_CON_START		((unsigned long)test_con_buf)
+
+#include "../console.c"
+
+struct dt_node *opal_node, *dt_chosen;
+unsigned long top_of_ram;
+
+bool lock_recursive_caller(struct lock *l __unused,
+			   const char *caller __unused)
+{
+	return false;
+}
+
+void lock_caller(struct lock *l __unused, const char *caller __unused)
+{
+}
+
+void unlock(struct lock *l __unused)
+{
+}
+
+void _prlog(int log_level __unused, const char *fmt __unused, ...)
+{
+}
+
+void opal_update_pending_evt(uint64_t evt_mask __unused,
+			     uint64_t evt_values __unused)
+{
+}
+
+void __opal_register(uint64_t token __unused, void *func __unused,
+		     unsigned num_args __unused)
+{
+}
+
+void __opal_add_poller(void (*poller)(void *data) __unused,
+		       void *data __unused, unsigned int min_ms __unused,
+		       const char *name __unused)
+{
+}
+
+struct dt_node *dt_new(struct dt_node *parent __unused,
+		       const char *name __unused)
+{
+	return NULL;
+}
+
+struct dt_node *dt_new_addr(struct dt_node *parent __unused,
+			    const char *name __unused, uint64_t unit_addr __unused)
+{
+	return NULL;
+}
+
+struct dt_node *dt_find_by_name(struct dt_node *root __unused,
+				const char *name __unused)
+{
+	return NULL;
+}
+
+bool dt_has_node_property(const struct dt_node *node __unused,
+			  const char *name __unused, const char *val __unused)
+{
+	return false;
+}
+
+struct dt_property *__dt_find_property(struct dt_node *node __unused,
+				       const char *name __unused)
+{
+	return NULL;
+}
+
+void dt_del_property(struct dt_node *node __unused,
+		     struct dt_property *prop __unused)
+{
+}
+
+struct dt_property *dt_add_property_string(struct dt_node *node __unused,
+					   const char *name __unused,
+					   const char *value __unused)
+{
+	return NULL;
+}
+
+struct dt_property *__dt_add_property_cells(struct dt_node *node __unused,
+					    const char *name __unused,
+					    int count __unused, ...)
+{
+	return NULL;
+}
+
+struct dt_property *dt_add_property(struct dt_node *node __unused,
+				    const char *name __unused,
+				    const void *val __unused,
+				    size_t size __unused)
+{
+	return NULL;
+}
+
+/*
+ * The old character at a time writer, which the span based one must
+ * match byte for byte.
+ */
+static char ref_buf[INMEM_CON_OUT_LEN];
+static size_t ref_in, ref_out;
+static bool ref_wrapped;
+static uint32_t ref_out_pos;
+
+static void ref_write_char(char c)
+{
+	if (!c)
+		return;
+	ref_buf[ref_in++] = c;
+	if (ref_in >= INMEM_CON_OUT_LEN) {
+		ref_in = 0;
+		ref_wrapped = true;
+	}
+	lwsync();
+	ref_out_pos = ref_in | (ref_wrapped ? MEMCONS_OUT_POS_WRAP : 0);
+	if (ref_in == ref_out)
+		ref_out = (ref_in + 1) % INMEM_CON_OUT_LEN;
+}
+
+static void ref_write(const char *buf, size_t count)
+{
+	while (count--) {
+		char c = *(buf++);
+		if (c == '\n')
+			ref_write_char('\r');
+		ref_write_char(c);
+	}
+}
+
+static void check_write(const char *buf, size_t count)
+{
+	assert(console_write(false, buf, count) == (ssize_t)count);
+	ref_write(buf, count);
+
+	assert(con_in == ref_in);
+	assert(con_out == ref_out);
+	assert(con_wrapped == ref_wrapped);
+	assert(memcons.out_pos == ref_out_pos);
+	assert(memcmp(con_buf, ref_buf, INMEM_CON_OUT_LEN) == 0);
+}
+
+static size_t test_con_write(const char *buf __unused, size_t len)
+{
+	return len;
+}
+
+static struct con_ops test_con = {
+	.write = test_con_write,
+};
+
+static const char line[] =
+	"[   42.123456789,7] PHB#0000[0:0]: Initializing PHB4 with "
+	"a rather long log line to be copied in one go\n";
+
+int main(void)
+{
+	static char big[INMEM_CON_OUT_LEN + 100];
+	unsigned long i, n;
+	clock_t t;
+
+	/* Plain lines, no driver so con_out follows con_in */
+	for (i = 0; i < 200; i++)
+		check_write(line, sizeof(line) - 1);
+
+	/* Embedded NULs and newlines, including at the edges */
+	check_write("\nab\0cd\n\n\0", 9);
+	check_write("\0", 1);
+	check_write("", 0);
+
+	/*
+	 * With a driver attached, but flushing suspended, the tail is left
+	 * behind and pushed around once the head catches up.
+	 */
+	con_driver = &test_con;
+	ref_out = con_out;
+	fake_cpu.con_suspend = true;
+	for (i = 0; i < 100; i++)
+		check_write(line, sizeof(line) - 1);
+	assert(con_out == (con_in + 1) % INMEM_CON_OUT_LEN);
+
+	/* Spans larger than the whole buffer, from various offsets */
+	memset(big, 'x', sizeof(big));
+	for (i = 0; i < sizeof(big); i += 37)
+		big[i] = 'a' + i % 26;
+	for (i = 0; i < 5; i++) {
+		check_write(line, i * 7);
+		check_write(big, sizeof(big));
+	}
+	fake_cpu.con_suspend = false;
+	con_driver = NULL;
+
+	/* One out_pos update per console_write() instead of per byte */
+	nr_lwsync = 0;
+	console_write(false, line, sizeof(line) - 1);
+	assert(nr_lwsync == 1);
+	ref_write(line, sizeof(line) - 1);
+	assert(nr_lwsync == 1 + sizeof(line));
+	assert(memcmp(con_buf, ref_buf, INMEM_CON_OUT_LEN) == 0);
+
+	/* Speed, for information only */
+	n = 200000;
+	t = clock();
+	for (i = 0; i < n; i++)
+		ref_write(line, sizeof(line) - 1);
+	t = clock() - t;
+	printf("per-char: %.1f ns/line\n", t * 1e9 / CLOCKS_PER_SEC / n);
+	t = clock();
+	for (i = 0; i < n; i++)
+		console_write(false, line, sizeof(line) - 1);
+	t = clock() - t;
+	printf("span    : %.1f ns/line\n", t * 1e9 / CLOCKS_PER_SEC / n);
+
+	return 0;
+}
@@ -37,6 +37,13 @@ static inline unsigned long mftb(void)
 
 struct debug_descriptor debug_descriptor;
 
+void trace_add(union trace *trace, u8 type, u16 len)
+{
+	(void)trace;
+	(void)type;
+	(void)len;
+}
+
 bool flushed_to_drivers;
 char console_buffer[4096];
 
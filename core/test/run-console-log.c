@@ -37,6 +37,16 @@ int _printf(const char* fmt, ...);
 
 struct debug_descriptor debug_descriptor;
 
+static union trace last_trace;
+static u16 last_trace_len;
+
+void trace_add(union trace *trace, u8 type, u16 len)
+{
+	trace->hdr.type = type;
+	last_trace = *trace;
+	last_trace_len = len;
+}
+
 bool flushed_to_drivers;
 char console_buffer[4096];
 
@@ -70,5 +80,58 @@ int main(void)
 	assert(strcmp(console_buffer, "[    0.000000042,5] Hello World") == 0);
 	assert(flushed_to_drivers==true);
 
+	/* Binary mode: memory only messages become TRACE_PRLOG records */
+	debug_descriptor.trace_mask = 1ul << TRACE_PRLOG;
+	memset(console_buffer, 0, sizeof(console_buffer));
+	{
+		static const char fmt[] = "%s: %d %08llx%% %s\n";
+		struct trace_prlog *p = &last_trace.prlog;
+		const char *data = (const char *)p->data;
+		char name[] = "chatty";
+
+		prlog(PR_DEBUG, fmt, name, -1, 0x1234ull, "x");
+		/* Only the copy matters once we've returned */
+		name[0] = 'X';
+		assert(console_buffer[0] == 0);
+		assert(p->hdr.type == TRACE_PRLOG);
+		assert(p->level == PR_DEBUG);
+		assert(p->nargs == 4);
+		assert(be64_to_cpu(p->fmt) == (u64)fmt);
+		/* Only the low 32 bits of an int are defined */
+		assert((u32)be64_to_cpu(p->data[1]) == (u32)-1);
+		assert(be64_to_cpu(p->data[2]) == 0x1234);
+		assert(strcmp(data + be64_to_cpu(p->data[0]), "chatty") == 0);
+		assert(strcmp(data + be64_to_cpu(p->data[3]), "x") == 0);
+		assert(last_trace_len == offsetof(struct trace_prlog, data) +
+		       4 * 8 + 16);
+	}
+
+	/* Messages for the drivers are still formatted */
+	last_trace.hdr.type = 0;
+	prlog(PR_NOTICE, "Hello World");
+	assert(strcmp(console_buffer, "[    0.000000042,5] Hello World") == 0);
+	assert(last_trace.hdr.type == 0);
+
+	/* As is anything that doesn't fit in a record */
+	prlog(PR_DEBUG, "%d %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8, 9);
+	assert(strcmp(console_buffer, "[    0.000000042,7] 1 2 3 4 5 6 7 8 9") == 0);
+	assert(last_trace.hdr.type == 0);
+	{
+		char big[TRACE_PRLOG_DATA];
+
+		/* Strings aren't cut short to make them fit */
+		memset(big, 'a', sizeof(big) - 8);
+		big[sizeof(big) - 8] = '\0';
+		prlog(PR_DEBUG, "%s", big);
+		assert(last_trace.hdr.type == 0);
+		assert(strlen(console_buffer) == 20 + strlen(big));
+
+		/* But one that just fits is recorded */
+		big[sizeof(big) - 9] = '\0';
+		prlog(PR_DEBUG, "%s", big);
+		assert(last_trace.hdr.type == TRACE_PRLOG);
+		assert(last_trace_len == sizeof(struct trace_prlog));
+	}
+
 	return 0;
 }
@@ -32,7 +32,21 @@ static inline bool fake_is_rodata(const void *p)
 
 #include "../device.c"
 #include <assert.h>
+#include <time.h>
 #include "../../test/dt_common.c"
+
+void lock_caller(struct lock *l, const char *caller)
+{
+	(void)caller;
+	assert(!l->lock_val);
+	l->lock_val++;
+}
+
+void unlock(struct lock *l)
+{
+	assert(l->lock_val);
+	l->lock_val--;
+}
 const char *prop_to_fix[] = {"something", NULL};
 const char **props_to_fix(struct dt_node *node);
 
@@ -101,6 +115,207 @@ const char **props_to_fix(struct dt_node *node)
 	return NULL;
 }
 
+/* Nodes big enough to get an index, kept in sync through adds/deletes */
+static void test_index(void)
+{
+	unsigned int names = dt_names_count;
+	struct dt_node *root, *n, *other;
+	struct dt_property *p;
+	char name[40];
+	int i;
+
+	root = dt_new_root("");
+	n = dt_new(root, "props");
+	other = dt_new(root, "other");
+	for (i = 0; i < 100; i++) {
+		snprintf(name, sizeof(name), "prop%d", i);
+		dt_add_property_cells(n, name, i);
+		dt_add_property_cells(other, name, i);
+	}
+	assert(n->num_props == 100);
+	/* Built as the node grows, so lookups never modify the tree */
+	assert(n->prop_index && !n->child_index);
+	assert(!root->prop_index && !root->child_index);
+
+	/* Names are shared, not copied per node */
+	assert(dt_find_property(n, "prop7")->name ==
+	       dt_find_property(other, "prop7")->name);
+
+	for (i = 0; i < 100; i += 2) {
+		snprintf(name, sizeof(name), "prop%d", i);
+		dt_check_del_prop(n, name);
+	}
+	for (i = 0; i < 100; i++) {
+		snprintf(name, sizeof(name), "prop%d", i);
+		p = __dt_find_property(n, name);
+		assert(i % 2 ? p && dt_property_get_cell(p, 0) == i : !p);
+	}
+
+	/* A resized property may move, lookups must still find it */
+	p = __dt_find_property(n, "prop51");
+	dt_resize_property(n, &p, 4096);
+	assert(__dt_find_property(n, "prop51") == p);
+	assert(dt_prop_get_u32(n, "prop99") == 99);
+	dt_add_property_cells(n, "prop0", 0);
+	assert(dt_prop_get_u32(n, "prop0") == 0);
+
+	/* Children, added out of order */
+	for (i = 0; i < 200; i++)
+		assert(dt_new_addr(n, "child", (i * 37) % 200));
+	assert(!dt_new_addr(n, "child", 5));
+	assert(n->num_children == 200);
+	assert(n->child_index);
+	assert(is_sorted(n));
+	assert(dt_find_by_path(root, "/props/child@2a") ==
+	       dt_find_by_name_addr(n, "child", 0x2a));
+	assert(dt_find_by_path(root, "/props/child@2a"));
+	assert(!dt_find_by_path(root, "/props/child@c8"));
+	assert(dt_find_by_path(root, "/props/child") == dt_first(n));
+
+	dt_free(dt_find_by_name_addr(n, "child", 0x2a));
+	assert(!dt_find_by_path(root, "/props/child@2a"));
+	assert(dt_find_by_path(root, "/props/child@2b"));
+	assert(dt_new_addr(n, "child", 0x2a));
+	assert(is_sorted(n));
+
+	/* A miss in the index still finds grandchildren */
+	other = dt_new_addr(dt_find_by_name_addr(n, "child", 0x10), "gc",
+			    0xffffffffffffffffull);
+	assert(dt_find_by_name_addr(n, "gc", 0xffffffffffffffffull) == other);
+	assert(dt_find_by_name_addr(root, "gc", 0xffffffffffffffffull) ==
+	       other);
+	assert(!dt_find_by_name_addr(n, "gc", 0x10));
+	assert(!dt_find_by_name_addr(n, "child", 0x1000));
+
+	/* The longest key that fits, and one that takes the slow path */
+	snprintf(name, sizeof(name), "%031d", 0);
+	other = dt_new_addr(n, name, 0xffffffffffffffffull);
+	assert(dt_find_by_name_addr(n, name, 0xffffffffffffffffull) == other);
+	snprintf(name, sizeof(name), "%032d", 0);
+	other = dt_new_addr(n, name, 0xffffffffffffffffull);
+	assert(dt_find_by_name_addr(n, name, 0xffffffffffffffffull) == other);
+	assert(dt_find_by_name_addr(root, name, 0xffffffffffffffffull) ==
+	       other);
+
+	dt_free(root);
+	assert(dt_names_count == names);
+}
+
+static u64 journal_notified;
+
+static void journal_notify(u64 gen)
+{
+	journal_notified = gen;
+}
+
+static void test_journal(void)
+{
+	unsigned int names = dt_names_count;
+	struct dt_node *scratch, *n;
+	const struct dt_change *c;
+	u32 phandle;
+	char name[32];
+	int i;
+
+	dt_root = dt_new_root("");
+	dt_journal_start(journal_notify);
+
+	/* Only the live tree is journalled */
+	scratch = dt_new_root("");
+	dt_add_property_cells(dt_new(scratch, "x"), "y", 1);
+	dt_free(scratch);
+	assert(dt_journal_gen() == 0 && !journal_notified);
+
+	n = dt_new(dt_root, "n");
+	dt_new(dt_new(n, "sub"), "subsub");
+	c = dt_journal_get(1);
+	assert(c && c->type == DT_CHANGE_NODE_ADD && c->phandle == n->phandle);
+	assert(journal_notified == 3);
+
+	for (i = 0; i < DT_JOURNAL_SIZE; i++) {
+		snprintf(name, sizeof(name), "prop%d", i);
+		dt_add_property_cells(n, name, i);
+	}
+	dt_check_del_prop(n, "prop7");
+	assert(dt_journal_gen() == DT_JOURNAL_SIZE + 4);
+	assert(!dt_journal_get(4));
+	c = dt_journal_get(5);
+	assert(c && c->type == DT_CHANGE_PROP_ADD && !strcmp(c->name, "prop1"));
+	c = dt_journal_get(dt_journal_gen());
+	assert(c->type == DT_CHANGE_PROP_DEL && !strcmp(c->name, "prop7"));
+	assert(!dt_journal_get(dt_journal_gen() + 1));
+
+	/* Freeing a subtree records just its top */
+	phandle = n->phandle;
+	dt_free(n);
+	c = dt_journal_get(dt_journal_gen());
+	assert(c->type == DT_CHANGE_NODE_DEL && c->phandle == phandle);
+	assert(dt_journal_get(dt_journal_gen() - 1)->type == DT_CHANGE_PROP_DEL);
+	assert(!dt_journal_lk.lock_val && !dt_names_lock.lock_val);
+
+	/* Restarting drops the old records, and their names */
+	dt_journal_start(NULL);
+	assert(dt_journal_gen() == 0 && !dt_journal_get(1));
+	dt_free(dt_root);
+	dt_root = NULL;
+	assert(dt_names_count == names);
+}
+
+static unsigned long time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/* Roughly what hdata does: lots of nodes with lots of properties */
+static void test_speed(void)
+{
+	static const char *props[] = {
+		"compatible", "reg", "ibm,chip-id", "status", "device_type",
+		"#address-cells", "#size-cells", "ranges", "interrupts",
+		"interrupt-parent", "ibm,loc-code", "ibm,slot-label",
+		"ibm,pcie-slot", "ibm,power-limit", "ibm,ec-level",
+		"ibm,fru-type", "ibm,vpd", "part-number", "serial-number",
+		"manufacturer", "ibm,phb-index", "ibm,opal-num-pes",
+		"ibm,opal-reserved-pe", "clock-frequency", "linux,pci-domain",
+	};
+	unsigned long start, build, lookup;
+	const int nodes = 2000, lookups = 200000;
+	struct dt_node *root, *bus, *n;
+	char name[64];
+	int i, j;
+
+	start = time_ns();
+	root = dt_new_root("");
+	bus = dt_new(root, "bus");
+	for (i = 0; i < nodes; i++) {
+		n = dt_new_addr(bus, "dev", i);
+		for (j = 0; j < ARRAY_SIZE(props); j++) {
+			/* Not in (fake) rodata, like names from an fdt */
+			strcpy(name, props[j]);
+			dt_add_property_cells(n, name, i, j);
+		}
+	}
+	build = time_ns() - start;
+
+	start = time_ns();
+	for (i = 0; i < lookups; i++) {
+		snprintf(name, sizeof(name), "/bus/dev@%x", (i * 7) % nodes);
+		n = dt_find_by_path(root, name);
+		assert(n);
+		j = i % ARRAY_SIZE(props);
+		assert(dt_prop_get_cell(n, props[j], 1) == j);
+	}
+	lookup = time_ns() - start;
+
+	printf("dt: %d nodes x %zu props built in %lu us, "
+	       "%lu ns per path + property lookup\n",
+	       nodes, ARRAY_SIZE(props), build / 1000, lookup / lookups);
+	dt_free(root);
+}
+
 int main(void)
 {
 	struct dt_node *root, *c1, *c2, *gc1, *gc2, *gc3, *ggc1, *ggc2;
@@ -289,7 +504,7 @@ int main(void)
 	n = p2->len;
 	while (p2 == p) {
 		n *= 2;
-		dt_resize_property(&p2, n);
+		dt_resize_property(c1, &p2, n);
 	}
 
 	assert(dt_find_property(c1, "some-property") == p2);
@@ -375,6 +590,16 @@ int main(void)
 	assert(dt_find_by_phandle(root, 0xf00) == gc3);
 	assert(dt_find_by_phandle(root, 0xf0f) == NULL);
 
+	/* Scratch nodes don't use up phandles */
+	c1 = __dt_new(NULL, "", false);
+	c2 = __dt_new(c1, "fragment@0", false);
+	assert(c1->phandle == 0 && c2->phandle == 0);
+	assert(dt_find_by_name(c1, "fragment@0") == c2);
+	assert(!__dt_new(c1, "fragment@0", false));
+	assert(last_phandle == 0xf00);
+	dt_free(c1);
+	assert(dt_new(root, "after-scratch")->phandle == 0xf01);
+
 	dt_free(root);
 
 	/* basic sorting */
@@ -465,6 +690,10 @@ int main(void)
 	new_prop_ph = dt_prop_get_u32(ut2, "something");
 	assert(!(new_prop_ph == ev1_ph));
 	dt_free(subtree);
+
+	test_index();
+	test_journal();
+	test_speed();
 	return 0;
 }
 
@@ -0,0 +1,299 @@
+/* Copyright 2018 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define __TEST__
+
+/* Every access to the timebase moves time on a bit */
+static uint64_t stamp;
+#define mftb()		(stamp += 100)
+#define sync()
+#define smt_lowest()
+#define smt_medium()
+
+/* Don't include this, it's PPC-specific */
+#define __CPU_H
+struct cpu_thread {
+	bool		job_has_no_return;
+	uint32_t	job_count;
+};
+struct cpu_job;
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
+static struct cpu_thread *boot_cpu = &fake_cpu;
+#define for_each_available_cpu(cpu)	for (cpu = NULL; cpu; )
+struct cpu_job *cpu_queue_job(struct cpu_thread *cpu, const char *name,
+			      void (*func)(void *data), void *data);
+void cpu_wait_job(struct cpu_job *job, bool free_it);
+void cpu_process_local_jobs(void);
+
+#include <skiboot.h>
+#include <lock.h>
+
+#include "../flash.c"
+#include "../timer.c"
+
+enum proc_gen proc_gen = proc_gen_p9;
+unsigned long tb_hz = 512000000;
+
+void lock_caller(struct lock *l, const char *caller __unused)
+{
+	assert(!l->lock_val);
+	l->lock_val = 1;
+}
+
+bool try_lock_caller(struct lock *l, const char *caller __unused)
+{
+	if (l->lock_val)
+		return false;
+	l->lock_val = 1;
+	return true;
+}
+
+void unlock(struct lock *l)
+{
+	assert(l->lock_val);
+	l->lock_val = 0;
+}
+
+bool lock_held_by_me(struct lock *l)
+{
+	return l->lock_val;
+}
+
+void p8_sbe_update_timer_expiry(uint64_t new_target __unused)
+{
+}
+
+void p9_sbe_update_timer_expiry(uint64_t new_target __unused)
+{
+}
+
+/* A flash backend that counts the chunks it is asked to do */
+#define TEST_FLASH_SIZE		0x200000
+#define TEST_ERASE_SIZE		0x10000
+#define TEST_OP_SIZE		0x100000
+
+static char flash_data[TEST_FLASH_SIZE];
+static char host_buf[TEST_FLASH_SIZE];
+static unsigned int nr_chunks;
+static int64_t last_len;
+
+/* Cancel from "another CPU" while the last chunk is being written */
+static bool cancel_in_last_chunk;
+static int64_t opal_flash_cancel(uint64_t id, uint64_t token);
+
+static int test_read(struct blocklevel_device *bl __unused, uint64_t pos,
+		     void *buf, uint64_t len)
+{
+	nr_chunks++;
+	last_len = len;
+	memcpy(buf, flash_data + pos, len);
+	return 0;
+}
+
+static int test_write(struct blocklevel_device *bl __unused, uint64_t pos,
+		      const void *buf, uint64_t len)
+{
+	nr_chunks++;
+	last_len = len;
+	memcpy(flash_data + pos, buf, len);
+	if (cancel_in_last_chunk && pos + len == TEST_OP_SIZE)
+		assert(opal_flash_cancel(0, 42) == OPAL_SUCCESS);
+	return 0;
+}
+
+static int test_erase(struct blocklevel_device *bl __unused, uint64_t pos,
+		      uint64_t len)
+{
+	nr_chunks++;
+	last_len = len;
+	memset(flash_data + pos, 0xff, len);
+	return 0;
+}
+
+static struct blocklevel_device test_bl = {
+	.read = test_read,
+	.write = test_write,
+	.erase = test_erase,
+	.erase_mask = TEST_ERASE_SIZE - 1,
+};
+
+int blocklevel_raw_read(struct blocklevel_device *bl, uint64_t pos,
+			void *buf, uint64_t len)
+{
+	return bl->read(bl, pos, buf, len);
+}
+
+int blocklevel_raw_write(struct blocklevel_device *bl, uint64_t pos,
+			 const void *buf, uint64_t len)
+{
+	return bl->write(bl, pos, buf, len);
+}
+
+int blocklevel_erase(struct blocklevel_device *bl, uint64_t pos,
+		     uint64_t len)
+{
+	return bl->erase(bl, pos, len);
+}
+
+/* Completion messages */
+static unsigned int nr_msgs;
+static uint64_t msg_token, msg_rc, msg_done;
+
+int _opal_queue_msg(enum opal_msg_type msg_type, void *data __unused,
+		    void (*consumed)(void *data) __unused,
+		    size_t num_params, const u64 *params)
+{
+	assert(msg_type == OPAL_MSG_ASYNC_COMP);
+	assert(num_params == 3);
+	nr_msgs++;
+	msg_token = params[0];
+	msg_rc = params[1];
+	msg_done = params[2];
+	return 0;
+}
+
+struct dt_node *dt_root, *dt_chosen, *opal_node;
+struct platform platform;
+unsigned long top_of_ram = ~0ul;
+
+void blocklevel_cache_free(struct blocklevel_device *bl __unused)
+{
+}
+
+void blocklevel_cache_invalidate(struct blocklevel_device *bl __unused)
+{
+}
+
+static struct flash test_flash = {
+	.bl		= &test_bl,
+	.size		= TEST_FLASH_SIZE,
+	.block_size	= TEST_ERASE_SIZE,
+};
+
+/*
+ * Run the timers until the op completes, checking that each call only
+ * does a single bounded step. Returns the number of calls.
+ */
+static unsigned int run_op(void)
+{
+	unsigned int runs = 0, chunks;
+
+	while (!nr_msgs) {
+		chunks = nr_chunks;
+		stamp += msecs_to_tb(FLASH_ASYNC_DELAY_MS) + 1;
+		check_timers(true);
+		assert(nr_chunks - chunks <= 1);
+		runs++;
+		assert(runs < 1000);
+	}
+	return runs;
+}
+
+/* Nothing else must happen to the flash once the op has completed */
+static void check_idle(void)
+{
+	unsigned int i, chunks = nr_chunks, msgs = nr_msgs;
+
+	for (i = 0; i < 100; i++) {
+		stamp += msecs_to_tb(FLASH_ASYNC_RETRY_MS);
+		check_timers(true);
+	}
+	assert(nr_chunks == chunks);
+	assert(nr_msgs == msgs);
+	assert(!test_flash.async.active);
+}
+
+int main(void)
+{
+	unsigned int i;
+
+	init_timer(&test_flash.async.poller, flash_async_poll, &test_flash);
+	list_add(&flashes, &test_flash.list);
+	system_flash = &test_flash;
+
+	for (i = 0; i < TEST_FLASH_SIZE; i++)
+		flash_data[i] = i * 7;
+
+	/* A read is done a chunk per timer run, not all in one go */
+	assert(opal_flash_read(0, 0, (uint64_t)host_buf, TEST_OP_SIZE,
+			       42) == OPAL_ASYNC_COMPLETION);
+	assert(opal_flash_read(0, 0, (uint64_t)host_buf, TEST_OP_SIZE,
+			       43) == OPAL_BUSY);
+	assert(run_op() >= TEST_OP_SIZE / FLASH_ASYNC_CHUNK);
+	assert(nr_chunks == TEST_OP_SIZE / FLASH_ASYNC_CHUNK);
+	assert(last_len == FLASH_ASYNC_CHUNK);
+	assert(nr_msgs == 1 && msg_token == 42);
+	assert(msg_rc == OPAL_SUCCESS && msg_done == TEST_OP_SIZE);
+	assert(!memcmp(host_buf, flash_data, TEST_OP_SIZE));
+	check_idle();
+
+	/* Erases go one erase block at a time */
+	nr_chunks = nr_msgs = 0;
+	assert(opal_flash_erase(0, 0, TEST_OP_SIZE, 42) ==
+	       OPAL_ASYNC_COMPLETION);
+	run_op();
+	assert(nr_chunks == TEST_OP_SIZE / TEST_ERASE_SIZE);
+	assert(last_len == TEST_ERASE_SIZE);
+	assert(msg_rc == OPAL_SUCCESS && msg_done == TEST_OP_SIZE);
+	check_idle();
+
+	/* Cancelling stops at the next chunk */
+	nr_chunks = nr_msgs = 0;
+	memset(host_buf, 0x5a, sizeof(host_buf));
+	assert(opal_flash_write(0, 0, (uint64_t)host_buf, TEST_OP_SIZE,
+				42) == OPAL_ASYNC_COMPLETION);
+	while (nr_chunks < 3) {
+		stamp += msecs_to_tb(FLASH_ASYNC_DELAY_MS) + 1;
+		check_timers(true);
+	}
+	assert(opal_flash_cancel(0, 43) == OPAL_PARAMETER);
+	assert(opal_flash_cancel(0, 42) == OPAL_SUCCESS);
+	run_op();
+	assert(nr_chunks == 3);
+	assert(msg_rc == OPAL_PARTIAL && msg_done == 3 * FLASH_ASYNC_CHUNK);
+	assert(opal_flash_cancel(0, 42) == OPAL_PARAMETER);
+	check_idle();
+
+	/*
+	 * A cancel racing with the last chunk doesn't get a second
+	 * completion, and doesn't release a flash someone else owns by then.
+	 */
+	nr_chunks = nr_msgs = 0;
+	cancel_in_last_chunk = true;
+	assert(opal_flash_write(0, 0, (uint64_t)host_buf, TEST_OP_SIZE,
+				42) == OPAL_ASYNC_COMPLETION);
+	run_op();
+	assert(nr_chunks == TEST_OP_SIZE / FLASH_ASYNC_CHUNK);
+	assert(msg_rc == OPAL_SUCCESS && msg_done == TEST_OP_SIZE);
+	assert(!memcmp(host_buf, flash_data, TEST_OP_SIZE));
+	assert(flash_reserve());
+	check_idle();
+	assert(test_flash.busy);
+	flash_release();
+
+	return 0;
+}
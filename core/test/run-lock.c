@@ -0,0 +1,255 @@
+/* Copyright 2018 IBM Corp.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <skiboot-valgrind.h>
+
+#define __TEST__
+
+/* Don't include this, it's PPC-specific */
+#define __CPU_H
+
+#include <ccan/list/list.h>
+#include <processor.h>
+
+enum cpu_thread_state {
+	cpu_state_no_cpu	= 0,
+	cpu_state_active,
+	cpu_state_os,
+};
+
+struct lock;
+
+struct cpu_thread {
+	uint32_t			pir;
+	enum cpu_thread_state		state;
+	uint32_t			con_suspend;
+	bool				con_need_flush;
+	struct list_head		locks_held;
+	struct lock			*requested_lock;
+};
+
+#define CPUS 4
+
+static struct cpu_thread *fake_cpus;
+static struct cpu_thread *my_fake_cpu;
+static unsigned int cpu_max_pir = CPUS;
+
+static struct cpu_thread *this_cpu(void)
+{
+	return my_fake_cpu;
+}
+
+static struct cpu_thread *find_cpu_by_pir(uint32_t pir)
+{
+	return pir < CPUS ? &fake_cpus[pir] : NULL;
+}
+
+static uint64_t __cmpxchg64(uint64_t *mem, uint64_t old, uint64_t new)
+{
+	return __sync_val_compare_and_swap(mem, old, new);
+}
+
+#define sync()		__sync_synchronize()
+#define lwsync()	__sync_synchronize()
+
+/* The waiter may well share a host cpu with the owner */
+#define smt_lowest()	sched_yield()
+#define smt_medium()
+
+static unsigned long mftb(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+#define mfspr(spr)	(SPR_TFMR_TB_VALID)
+
+unsigned long tb_hz = 1000000000;
+unsigned long top_of_ram = ~0ul;
+
+void backtrace(void);
+
+#include "../lock.c"
+
+void op_display(enum op_severity sev, enum op_module mod, uint16_t code)
+{
+	(void)sev;
+	(void)mod;
+	(void)code;
+}
+
+void backtrace(void)
+{
+}
+
+void disable_fast_reboot(const char *reason)
+{
+	(void)reason;
+}
+
+bool flush_console(void)
+{
+	return true;
+}
+
+#define RUN_NSECS ((RUNNING_ON_VALGRIND) ? 200000000ul : 500000000ul)
+
+struct shared {
+	struct cpu_thread cpus[CPUS];
+	struct lock lock;
+	volatile unsigned long end;
+	uint64_t in_lock;
+	uint64_t total;
+	uint64_t count[CPUS];
+};
+
+static void contend(struct shared *sh, unsigned int cpu)
+{
+	my_fake_cpu = &fake_cpus[cpu];
+	while (!sh->end)
+		sched_yield();
+
+	while (mftb() < sh->end) {
+		lock(&sh->lock);
+		assert(lock_held_by_me(&sh->lock));
+		assert(sh->in_lock++ == 0);
+		sh->total++;
+		sh->count[cpu]++;
+		assert(--sh->in_lock == 0);
+		unlock(&sh->lock);
+	}
+	exit(0);
+}
+
+/* Run CPUS processes hammering one lock, report throughput and fairness */
+static void test_contention(bool fair)
+{
+	struct shared *sh;
+	uint64_t min = ~0ull, max = 0, sum = 0;
+	unsigned int i;
+
+	sh = mmap(NULL, sizeof(*sh), PROT_READ|PROT_WRITE,
+		  MAP_ANONYMOUS|MAP_SHARED, -1, 0);
+	assert(sh != MAP_FAILED);
+	memset(sh, 0, sizeof(*sh));
+	fake_cpus = sh->cpus;
+	for (i = 0; i < CPUS; i++) {
+		fake_cpus[i].pir = i;
+		fake_cpus[i].state = cpu_state_active;
+		list_head_init(&fake_cpus[i].locks_held);
+	}
+	if (fair)
+		init_fair_lock(&sh->lock);
+	else
+		init_lock(&sh->lock);
+
+	fflush(stdout);
+	for (i = 0; i < CPUS; i++)
+		if (!fork())
+			contend(sh, i);
+	sh->end = mftb() + RUN_NSECS;
+
+	for (i = 0; i < CPUS; i++) {
+		int status;
+
+		wait(&status);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	for (i = 0; i < CPUS; i++) {
+		sum += sh->count[i];
+		if (sh->count[i] < min)
+			min = sh->count[i];
+		if (sh->count[i] > max)
+			max = sh->count[i];
+	}
+	assert(sum == sh->total);
+	assert(sh->lock.lock_val == 0);
+	if (fair)
+		assert((sh->lock.tickets >> 32) ==
+		       (sh->lock.tickets & 0xffffffff));
+
+	printf("%s lock: %llu locks/s, min/max per cpu %llu/%llu\n",
+	       fair ? "fair" : "test-and-set",
+	       (unsigned long long)(sum * 1000000000ul / RUN_NSECS),
+	       (unsigned long long)min, (unsigned long long)max);
+
+	munmap(sh, sizeof(*sh));
+}
+
+static void test_fair_basics(void)
+{
+	struct cpu_thread cpus[2];
+	struct lock l = LOCK_UNLOCKED_FAIR;
+
+	memset(cpus, 0, sizeof(cpus));
+	cpus[1].pir = 1;
+	list_head_init(&cpus[0].locks_held);
+	list_head_init(&cpus[1].locks_held);
+	fake_cpus = cpus;
+
+	my_fake_cpu = &cpus[0];
+	assert(try_lock(&l));
+	assert(lock_held_by_me(&l));
+	assert(l.owner);
+
+	my_fake_cpu = &cpus[1];
+	assert(!lock_held_by_me(&l));
+	assert(!try_lock(&l));
+
+	/* Somebody queued behind the owner, try_lock mustn't jump in */
+	__take_ticket(&l);
+	my_fake_cpu = &cpus[0];
+	unlock(&l);
+	assert(!l.lock_val);
+	my_fake_cpu = &cpus[1];
+	assert(!try_lock(&l));
+	__serve_next_ticket(&l);
+
+	assert(lock_recursive(&l));
+	assert(!lock_recursive(&l));
+	assert(lock_held_by_me(&l));
+	unlock(&l);
+	assert(list_empty(&cpus[1].locks_held));
+	assert((l.tickets >> 32) == (l.tickets & 0xffffffff));
+}
+
+int main(void)
+{
+	init_locks();
+
+	test_fair_basics();
+	test_contention(false);
+	test_contention(true);
+
+	return 0;
+}
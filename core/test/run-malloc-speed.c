@@ -22,7 +22,13 @@
 static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
+	struct slab_magazines		*slab_mags;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 
@@ -51,6 +57,7 @@ static inline void real_free(void *p)
 
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
 
 char __rodata_start[1], __rodata_end[1];
 struct dt_node *dt_root;
@@ -78,6 +85,63 @@ bool lock_held_by_me(struct lock *l)
 
 #define NUM_ALLOCS 4096
 
+static uint64_t cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define FRAG_ALLOCS	10000
+#define SMALL_BATCH	32
+
+/*
+ * Fragment a fresh heap, then time batches of the small allocations
+ * skiboot does all the time (cpu_job, ipmi_msg, opal_msg entries,
+ * dt_property...). List debugging makes every heap free list update
+ * walk the list, so the heap only case gets far fewer iterations.
+ */
+static double small_allocs(bool slabs)
+{
+	static const size_t sizes[] = { 40, 56, 96, 112, 152, 24, 64, 200 };
+	void **frag = real_malloc(sizeof(void *) * FRAG_ALLOCS);
+	void *p[SMALL_BATCH];
+	uint64_t start, end;
+	unsigned int i, j, loops = slabs ? 20000 : 100;
+
+	assert(frag);
+	memset(&skiboot_heap.free_list, 0, sizeof(skiboot_heap.free_list));
+	slab_enabled = false;
+	if (slabs)
+		malloc_slab_init();
+
+	for (i = 0; i < FRAG_ALLOCS; i++) {
+		frag[i] = __malloc(16 + (i * 37) % 1000, __location__);
+		assert(frag[i]);
+	}
+	for (i = 0; i < FRAG_ALLOCS; i += 2)
+		__free(frag[i], __location__);
+
+	start = cpu_ns();
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < SMALL_BATCH; j++) {
+			p[j] = __malloc(sizes[j % 8], __location__);
+			assert(p[j]);
+		}
+		for (j = 0; j < SMALL_BATCH; j++)
+			__free(p[j], __location__);
+	}
+	end = cpu_ns();
+
+	for (i = 1; i < FRAG_ALLOCS; i += 2)
+		__free(frag[i], __location__);
+	assert(mem_check(&skiboot_heap));
+	real_free(frag);
+
+	return (double)(end - start) / (loops * SMALL_BATCH);
+}
+
 int main(void)
 {
 	uint64_t i, len;
@@ -97,6 +161,13 @@ int main(void)
 	}
 	assert(mem_check(&skiboot_heap));
 	assert(skiboot_heap.free_list_lock.lock_val == 0);
+
+	printf("small allocs, heap only: %.1f ns/alloc+free\n",
+	       small_allocs(false));
+	printf("small allocs, slabs: %.1f ns/alloc+free\n",
+	       small_allocs(true));
+	assert(skiboot_heap.free_list_lock.lock_val == 0);
+
 	free(region_start(&skiboot_heap));
 	real_free(p);
 	return 0;
@@ -23,7 +23,13 @@
 static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
+	struct slab_magazines		*slab_mags;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 
@@ -81,6 +87,85 @@ static bool heap_empty(void)
 	return h->num_longs == skiboot_heap.len / sizeof(long);
 }
 
+#define SLAB_TEST_HEAP_SIZE (8ULL << 20)
+
+static void test_slabs(void)
+{
+	char *test_heap = real_malloc(SLAB_TEST_HEAP_SIZE);
+	static char *objs[512];
+	char *p, *p2, *big;
+	size_t i;
+
+	skiboot_heap.start = (unsigned long)test_heap;
+	skiboot_heap.len = SLAB_TEST_HEAP_SIZE;
+	memset(&skiboot_heap.free_list, 0, sizeof(skiboot_heap.free_list));
+	malloc_slab_init();
+	assert(slab_enabled);
+
+	/* Small allocations come from slabs, with their location */
+	p = malloc(100);
+	assert(p);
+	assert(slab_owns(p));
+	assert(slab_obj(p)->state == SLAB_ALLOCATED);
+	assert(strstr(slab_obj(p)->location, "run-malloc.c"));
+	memset(p, 'a', 100);
+
+	/* Big ones and anything aligned still go to the heap */
+	big = malloc(SLAB_MAX_SIZE + 1);
+	assert(big);
+	assert(!slab_owns(big));
+	p2 = memalign(64, 32);
+	assert(p2);
+	assert(!slab_owns(p2));
+	free(p2);
+
+	/* Realloc within the size class stays put, beyond it moves */
+	p2 = realloc(p, 128);
+	assert(p2 == p);
+	p2 = realloc(p, 129);
+	assert(p2 != p);
+	assert(slab_owns(p2));
+	for (i = 0; i < 100; i++)
+		assert(p2[i] == 'a');
+	assert(slab_obj(p)->state == SLAB_FREE);
+	p = realloc(p2, SLAB_MAX_SIZE * 2);
+	assert(p);
+	assert(!slab_owns(p));
+	assert(p[99] == 'a');
+	free(p);
+
+	/* Freed objects are reused, and zalloc still zeroes them */
+	p = malloc(24);
+	memset(p, 'b', 24);
+	free(p);
+	p2 = zalloc(24);
+	assert(p2 == p);
+	for (i = 0; i < 24; i++)
+		assert(p2[i] == 0);
+	free(p2);
+
+	/* Enough of every class to overflow magazines and grow pages */
+	for (i = 0; i < 512; i++) {
+		objs[i] = malloc(1 + (i * 97) % SLAB_MAX_SIZE);
+		assert(objs[i]);
+		assert(slab_owns(objs[i]));
+		memset(objs[i], i, 1 + (i * 97) % SLAB_MAX_SIZE);
+	}
+	for (i = 0; i < 512; i++) {
+		assert(objs[i][0] == (char)i);
+		free(objs[i]);
+	}
+	for (i = 0; i < SLAB_CLASSES; i++)
+		assert(slab_classes[i].pages);
+
+	free(big);
+	assert(mem_check(&skiboot_heap));
+	assert(!skiboot_heap.free_list_lock.lock_val);
+
+	slab_enabled = false;
+	real_free(test_heap);
+}
+
 int main(void)
 {
 	char *test_heap = real_malloc(TEST_HEAP_SIZE);
@@ -185,5 +270,7 @@ int main(void)
 	assert(!skiboot_heap.free_list_lock.lock_val);
 
 	real_free(test_heap);
+
+	test_slabs();
 	return 0;
 }
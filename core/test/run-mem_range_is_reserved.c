@@ -22,7 +22,13 @@
 static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
+	struct slab_magazines		*slab_mags;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 
@@ -75,7 +81,7 @@ bool lock_held_by_me(struct lock *l)
 	return l->lock_val;
 }
 
-#define TEST_HEAP_ORDER 14
+#define TEST_HEAP_ORDER 16
 #define TEST_HEAP_SIZE (1ULL << TEST_HEAP_ORDER)
 
 static void add_mem_node(uint64_t start, uint64_t len)
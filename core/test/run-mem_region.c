@@ -22,7 +22,13 @@
 static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
+	struct slab_magazines		*slab_mags;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 #include <string.h>
@@ -73,7 +79,7 @@ bool lock_held_by_me(struct lock *l)
 	return l->lock_val;
 }
 
-#define TEST_HEAP_ORDER 12
+#define TEST_HEAP_ORDER 14
 #define TEST_HEAP_SIZE (1ULL << TEST_HEAP_ORDER)
 
 static bool heap_empty(void)
@@ -166,6 +172,30 @@ int main(void)
 	assert(mem_check(&skiboot_heap));
 	assert(heap_empty());
 
+	/* Random sizes and alignments, exercising every free list. */
+	memset(ptrs, 0, sizeof(ptrs));
+	srandom(1);
+	for (i = 0; i < 5000; i++) {
+		size_t n = random() % 100;
+
+		if (ptrs[n]) {
+			mem_free(&skiboot_heap, ptrs[n], "random free");
+			ptrs[n] = NULL;
+		} else {
+			size_t align = 1ULL << (random() % 8);
+
+			ptrs[n] = mem_alloc(&skiboot_heap, 1 + random() % 256,
+					    align, "random");
+			assert(!ptrs[n] || (long)ptrs[n] % align == 0);
+		}
+		assert(mem_check(&skiboot_heap));
+	}
+	for (i = 0; i < 100; i++)
+		if (ptrs[i])
+			mem_free(&skiboot_heap, ptrs[i], "freed");
+	assert(mem_check(&skiboot_heap));
+	assert(heap_empty());
+
 #if 0
 	printf("Heap map:\n");
 	for (i = 0; i < TEST_HEAP_SIZE / sizeof(long); i++) {
@@ -237,7 +267,7 @@ int main(void)
 			assert(r->len == TEST_HEAP_SIZE/2);
 			assert(strcmp(r->name, "splitter") == 0);
 			assert(r->type == REGION_RESERVED);
-			assert(!r->free_list.n.next);
+			assert(!r->free_list[0].n.next);
 		} else if (region_start(r) == test_heap + TEST_HEAP_SIZE/4*3) {
 			assert(r->len == TEST_HEAP_SIZE/4);
 			assert(strcmp(r->name, "base") == 0);
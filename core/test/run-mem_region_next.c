@@ -22,7 +22,13 @@
 static unsigned int cpu_max_pir = 1;
 struct cpu_thread {
 	unsigned int			chip_id;
+	struct slab_magazines		*slab_mags;
 };
+static struct cpu_thread fake_cpu;
+static inline struct cpu_thread *this_cpu(void)
+{
+	return &fake_cpu;
+}
 
 #include <stdlib.h>
 #include <string.h>
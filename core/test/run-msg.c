@@ -20,6 +20,9 @@
 #include <errno.h>
 #include <stdlib.h>
 
+#define __TEST__
+#define lwsync()	__sync_synchronize()
+
 static bool zalloc_should_fail = false;
 static int zalloc_should_fail_after = 0;
 
@@ -54,10 +57,23 @@ void unlock(struct lock *l)
         l->lock_val = 0;
 }
 
+static uint64_t pending_evts;
+static int evt_sets;
+
 void opal_update_pending_evt(uint64_t evt_mask, uint64_t evt_values)
 {
-        (void)evt_mask;
-        (void)evt_values;
+        if (evt_values & ~pending_evts)
+                evt_sets++;
+        pending_evts = (pending_evts & ~evt_mask) | evt_values;
+}
+
+void __opal_add_poller(void (*poller)(void *data), void *data,
+                       unsigned int unused, const char *name)
+{
+        (void)unused;
+        (void)name;
+        assert(poller == opal_msg_ring_poll);
+        assert(!data);
 }
 
 static long magic = 8097883813087437089UL;
@@ -66,6 +82,13 @@ static void callback(void *data)
         assert(*(uint64_t *)data == magic);
 }
 
+static int consumed_count;
+static void count_callback(void *data)
+{
+        (void)data;
+        consumed_count++;
+}
+
 static size_t list_count(struct list_head *list)
 {
         size_t count = 0;
@@ -76,6 +99,168 @@ static size_t list_count(struct list_head *list)
         return count;
 }
 
+/* Take one message off the ring the way a host would */
+static bool ring_get(struct opal_msg_ring *ring, struct opal_msg *m)
+{
+        uint64_t tail = be64_to_cpu(ring->tail);
+        uint32_t nr = be32_to_cpu(ring->nr_msgs);
+
+        if (tail == be64_to_cpu(ring->head))
+                return false;
+        *m = ring->msgs[tail & (nr - 1)];
+        ring->tail = cpu_to_be64(tail + 1);
+        return true;
+}
+
+static void test_msg_ring(void)
+{
+        /* Room for 5 messages, OPAL should only use 4 */
+        size_t size = sizeof(struct opal_msg_ring) + 5 * sizeof(struct opal_msg);
+        struct opal_msg_ring *ring = calloc(1, size);
+        static struct opal_msg msgs[2];
+        struct opal_msg m;
+        int i, r, sets;
+
+        assert(ring);
+        assert(list_empty(&msg_pending_list));
+        zalloc_should_fail = false;
+
+        r = opal_register_msg_ring((uint64_t)ring + 4, size);
+        assert(r == OPAL_PARAMETER);
+        r = opal_register_msg_ring((uint64_t)ring,
+                sizeof(struct opal_msg_ring) + sizeof(struct opal_msg));
+        assert(r == OPAL_PARAMETER);
+        r = opal_register_msg_ring((uint64_t)ring, size);
+        assert(r == OPAL_SUCCESS);
+        assert(be32_to_cpu(ring->nr_msgs) == 4);
+
+        /* Going non-empty raises the event once */
+        consumed_count = 0;
+        pending_evts = 0;
+        sets = evt_sets;
+        for (i = 0; i < 3; i++) {
+                r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, count_callback,
+                                   (u64)i);
+                assert(r == 0);
+        }
+        assert(evt_sets == sets + 1);
+        assert(pending_evts == OPAL_EVENT_MSG_PENDING);
+        assert(be64_to_cpu(ring->head) == 3);
+        assert(list_empty(&msg_pending_list));
+
+        for (i = 0; i < 2; i++) {
+                assert(ring_get(ring, &m));
+                assert(m.params[0] == i);
+        }
+        opal_msg_ring_poll(NULL);
+        assert(consumed_count == 2);
+        assert(pending_evts == OPAL_EVENT_MSG_PENDING);
+
+        /* Wrap around and fill it, then overflow to the pending list */
+        for (i = 3; i < 8; i++) {
+                r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, count_callback,
+                                   (u64)i);
+                assert(r == 0);
+        }
+        assert(be64_to_cpu(ring->head) == 6);
+        assert(be64_to_cpu(ring->overflows) == 2);
+        assert(list_count(&msg_pending_list) == 2);
+
+        for (i = 2; i < 6; i++) {
+                assert(ring_get(ring, &m));
+                assert(m.params[0] == i);
+        }
+        assert(!ring_get(ring, &m));
+
+        /* Still more to come from OPAL_GET_MSGS */
+        opal_msg_ring_poll(NULL);
+        assert(consumed_count == 6);
+        assert(pending_evts == OPAL_EVENT_MSG_PENDING);
+
+        r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs));
+        assert(r == 2);
+        assert(msgs[0].params[0] == 6);
+        assert(msgs[1].params[0] == 7);
+        assert(consumed_count == 8);
+        opal_msg_ring_poll(NULL);
+        assert(pending_evts == 0);
+
+        /* Back on the ring, and the event fires again */
+        sets = evt_sets;
+        for (i = 8; i < 13; i++) {
+                r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, count_callback,
+                                   (u64)i);
+                assert(r == 0);
+        }
+        assert(evt_sets == sets + 1);
+        assert(list_count(&msg_pending_list) == 1);
+
+        /* Emptying the list mustn't drop the event while the ring isn't */
+        r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs));
+        assert(r == 1);
+        assert(msgs[0].params[0] == 12);
+        assert(consumed_count == 9);
+        assert(pending_evts == OPAL_EVENT_MSG_PENDING);
+        for (i = 8; i < 12; i++) {
+                assert(ring_get(ring, &m));
+                assert(m.params[0] == i);
+        }
+        opal_msg_ring_poll(NULL);
+        assert(consumed_count == 13);
+        assert(pending_evts == 0);
+
+        sets = evt_sets;
+        r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, count_callback, (u64)13);
+        assert(r == 0);
+        assert(evt_sets == sets + 1);
+        assert(list_empty(&msg_pending_list));
+
+        /* Can't unregister with messages in flight */
+        r = opal_register_msg_ring(0, 0);
+        assert(r == OPAL_BUSY);
+        assert(ring_get(ring, &m));
+        assert(m.params[0] == 13);
+        r = opal_register_msg_ring(0, 0);
+        assert(r == OPAL_SUCCESS);
+        assert(consumed_count == 14);
+
+        /* And we're back to the pending list */
+        r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, count_callback, (u64)14);
+        assert(r == 0);
+        assert(list_count(&msg_pending_list) == 1);
+        r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs));
+        assert(r == 1);
+        assert(consumed_count == 15);
+
+        /* Booting an OS drops the ring the previous one left registered */
+        r = opal_register_msg_ring((uint64_t)ring, size);
+        assert(r == OPAL_SUCCESS);
+        for (i = 15; i < 17; i++) {
+                r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, count_callback,
+                                   (u64)i);
+                assert(r == 0);
+        }
+        assert(ring_get(ring, &m));
+        assert(pending_evts == OPAL_EVENT_MSG_PENDING);
+        opal_drop_msg_ring();
+        assert(consumed_count == 17);
+        assert(pending_evts == 0);
+        opal_drop_msg_ring();
+        assert(consumed_count == 17);
+
+        /* Nothing touches the old ring after that */
+        r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, count_callback, (u64)17);
+        assert(r == 0);
+        assert(be64_to_cpu(ring->head) == 2);
+        assert(list_count(&msg_pending_list) == 1);
+        r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs));
+        assert(r == 1);
+        assert(msgs[0].params[0] == 17);
+        assert(consumed_count == 18);
+
+        free(ring);
+}
+
 int main(void)
 {
         struct opal_msg_entry* entry;
@@ -86,8 +271,8 @@ int main(void)
         static struct opal_msg m;
         uint64_t *m_ptr = (uint64_t *)&m;
 
+	/* The pool is static, initialising it can't fail */
 	zalloc_should_fail = true;
-	zalloc_should_fail_after = 3;
 	opal_init_msg();
 
 	zalloc_should_fail = false;
@@ -197,17 +382,16 @@ int main(void)
         assert(list_count(&msg_pending_list) == npending);
         assert(list_count(&msg_free_list) == nfree);
 
-        /* Empty list (no nodes). */
+        /* Empty list (no nodes), the allocated entry isn't kept. */
         while(!list_empty(&msg_pending_list)) {
                 r = opal_get_msg(m_ptr, sizeof(m));
                 assert(r == 0);
                 npending--;
-                nfree++;
         }
+        nfree = OPAL_MAX_MSGS;
         assert(list_count(&msg_pending_list) == npending);
         assert(list_count(&msg_free_list) == nfree);
         assert(npending == 0);
-        assert(nfree == OPAL_MAX_MSGS+1);
 
         r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL, NULL);
         assert(r == 0);
@@ -256,18 +440,47 @@ int main(void)
         test_queue_num(u8, -1);
         test_queue_num(s8, -1);
 
-        /* Clean up the list to keep valgrind happy. */
-        while(!list_empty(&msg_free_list)) {
-                entry = list_pop(&msg_free_list, struct opal_msg_entry, link);
-                assert(entry);
-                free(entry);
+        /* Batched: drain several messages per call, in order. */
+        {
+                static struct opal_msg msgs[3];
+                int i;
+
+                consumed_count = 0;
+                for (i = 0; i < 5; i++) {
+                        r = opal_queue_msg(OPAL_MSG_ASYNC_COMP, NULL,
+                                           count_callback, (u64)i);
+                        assert(r == 0);
+                }
+                assert(list_count(&msg_pending_list) == 5);
+
+                r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs));
+                assert(r == 3);
+                assert(consumed_count == 3);
+                for (i = 0; i < 3; i++)
+                        assert(msgs[i].params[0] == i);
+
+                /* A buffer that isn't a multiple of a message */
+                r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs) - 1);
+                assert(r == 2);
+                assert(consumed_count == 5);
+                assert(msgs[0].params[0] == 3);
+                assert(msgs[1].params[0] == 4);
+
+                r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs));
+                assert(r == OPAL_RESOURCE);
+                r = opal_get_msgs((uint64_t *)msgs, sizeof(msgs[0]) - 1);
+                assert(r == OPAL_PARAMETER);
+                r = opal_get_msgs(NULL, sizeof(msgs));
+                assert(r == OPAL_PARAMETER);
         }
 
-        while(!list_empty(&msg_pending_list)) {
-                entry = list_pop(&msg_pending_list, struct opal_msg_entry, link);
-                assert(entry);
-                free(entry);
-        }
+        test_msg_ring();
+
+        /* Everything is back in the pool, nothing to free. */
+        assert(list_empty(&msg_pending_list));
+        assert(list_count(&msg_free_list) == OPAL_MAX_MSGS);
+        list_for_each(&msg_free_list, entry, link)
+                assert(entry->pooled);
 
         return 0;
 }
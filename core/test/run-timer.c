@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 #define __TEST__
 #include <timer.h>
@@ -13,7 +14,7 @@
 
 enum proc_gen proc_gen = proc_gen_p9;
 
-static uint64_t stamp, last;
+static uint64_t stamp, last, sbe_target;
 struct lock;
 static inline void lock_caller(struct lock *l, const char *caller)
 {
@@ -58,7 +59,172 @@ void p8_sbe_update_timer_expiry(uint64_t new_target)
 
 void p9_sbe_update_timer_expiry(uint64_t new_target)
 {
-	(void)new_target;
+	sbe_target = new_target;
+}
+
+#define STRESS_TIMERS	1000
+#define STRESS_OPS	200000
+
+static struct timer stress_timers[STRESS_TIMERS];
+static bool stress_pending[STRESS_TIMERS];
+static unsigned int stress_fired;
+
+/* Anything from "already expired" to well past the top of the wheel */
+static uint64_t stress_delay(void)
+{
+	switch (random() % 8) {
+	case 0:
+		return 0;
+	case 1:
+		return random() % (1ull << TIMER_WHEEL_SHIFT);
+	case 2:
+	case 3:
+		return random() % (1ull << (TIMER_WHEEL_SHIFT +
+					     TIMER_WHEEL0_BITS + 2));
+	case 4:
+	case 5:
+		return random() % (1ull << (TIMER_WHEEL_SHIFT +
+					     TIMER_WHEEL0_BITS + 8));
+	case 6:
+		return (uint64_t)random() << 12;
+	default:
+		return (uint64_t)random() << 24;
+	}
+}
+
+static void stress_expiry(struct timer *t, void *data, uint64_t now)
+{
+	unsigned int i = t - stress_timers;
+
+	(void)data;
+	assert(stress_pending[i]);
+	assert(t->target <= now);
+	assert(t->running);
+	stress_pending[i] = false;
+	stress_fired++;
+
+	/* Some re-arm themselves, sometimes already expired */
+	if (!(random() % 4)) {
+		schedule_timer(t, stress_delay());
+		stress_pending[i] = true;
+	}
+}
+
+static void stress_check(void)
+{
+	unsigned int i, pending = 0;
+
+	for (i = 0; i < STRESS_TIMERS; i++) {
+		if (!stress_pending[i])
+			continue;
+		pending++;
+		/* Nothing expired may be left behind ... */
+		assert(stress_timers[i].target > stamp);
+		/* ... and the SBE mustn't be programmed past anything */
+		assert(sbe_target <= stress_timers[i].target);
+	}
+	assert(pending == timer_count);
+}
+
+static void test_stress(void)
+{
+	struct timer *t;
+	unsigned int i, op;
+
+	srandom(1);
+	for (i = 0; i < STRESS_TIMERS; i++)
+		init_timer(&stress_timers[i], stress_expiry, NULL);
+
+	for (op = 0; op < STRESS_OPS; op++) {
+		i = random() % STRESS_TIMERS;
+		t = &stress_timers[i];
+
+		switch (random() % 8) {
+		case 0:
+			cancel_timer(t);
+			stress_pending[i] = false;
+			break;
+		case 1:
+			cancel_timer_async(t);
+			stress_pending[i] = false;
+			break;
+		case 2:
+		case 3:
+		case 4:
+			schedule_timer(t, stress_delay());
+			stress_pending[i] = true;
+			break;
+		default:
+			/* Sometimes leap a long way ahead */
+			if (random() % 64)
+				stamp += random() % (1ull << TIMER_WHEEL_SHIFT);
+			else
+				stamp += stress_delay();
+			check_timers(false);
+			stress_check();
+		}
+	}
+
+	/* Drain whatever is left, some of it re-arms as we go */
+	while (timer_count) {
+		for (i = 0; i < STRESS_TIMERS; i++)
+			if (stress_pending[i] && stress_timers[i].target > stamp)
+				stamp = stress_timers[i].target;
+		check_timers(false);
+		stress_check();
+	}
+	for (i = 0; i < STRESS_TIMERS; i++)
+		assert(!stress_pending[i]);
+	printf("stress: %u timers fired\n", stress_fired);
+}
+
+static uint64_t cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void nop_expiry(struct timer *t, void *data, uint64_t now)
+{
+	(void)t;
+	(void)data;
+	(void)now;
+}
+
+/*
+ * Re-arm one timer over and over with a backlog of others pending, the
+ * cost shouldn't depend on the backlog. Note that list debugging is on
+ * in tests, which walks the destination bucket on every insert.
+ */
+static void test_speed(unsigned int backlog)
+{
+	static struct timer bench[1000];
+	struct timer t;
+	uint64_t start, end;
+	unsigned int i, loops = 200000;
+
+	assert(backlog <= 1000);
+	srandom(3);
+	for (i = 0; i < backlog; i++) {
+		init_timer(&bench[i], nop_expiry, NULL);
+		schedule_timer(&bench[i], random() % (1ul << 30));
+	}
+	init_timer(&t, nop_expiry, NULL);
+
+	start = cpu_ns();
+	for (i = 0; i < loops; i++)
+		schedule_timer(&t, random() % (1ul << 20));
+	cancel_timer(&t);
+	end = cpu_ns();
+
+	printf("%u pending: %.1f ns/schedule\n", backlog,
+	       (double)(end - start) / loops);
+
+	for (i = 0; i < backlog; i++)
+		cancel_timer(&bench[i]);
+	assert(!timer_count);
 }
 
 int main(void)
@@ -75,5 +241,11 @@ int main(void)
 		check_timers(false);
 		stamp++;
 	}
+
+	test_stress();
+
+	test_speed(0);
+	test_speed(100);
+	test_speed(1000);
 	return 0;
 }
@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 
 #include <skiboot-valgrind.h>
 
@@ -64,6 +65,7 @@ static struct cpu_thread *this_cpu(void);
 #define CPUS 4
 
 static struct cpu_thread fake_cpus[CPUS];
+static unsigned int cpu_thread_count = 2;
 
 static inline struct cpu_thread *next_cpu(struct cpu_thread *cpu)
 {
@@ -262,15 +264,94 @@ static void test_parallel(void)
 	 */
 }
 
+#define SPEED_TRACES ((RUNNING_ON_VALGRIND) ? (1024*16) : (1024*1024*4))
+
+/* CPU time, so an oversubscribed host doesn't skew the numbers */
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void speed_trace_entries(void)
+{
+	union trace trace;
+	unsigned int i;
+
+	memset(&trace, 0, sizeof(trace));
+	for (i = 0; i < SPEED_TRACES; i++) {
+		timestamp = i;
+		/* Alternate types so nothing is folded into a repeat */
+		trace_add(&trace, 3 + (i & 1), sizeof(trace.opal));
+	}
+}
+
+/* Time ncpus writers running in parallel, returns mean ns per record */
+static double test_speed(unsigned int ncpus, bool shared)
+{
+	void *p;
+	uint64_t *ns;
+	double total = 0;
+	unsigned int i;
+	size_t len = sizeof(struct trace_info) + TBUF_SZ + sizeof(union trace);
+
+	i = (CPUS*len + sizeof(uint64_t)*CPUS + getpagesize()-1)
+		& ~(getpagesize()-1);
+	p = mmap(NULL, i, PROT_READ|PROT_WRITE,
+		 MAP_ANONYMOUS|MAP_SHARED, -1, 0);
+	assert(p != MAP_FAILED);
+	ns = p + CPUS * len;
+
+	for (i = 0; i < ncpus; i++) {
+		fake_cpus[i].trace = p + i * len;
+		fake_cpus[i].trace->tb.mask = cpu_to_be64(TBUF_SZ - 1);
+		fake_cpus[i].trace->tb.max_size = cpu_to_be32(sizeof(union trace));
+		fake_cpus[i].trace->shared = shared;
+	}
+
+	fflush(stdout);
+	for (i = 0; i < ncpus; i++) {
+		if (!fork()) {
+			uint64_t start;
+
+			my_fake_cpu = &fake_cpus[i];
+			start = time_ns();
+			speed_trace_entries();
+			ns[i] = time_ns() - start;
+			exit(0);
+		}
+	}
+
+	for (i = 0; i < ncpus; i++) {
+		int status;
+		wait(&status);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	for (i = 0; i < ncpus; i++) {
+		assert(be64_to_cpu(fake_cpus[i].trace->tb.end) ==
+		       (uint64_t)SPEED_TRACES * sizeof(struct trace_opal));
+		total += (double)ns[i] / SPEED_TRACES;
+	}
+
+	munmap(p, (CPUS*len + sizeof(uint64_t)*CPUS + getpagesize()-1)
+	       & ~(getpagesize()-1));
+	return total / ncpus;
+}
+
 int main(void)
 {
 	union trace minimal;
 	union trace large;
 	union trace trace;
-	unsigned int i, j;
+	unsigned int i, j, missed;
+	uint64_t tbsz;
 
 	opal_node = dt_new_root("opal");
 	for (i = 0; i < CPUS; i++) {
+		fake_cpus[i].pir = i;
 		fake_cpus[i].server_no = i;
 		fake_cpus[i].is_secondary = (i & 0x1);
 		fake_cpus[i].primary = &fake_cpus[i & ~0x1];
@@ -278,7 +359,11 @@ int main(void)
 	init_trace_buffers();
 	my_fake_cpu = &fake_cpus[0];
 
+	/* Every thread has its own buffer, nobody needs the lock */
 	for (i = 0; i < CPUS; i++) {
+		for (j = 0; j < i; j++)
+			assert(fake_cpus[i].trace != fake_cpus[j].trace);
+		assert(!fake_cpus[i].trace->shared);
 		assert(trace_empty(&fake_cpus[i].trace->tb));
 		assert(!trace_get(&trace, &fake_cpus[i].trace->tb));
 	}
@@ -291,7 +376,8 @@ int main(void)
 	assert(be64_to_cpu(trace.hdr.timestamp) == timestamp);
 
 	/* Make it wrap once. */
-	for (i = 0; i < TBUF_SZ / (minimal.hdr.len_div_8 * 8) + 1; i++) {
+	tbsz = be64_to_cpu(my_fake_cpu->trace->tb.mask) + 1;
+	for (i = 0; i < tbsz / (minimal.hdr.len_div_8 * 8) + 1; i++) {
 		timestamp = i;
 		trace_add(&minimal, 99 + (i%2), sizeof(trace.hdr));
 	}
@@ -300,13 +386,18 @@ int main(void)
 	/* First one must be overflow marker. */
 	assert(trace.hdr.type == TRACE_OVERFLOW);
 	assert(trace.hdr.len_div_8 * 8 == sizeof(trace.overflow));
-	assert(be64_to_cpu(trace.overflow.bytes_missed) == minimal.hdr.len_div_8 * 8);
 
-	for (i = 0; i < TBUF_SZ / (minimal.hdr.len_div_8 * 8); i++) {
+	/* Eviction is done up to the next TBUF_SKIP_SZ boundary */
+	missed = be64_to_cpu(trace.overflow.bytes_missed);
+	assert(missed % (minimal.hdr.len_div_8 * 8) == 0);
+	assert(missed > 0 && missed <= TBUF_SKIP_SZ);
+	missed /= minimal.hdr.len_div_8 * 8;
+
+	for (i = missed; i <= tbsz / (minimal.hdr.len_div_8 * 8); i++) {
 		assert(trace_get(&trace, &my_fake_cpu->trace->tb));
 		assert(trace.hdr.len_div_8 == minimal.hdr.len_div_8);
-		assert(be64_to_cpu(trace.hdr.timestamp) == i+1);
-		assert(trace.hdr.type == 99 + ((i+1)%2));
+		assert(be64_to_cpu(trace.hdr.timestamp) == i);
+		assert(trace.hdr.type == 99 + (i%2));
 	}
 	assert(!trace_get(&trace, &my_fake_cpu->trace->tb));
 
@@ -394,5 +485,10 @@ int main(void)
 
 	test_parallel();
 
+	printf("1 cpu, locked: %.1f ns/record\n", test_speed(1, true));
+	for (i = 1; i <= CPUS; i *= 2)
+		printf("%u cpus, lock-free: %.1f ns/record\n", i,
+		       test_speed(i, false));
+
 	return 0;
 }
@@ -61,3 +61,30 @@ STUB(dt_next);
 STUB(dt_has_node_property);
 STUB(dt_get_address);
 STUB(add_chip_dev_associativity);
+STUB(blocklevel_cache_init);
+STUB(blocklevel_get_info);
+STUB(blocklevel_read);
+STUB(blocklevel_write);
+STUB(ffs_close);
+STUB(ffs_init);
+STUB(ffs_lookup_part);
+STUB(ffs_part_info);
+STUB(flash_subpart_info);
+STUB(nvram_read_complete);
+STUB(secureboot_verify);
+STUB(trustedboot_measure);
+STUB(stb_is_container);
+STUB(stb_sw_payload_size);
+STUB(start_preload_resource);
+STUB(wait_for_resource_loaded);
+STUB(cpu_queue_job);
+STUB(cpu_wait_job);
+STUB(cpu_process_local_jobs);
+STUB(dt_new);
+STUB(dt_new_addr);
+STUB(dt_add_property);
+STUB(dt_add_property_string);
+STUB(__dt_add_property_cells);
+STUB(__dt_add_property_strings);
+STUB(dt_find_property);
+STUB(dt_get_path);
@@ -17,8 +17,36 @@
 /* Heartbeat requested from Linux */
 #define HEARTBEAT_DEFAULT_MS	200
 
+/*
+ * Real timers live in a hierarchical timer wheel, so inserting and
+ * cancelling them is O(1) regardless of how many are pending.
+ *
+ * Time is counted in "slots" of (1 << TIMER_WHEEL_SHIFT) timebase ticks,
+ * about 32us at 512MHz. The level 0 wheel has one bucket per slot for
+ * the next TIMER_WHEEL0_SIZE slots. Each of the upper levels covers
+ * TIMER_WHEELN_SIZE times the range of the one below it, with coarser
+ * buckets that get redistributed ("cascaded") into the lower levels as
+ * time catches up with them. Anything further out than the top level
+ * can represent is parked in its last bucket and re-filed when that
+ * bucket cascades. Timers keep their exact target, the wheel only
+ * decides when we look at them.
+ */
+#define TIMER_WHEEL_SHIFT	14
+#define TIMER_WHEEL0_BITS	8
+#define TIMER_WHEEL0_SIZE	(1 << TIMER_WHEEL0_BITS)
+#define TIMER_WHEEL0_MASK	(TIMER_WHEEL0_SIZE - 1)
+#define TIMER_WHEELN_BITS	6
+#define TIMER_WHEELN_SIZE	(1 << TIMER_WHEELN_BITS)
+#define TIMER_WHEELN_MASK	(TIMER_WHEELN_SIZE - 1)
+#define TIMER_WHEELN_LEVELS	3
+
 static struct lock timer_lock = LOCK_UNLOCKED;
-static LIST_HEAD(timer_list);
+static struct list_head timer_wheel0[TIMER_WHEEL0_SIZE];
+static struct list_head timer_wheeln[TIMER_WHEELN_LEVELS][TIMER_WHEELN_SIZE];
+static bool timer_wheel_ready;
+static uint64_t timer_clk;	/* Next slot to be processed */
+static uint64_t timer_next;	/* Earliest target the SBE knows about */
+static unsigned int timer_count;	/* Real timers on the wheel */
 static LIST_HEAD(timer_poll_list);
 static bool timer_in_poll;
 static uint64_t timer_poll_gen;
@@ -40,10 +68,164 @@ void init_timer(struct timer *t, timer_func_t expiry, void *data)
 	t->running = NULL;
 }
 
+static void __timer_wheel_init(void)
+{
+	unsigned int i, lvl;
+
+	if (timer_wheel_ready)
+		return;
+	for (i = 0; i < TIMER_WHEEL0_SIZE; i++)
+		list_head_init(&timer_wheel0[i]);
+	for (lvl = 0; lvl < TIMER_WHEELN_LEVELS; lvl++)
+		for (i = 0; i < TIMER_WHEELN_SIZE; i++)
+			list_head_init(&timer_wheeln[lvl][i]);
+	timer_clk = mftb() >> TIMER_WHEEL_SHIFT;
+	timer_next = TIMER_POLL;
+	timer_wheel_ready = true;
+}
+
+static void __timer_wheel_add(struct timer *t)
+{
+	uint64_t slot = t->target >> TIMER_WHEEL_SHIFT;
+	uint64_t delta, range;
+	unsigned int lvl, shift;
+
+	/* Already expired timers go in the next slot we look at */
+	if (slot < timer_clk)
+		slot = timer_clk;
+	delta = slot - timer_clk;
+
+	if (delta < TIMER_WHEEL0_SIZE) {
+		list_add_tail(&timer_wheel0[slot & TIMER_WHEEL0_MASK],
+			      &t->link);
+		return;
+	}
+
+	for (lvl = 0; ; lvl++) {
+		shift = TIMER_WHEEL0_BITS + lvl * TIMER_WHEELN_BITS;
+		range = 1ull << (shift + TIMER_WHEELN_BITS);
+		if (delta < range)
+			break;
+		if (lvl == TIMER_WHEELN_LEVELS - 1) {
+			/* Too far out, park it in the last bucket */
+			slot = timer_clk + range - 1;
+			break;
+		}
+	}
+	list_add_tail(&timer_wheeln[lvl][(slot >> shift) & TIMER_WHEELN_MASK],
+		      &t->link);
+}
+
+/*
+ * Called when timer_clk enters a new level 0 revolution: refile the
+ * upper level buckets that now fall within range of the level below.
+ */
+static void __timer_wheel_cascade(void)
+{
+	struct list_head *bucket;
+	struct timer *t;
+	unsigned int lvl, shift, idx;
+
+	for (lvl = 0; lvl < TIMER_WHEELN_LEVELS; lvl++) {
+		shift = TIMER_WHEEL0_BITS + lvl * TIMER_WHEELN_BITS;
+		idx = (timer_clk >> shift) & TIMER_WHEELN_MASK;
+		bucket = &timer_wheeln[lvl][idx];
+		while ((t = list_pop(bucket, struct timer, link)) != NULL)
+			__timer_wheel_add(t);
+		if (idx)
+			break;
+	}
+}
+
+/*
+ * We've fallen a long way behind (nobody polled for a while): rather
+ * than stepping through every slot, refile everything from scratch.
+ */
+static void __timer_bucket_move(struct list_head *to, struct list_head *from)
+{
+	struct timer *t;
+
+	while ((t = list_pop(from, struct timer, link)) != NULL)
+		list_add_tail(to, &t->link);
+}
+
+static void __timer_wheel_rebase(uint64_t slot)
+{
+	struct timer *t;
+	unsigned int i, lvl;
+	LIST_HEAD(all);
+
+	for (i = 0; i < TIMER_WHEEL0_SIZE; i++)
+		__timer_bucket_move(&all, &timer_wheel0[i]);
+	for (lvl = 0; lvl < TIMER_WHEELN_LEVELS; lvl++)
+		for (i = 0; i < TIMER_WHEELN_SIZE; i++)
+			__timer_bucket_move(&all, &timer_wheeln[lvl][i]);
+
+	timer_clk = slot;
+	while ((t = list_pop(&all, struct timer, link)) != NULL)
+		__timer_wheel_add(t);
+}
+
+static uint64_t __timer_bucket_min(struct list_head *bucket, uint64_t min)
+{
+	struct timer *t;
+
+	list_for_each(bucket, t, link)
+		if (t->target < min)
+			min = t->target;
+	return min;
+}
+
+/*
+ * Find the earliest pending target. Within a level, buckets are visited
+ * in time order so the first non-empty one holds that level's earliest
+ * timer, but a lower level isn't necessarily earlier than an upper one
+ * (it may have been filed after the upper one was), so look at them all.
+ */
+static uint64_t __timer_wheel_next(void)
+{
+	struct list_head *bucket;
+	uint64_t next = TIMER_POLL;
+	unsigned int i, lvl, shift, idx;
+
+	if (!timer_count)
+		return next;
+
+	for (i = 0; i < TIMER_WHEEL0_SIZE; i++) {
+		bucket = &timer_wheel0[(timer_clk + i) & TIMER_WHEEL0_MASK];
+		if (!list_empty(bucket)) {
+			next = __timer_bucket_min(bucket, next);
+			break;
+		}
+	}
+	for (lvl = 0; lvl < TIMER_WHEELN_LEVELS; lvl++) {
+		shift = TIMER_WHEEL0_BITS + lvl * TIMER_WHEELN_BITS;
+		idx = timer_clk >> shift;
+		/* The current bucket was cascaded already, it's the last */
+		for (i = 1; i <= TIMER_WHEELN_SIZE; i++) {
+			bucket = &timer_wheeln[lvl][(idx + i) & TIMER_WHEELN_MASK];
+			if (!list_empty(bucket)) {
+				next = __timer_bucket_min(bucket, next);
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+static void __update_timer_next(void)
+{
+	timer_next = __timer_wheel_next();
+	if (timer_next != TIMER_POLL)
+		update_timer_expiry(timer_next);
+}
+
 static void __remove_timer(struct timer *t)
 {
 	list_del(&t->link);
 	t->link.next = t->link.prev = NULL;
+	if (t->target != TIMER_POLL)
+		timer_count--;
 }
 
 static void __sync_timer(struct timer *t)
@@ -90,8 +272,6 @@ void cancel_timer_async(struct timer *t)
 
 static void __schedule_timer_at(struct timer *t, uint64_t when)
 {
-	struct timer *lt;
-
 	/* If the timer is already scheduled, take it out */
 	if (t->link.next)
 		__remove_timer(t);
@@ -103,23 +283,22 @@ static void __schedule_timer_at(struct timer *t, uint64_t when)
 		/* It's a poller, add it to the poller list */
 		t->gen = timer_poll_gen;
 		list_add_tail(&timer_poll_list, &t->link);
-	} else {
-		/* It's a real timer, add it in the right spot in the
-		 * ordered timer list
-		 */
-		list_for_each(&timer_list, lt, link) {
-			if (when >= lt->target)
-				continue;
-			list_add_before(&timer_list, &t->link, &lt->link);
-			goto bail;
-		}
-		list_add_tail(&timer_list, &t->link);
+		return;
 	}
- bail:
-	/* Pick up the next timer and upddate the SBE HW timer */
-	lt = list_top(&timer_list, struct timer, link);
-	if (lt) {
-		update_timer_expiry(lt->target);
+
+	/* It's a real timer, file it in the wheel */
+	__timer_wheel_init();
+	__timer_wheel_add(t);
+	timer_count++;
+
+	/*
+	 * Update the SBE HW timer if this is the new earliest. We don't
+	 * bother pulling it back out when timers are cancelled, that just
+	 * costs a spurious check_timers().
+	 */
+	if (when < timer_next) {
+		timer_next = when;
+		update_timer_expiry(when);
 	}
 }
 
@@ -196,21 +375,51 @@ static void __check_poll_timers(uint64_t now)
 	timer_in_poll = false;
 }
 
+/* Return an expired timer from the current slot, or NULL */
+static struct timer *__timer_wheel_expired(uint64_t now)
+{
+	struct timer *t;
+
+	list_for_each(&timer_wheel0[timer_clk & TIMER_WHEEL0_MASK], t, link)
+		if (t->target <= now)
+			return t;
+	return NULL;
+}
+
 static void __check_timers(uint64_t now)
 {
 	struct timer *t;
+	bool fired = false;
 
-	for (;;) {
-		t = list_top(&timer_list, struct timer, link);
+	if (!timer_wheel_ready)
+		return;
 
-		/* Top of list not expired ? that's it ... */
-		if (!t || t->target > now)
-			break;
+	if ((now >> TIMER_WHEEL_SHIFT) > timer_clk + 2 * TIMER_WHEEL0_SIZE)
+		__timer_wheel_rebase(now >> TIMER_WHEEL_SHIFT);
 
-		/* Top of list still running, we have to delay handling
-		 * it. For now just skip until the next poll, when we have
-		 * SLW interrupts, we'll probably want to trip another one
-		 * ASAP
+	for (;;) {
+		t = __timer_wheel_expired(now);
+		if (!t) {
+			/* Nothing at all pending ? catch up in one go */
+			if (!timer_count) {
+				if (timer_clk < (now >> TIMER_WHEEL_SHIFT))
+					timer_clk = now >> TIMER_WHEEL_SHIFT;
+				break;
+			}
+
+			/* Current slot isn't over yet, that's it ... */
+			if (timer_clk >= (now >> TIMER_WHEEL_SHIFT))
+				break;
+
+			timer_clk++;
+			if (!(timer_clk & TIMER_WHEEL0_MASK))
+				__timer_wheel_cascade();
+			continue;
+		}
+
+		/* Timer still running, we have to delay handling it. For
+		 * now just skip until the next poll, when we have SLW
+		 * interrupts, we'll probably want to trip another one ASAP
 		 */
 		if (t->running)
 			break;
@@ -218,6 +427,7 @@ static void __check_timers(uint64_t now)
 		/* Allright, first remove it and mark it running */
 		__remove_timer(t);
 		t->running = this_cpu();
+		fired = true;
 
 		/* Now we can unlock and call it's expiry */
 		unlock(&timer_lock);
@@ -230,6 +440,10 @@ static void __check_timers(uint64_t now)
 		/* Update time stamp */
 		now = mftb();
 	}
+
+	/* Pick up the next timer and update the SBE HW timer */
+	if (fired || timer_next <= now)
+		__update_timer_next();
 }
 
 void check_timers(bool from_interrupt)
@@ -242,10 +456,9 @@ void check_timers(bool from_interrupt)
 	 */
 
 	/* Lockless "peek", a bit racy but shouldn't be a problem as
-	 * we are only looking at whether the list is empty
+	 * we are only looking at whether there is anything pending
 	 */
-	if (list_empty_nocheck(&timer_poll_list) &&
-	    list_empty_nocheck(&timer_list))
+	if (list_empty_nocheck(&timer_poll_list) && !timer_count)
 		return;
 
 	/* Take lock and try again */
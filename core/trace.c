@@ -41,27 +41,86 @@ static struct {
 void init_boot_tracebuf(struct cpu_thread *boot_cpu)
 {
 	init_lock(&boot_tracebuf.trace_info.lock);
+	/* Every cpu points here until init_trace_buffers() */
+	boot_tracebuf.trace_info.shared = true;
 	boot_tracebuf.trace_info.tb.mask = cpu_to_be64(BOOT_TBUF_SZ - 1);
 	boot_tracebuf.trace_info.tb.max_size = cpu_to_be32(MAX_SIZE);
 
 	boot_cpu->trace = &boot_tracebuf.trace_info;
 }
 
+/* Each thread of a core gets an equal share of TBUF_SZ */
+static size_t tracebuf_size(void)
+{
+	size_t size = TBUF_SZ;
+
+	if (cpu_thread_count > 1)
+		size /= cpu_thread_count;
+	return size;
+}
+
 static size_t tracebuf_extra(void)
 {
 	/* We make room for the largest possible record */
-	return TBUF_SZ + MAX_SIZE;
+	return tracebuf_size() + MAX_SIZE;
+}
+
+/*
+ * Advance the writer's end offset past a record of tsz bytes at
+ * ti->end. If that crosses a TBUF_SKIP_SZ boundary, remember where the
+ * next record starts so trace_make_room() can find a record boundary
+ * without walking the headers. Records are smaller than TBUF_SKIP_SZ,
+ * so at most one boundary is crossed.
+ */
+static void trace_advance(struct trace_info *ti, unsigned int tsz)
+{
+	u64 size = be64_to_cpu(ti->tb.mask) + 1;
+	u64 next = ti->end + tsz;
+	u64 boundary = next & ~(u64)(TBUF_SKIP_SZ - 1);
+
+	if (boundary > ti->end)
+		ti->skip[(boundary / TBUF_SKIP_SZ) % (size / TBUF_SKIP_SZ)] = next;
+	ti->end = next;
+}
+
+/*
+ * Throw away old entries before we overwrite them. Rather than evicting
+ * a record at a time we drop everything up to the first record past the
+ * next TBUF_SKIP_SZ boundary, so the following writes find free space
+ * and don't need to touch ->start (or issue its barrier) at all.
+ */
+static void trace_make_room(struct trace_info *ti, unsigned int tsz)
+{
+	u64 size = be64_to_cpu(ti->tb.mask) + 1;
+	u64 need, chunk;
+
+	if (ti->end + tsz <= ti->start + size)
+		return;
+
+	need = ti->end + tsz - size;
+	chunk = (need + TBUF_SKIP_SZ - 1) / TBUF_SKIP_SZ;
+	ti->start = ti->skip[chunk % (size / TBUF_SKIP_SZ)];
+	ti->tb.start = cpu_to_be64(ti->start);
+
+	/* Must update ->start before we rewrite new entries. */
+	lwsync(); /* write barrier */
 }
 
 /* To avoid bloating each entry, repeats are actually specific entries.
- * tb->last points to the last (non-repeat) entry. */
-static bool handle_repeat(struct tracebuf *tb, const union trace *trace)
+ * ti->last points to the last (non-repeat) entry. */
+static bool handle_repeat(struct trace_info *ti, const union trace *trace)
 {
+	struct tracebuf *tb = &ti->tb;
+	u64 mask = be64_to_cpu(tb->mask);
 	struct trace_hdr *prev;
 	struct trace_repeat *rpt;
 	u32 len;
 
-	prev = (void *)tb->buf + be64_to_cpu(tb->last & tb->mask);
+	/* If they've consumed prev entry, don't repeat. */
+	if (ti->last < ti->start || ti->last == ti->end)
+		return false;
+
+	prev = (void *)tb->buf + (ti->last & mask);
 
 	if (prev->type != trace->hdr.type
 	    || prev->len_div_8 != trace->hdr.len_div_8
@@ -72,16 +131,12 @@ static bool handle_repeat(struct tracebuf *tb, const union trace *trace)
 	if (memcmp(prev + 1, &trace->hdr + 1, len - sizeof(*prev)) != 0)
 		return false;
 
-	/* If they've consumed prev entry, don't repeat. */
-	if (be64_to_cpu(tb->last) < be64_to_cpu(tb->start))
-		return false;
-
 	/* OK, it's a duplicate.  Do we already have repeat? */
-	if (be64_to_cpu(tb->last) + len != be64_to_cpu(tb->end)) {
-		u64 pos = be64_to_cpu(tb->last) + len;
+	if (ti->last + len != ti->end) {
+		u64 pos = ti->last + len;
 		/* FIXME: Reader is not protected from seeing this! */
-		rpt = (void *)tb->buf + (pos & be64_to_cpu(tb->mask));
-		assert(pos + rpt->len_div_8*8 == be64_to_cpu(tb->end));
+		rpt = (void *)tb->buf + (pos & mask);
+		assert(pos + rpt->len_div_8*8 == ti->end);
 		assert(rpt->type == TRACE_REPEAT);
 
 		/* If this repeat entry is full, don't repeat. */
@@ -99,18 +154,26 @@ static bool handle_repeat(struct tracebuf *tb, const union trace *trace)
 	 */
 	assert(trace->hdr.len_div_8 * 8 >= sizeof(*rpt));
 
-	rpt = (void *)tb->buf + be64_to_cpu(tb->end & tb->mask);
+	rpt = (void *)tb->buf + (ti->end & mask);
 	rpt->timestamp = trace->hdr.timestamp;
 	rpt->type = TRACE_REPEAT;
 	rpt->len_div_8 = sizeof(*rpt) >> 3;
 	rpt->cpu = trace->hdr.cpu;
 	rpt->prev_len = cpu_to_be16(trace->hdr.len_div_8 << 3);
 	rpt->num = cpu_to_be16(1);
+	trace_advance(ti, sizeof(*rpt));
 	lwsync(); /* write barrier: complete repeat record before exposing */
-	tb->end = cpu_to_be64(be64_to_cpu(tb->end) + sizeof(*rpt));
+	tb->end = cpu_to_be64(ti->end);
 	return true;
 }
 
+/*
+ * Each buffer normally has a single writer: the cpu it was allocated
+ * for. The offsets are kept in native endian in trace_info and only
+ * published to the tracebuf, so the common case is a memcpy followed
+ * by one barrier and one store. Shared buffers (the boot buffer, or
+ * when we ran out of memory) serialize writers with ti->lock.
+ */
 void trace_add(union trace *trace, u8 type, u16 len)
 {
 	struct trace_info *ti = this_cpu()->trace;
@@ -135,32 +198,25 @@ void trace_add(union trace *trace, u8 type, u16 len)
 	trace->hdr.timestamp = cpu_to_be64(mftb());
 	trace->hdr.cpu = cpu_to_be16(this_cpu()->server_no);
 
-	lock(&ti->lock);
-
-	/* Throw away old entries before we overwrite them. */
-	while ((be64_to_cpu(ti->tb.start) + be64_to_cpu(ti->tb.mask) + 1)
-	       < (be64_to_cpu(ti->tb.end) + tsz)) {
-		struct trace_hdr *hdr;
+	if (ti->shared)
+		lock(&ti->lock);
 
-		hdr = (void *)ti->tb.buf +
-			be64_to_cpu(ti->tb.start & ti->tb.mask);
-		ti->tb.start = cpu_to_be64(be64_to_cpu(ti->tb.start) +
-					   (hdr->len_div_8 << 3));
-	}
-
-	/* Must update ->start before we rewrite new entries. */
-	lwsync(); /* write barrier */
+	trace_make_room(ti, tsz);
 
 	/* Check for duplicates... */
-	if (!handle_repeat(&ti->tb, trace)) {
+	if (!handle_repeat(ti, trace)) {
 		/* This may go off end, and that's why ti->tb.buf is oversize */
-		memcpy(ti->tb.buf + be64_to_cpu(ti->tb.end & ti->tb.mask),
+		memcpy(ti->tb.buf + (ti->end & be64_to_cpu(ti->tb.mask)),
 		       trace, tsz);
-		ti->tb.last = ti->tb.end;
+		ti->last = ti->end;
+		ti->tb.last = cpu_to_be64(ti->last);
+		trace_advance(ti, tsz);
 		lwsync(); /* write barrier: write entry before exposing */
-		ti->tb.end = cpu_to_be64(be64_to_cpu(ti->tb.end) + tsz);
+		ti->tb.end = cpu_to_be64(ti->end);
 	}
-	unlock(&ti->lock);
+
+	if (ti->shared)
+		unlock(&ti->lock);
 }
 
 static void trace_add_dt_props(void)
@@ -183,19 +239,27 @@ static void trace_add_dt_props(void)
 	dt_add_property_u64(opal_node, "ibm,opal-trace-mask", tmask);
 }
 
-static void trace_add_desc(struct trace_info *t, uint64_t size)
+static bool trace_add_desc(struct trace_info *t, uint64_t size)
 {
 	unsigned int i = debug_descriptor.num_traces;
 
 	if (i >= DEBUG_DESC_MAX_TRACES) {
 		prerror("TRACE: Debug descriptor trace list full !\n");
-		return;
+		return false;
 	}
 	debug_descriptor.num_traces++;
 
 	debug_descriptor.trace_phys[i] = (uint64_t)&t->tb;
 	debug_descriptor.trace_tce[i] = 0; /* populated later */
 	debug_descriptor.trace_size[i] = size;
+	return true;
+}
+
+static void init_trace_info(struct trace_info *ti)
+{
+	init_lock(&ti->lock);
+	ti->tb.mask = cpu_to_be64(tracebuf_size() - 1);
+	ti->tb.max_size = cpu_to_be32(MAX_SIZE);
 }
 
 /* Allocate trace buffers once we know memory topology */
@@ -203,42 +267,64 @@ void init_trace_buffers(void)
 {
 	struct cpu_thread *t;
 	struct trace_info *any = &boot_tracebuf.trace_info;
+	unsigned int threads = cpu_thread_count ? cpu_thread_count : 1;
 	uint64_t size;
+	void *core_bufs;
 
 	/* Boot the boot trace in the debug descriptor */
 	trace_add_desc(any, sizeof(boot_tracebuf.buf));
 
-	/* Allocate a trace buffer for each primary cpu. */
+	/* Use a 4K alignment for TCE mapping */
+	size = ALIGN_UP(sizeof(*t->trace) + tracebuf_extra(), 0x1000);
+
+	/*
+	 * Allocate one block per primary cpu, carved up into a buffer
+	 * per thread so that every buffer has a single writer.
+	 */
 	for_each_cpu(t) {
 		if (t->is_secondary)
 			continue;
 
-		/* Use a 4K alignment for TCE mapping */
-		size = ALIGN_UP(sizeof(*t->trace) + tracebuf_extra(), 0x1000);
-		t->trace = local_alloc(t->chip_id, size, 0x1000);
-		if (t->trace) {
+		core_bufs = local_alloc(t->chip_id, size * threads, 0x1000);
+		if (core_bufs) {
+			memset(core_bufs, 0, size * threads);
+			t->trace = core_bufs;
 			any = t->trace;
-			memset(t->trace, 0, size);
-			init_lock(&t->trace->lock);
-			t->trace->tb.mask = cpu_to_be64(TBUF_SZ - 1);
-			t->trace->tb.max_size = cpu_to_be32(MAX_SIZE);
+			init_trace_info(t->trace);
 			trace_add_desc(any, sizeof(t->trace->tb) +
 				       tracebuf_extra());
-		} else
+		} else {
 			prerror("TRACE: cpu 0x%x allocation failed\n", t->pir);
+			t->trace = NULL;
+		}
 	}
 
 	/* In case any allocations failed, share trace buffers. */
 	for_each_cpu(t) {
-		if (!t->is_secondary && !t->trace)
+		if (!t->is_secondary && !t->trace) {
 			t->trace = any;
+			any->shared = true;
+		}
 	}
 
-	/* And copy those to the secondaries. */
+	/* Secondaries take the next slot in their primary's block */
 	for_each_cpu(t) {
+		struct trace_info *ti;
+		unsigned int thread;
+
 		if (!t->is_secondary)
 			continue;
-		t->trace = t->primary->trace;
+
+		thread = t->pir - t->primary->pir;
+		ti = (void *)t->primary->trace + thread * size;
+		if (t->primary->trace->shared || thread >= threads ||
+		    !trace_add_desc(ti, sizeof(ti->tb) + tracebuf_extra())) {
+			t->trace = t->primary->trace;
+			t->trace->shared = true;
+			continue;
+		}
+		init_trace_info(ti);
+		t->trace = ti;
 	}
 
 	/* Trace node in DT. */
@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -32,12 +33,15 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <libflash/libflash.h>
 #include <libflash/libffs.h>
 #include <libflash/blocklevel.h>
 #include <common/arch_flash.h>
 #include "progress.h"
+#include "sha256.h"
 
 #define __aligned(x)			__attribute__((aligned(x)))
 
@@ -57,10 +61,37 @@ const char *flashfilename = NULL;
 static bool must_confirm = true;
 static bool dummy_run;
 static bool bmc_flash;
+static bool pipelined;
+static bool delta;
+static const char *manifest_file;
 
 #define FILE_BUF_SIZE	0x10000
 static uint8_t file_buf[FILE_BUF_SIZE] __aligned(0x1000);
 
+/*
+ * Pipelined programming: a reader thread keeps up to PIPELINE_SLOTS
+ * chunks of the file ready while the main thread writes one chunk and
+ * then reads back the one before it to verify it. A slot only goes back
+ * to the reader once its chunk is verified.
+ */
+#define PIPELINE_SLOTS	4
+
+struct pipeline {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd;
+	uint32_t to_read;
+	/* Slot counters, they only ever go up */
+	unsigned int filled;
+	unsigned int released;
+	bool eof;
+	bool stop;
+	int err;
+	uint32_t len[PIPELINE_SLOTS];
+};
+
+static uint8_t pipeline_buf[PIPELINE_SLOTS][FILE_BUF_SIZE] __aligned(0x1000);
+
 static bool check_confirm(void)
 {
 	char yes[8], *p;
@@ -401,13 +432,420 @@ static int set_ecc(struct flash_details *flash, uint32_t start, uint32_t size)
 	return 0;
 }
 
+static void *pipeline_reader(void *arg)
+{
+	struct pipeline *p = arg;
+	unsigned int slot;
+	uint32_t len, done;
+	ssize_t rc = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		while (p->filled - p->released == PIPELINE_SLOTS && !p->stop)
+			pthread_cond_wait(&p->cond, &p->lock);
+		slot = p->filled % PIPELINE_SLOTS;
+		len = p->to_read > FILE_BUF_SIZE ? FILE_BUF_SIZE : p->to_read;
+		if (p->stop || !len) {
+			p->eof = true;
+			pthread_cond_broadcast(&p->cond);
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		pthread_mutex_unlock(&p->lock);
+
+		/*
+		 * Fill the whole chunk so they all stay aligned to the
+		 * start, short reads from pipes would break that up.
+		 */
+		for (done = 0; done < len; done += rc) {
+			rc = read(p->fd, pipeline_buf[slot] + done, len - done);
+			if (rc <= 0)
+				break;
+		}
+
+		pthread_mutex_lock(&p->lock);
+		if (rc < 0)
+			p->err = errno;
+		if (done) {
+			p->len[slot] = done;
+			p->to_read -= done;
+			p->filled++;
+		}
+		if (done < len)
+			p->eof = true;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+
+		if (done < len)
+			break;
+	}
+
+	return NULL;
+}
+
+static int pipeline_verify(struct blocklevel_device *bl, uint32_t pos,
+		const uint8_t *buf, uint32_t len)
+{
+	static uint8_t verify_buf[FILE_BUF_SIZE] __aligned(0x1000);
+	int rc;
+
+	rc = blocklevel_read(bl, pos, verify_buf, len);
+	if (rc) {
+		fprintf(stderr, "Flash read error %d for"
+			" chunk at 0x%08x\n", rc, pos);
+		return rc;
+	}
+	if (memcmp(verify_buf, buf, len)) {
+		fprintf(stderr, "Verification failed for"
+			" chunk at 0x%08x\n", pos);
+		return FLASH_ERR_VERIFY_FAILURE;
+	}
+
+	return 0;
+}
+
+static void pipeline_release(struct pipeline *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->released++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Smart writes only erase and write the erase blocks that differ, so
+ * the range doesn't need erasing beforehand and reprogramming an image
+ * that has barely changed is mostly reads.
+ *
+ * blocklevel devices aren't thread safe, so all flash accesses stay on
+ * this thread. What overlaps is reading the file with the flash work.
+ */
+static int program_pipelined(struct blocklevel_device *bl, int fd,
+		uint32_t start, uint32_t size, uint32_t *actual_size)
+{
+	struct pipeline p = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.fd = fd,
+		.to_read = size,
+	};
+	unsigned int consumed = 0, slot, prev_slot = 0;
+	uint32_t pos = start, prev_pos = 0, len;
+	bool have_prev = false;
+	pthread_t reader;
+	int rc = 0;
+
+	rc = pthread_create(&reader, NULL, pipeline_reader, &p);
+	if (rc) {
+		fprintf(stderr, "Failed to start reader thread: %s\n",
+				strerror(rc));
+		return 1;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&p.lock);
+		while (consumed == p.filled && !p.eof)
+			pthread_cond_wait(&p.cond, &p.lock);
+		if (consumed == p.filled) {
+			pthread_mutex_unlock(&p.lock);
+			break;
+		}
+		pthread_mutex_unlock(&p.lock);
+
+		slot = consumed % PIPELINE_SLOTS;
+		len = p.len[slot];
+		rc = blocklevel_smart_write(bl, pos, pipeline_buf[slot], len);
+		if (rc) {
+			fprintf(stderr, "Flash write error %d for"
+				" chunk at 0x%08x\n", rc, pos);
+			break;
+		}
+
+		if (have_prev) {
+			rc = pipeline_verify(bl, prev_pos,
+					pipeline_buf[prev_slot],
+					p.len[prev_slot]);
+			if (rc)
+				break;
+			pipeline_release(&p);
+		}
+
+		have_prev = true;
+		prev_slot = slot;
+		prev_pos = pos;
+		consumed++;
+		pos += len;
+		*actual_size += len;
+		progress_tick(*actual_size >> 8);
+	}
+
+	if (!rc && have_prev)
+		rc = pipeline_verify(bl, prev_pos, pipeline_buf[prev_slot],
+				p.len[prev_slot]);
+
+	pthread_mutex_lock(&p.lock);
+	p.stop = true;
+	pthread_cond_broadcast(&p.cond);
+	pthread_mutex_unlock(&p.lock);
+	pthread_join(reader, NULL);
+
+	if (!rc && p.err) {
+		fprintf(stderr, "Error reading file: %s\n", strerror(p.err));
+		rc = 1;
+	}
+
+	return rc;
+}
+
+/*
+ * A delta manifest records the SHA-256 of each erase block last
+ * programmed with --delta, or of each 4K for flashes with smaller erase
+ * blocks. It is a text file:
+ *
+ *   pflash-manifest 1
+ *   start 0x<flash address of the first block>
+ *   block 0x<block size>
+ *   <one hash per block, in flash order>
+ *
+ * The first and last blocks only hash the part of them that was written.
+ */
+#define MANIFEST_MAGIC	"pflash-manifest 1"
+#define DELTA_MIN_BLOCK	0x1000
+
+struct manifest {
+	uint32_t start;
+	uint32_t block;
+	uint32_t count;
+	uint8_t (*hash)[SHA256_DIGEST_SIZE];
+};
+
+static int manifest_load(const char *file, struct manifest *m)
+{
+	char line[2 * SHA256_DIGEST_SIZE + 2];
+	uint8_t (*hash)[SHA256_DIGEST_SIZE];
+	unsigned int i, byte;
+	FILE *f;
+
+	memset(m, 0, sizeof(*m));
+
+	f = fopen(file, "r");
+	if (!f)
+		return -1;
+
+	if (!fgets(line, sizeof(line), f) || strncmp(line, MANIFEST_MAGIC,
+				strlen(MANIFEST_MAGIC)) ||
+			fscanf(f, "start %" SCNx32 "\n", &m->start) != 1 ||
+			fscanf(f, "block %" SCNx32 "\n", &m->block) != 1)
+		goto bad;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (strlen(line) < 2 * SHA256_DIGEST_SIZE)
+			goto bad;
+		hash = realloc(m->hash, (m->count + 1) * sizeof(*m->hash));
+		if (!hash)
+			goto bad;
+		m->hash = hash;
+		for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+			if (sscanf(line + i * 2, "%2x", &byte) != 1)
+				goto bad;
+			m->hash[m->count][i] = byte;
+		}
+		m->count++;
+	}
+
+	fclose(f);
+	return 0;
+bad:
+	fprintf(stderr, "Ignoring malformed manifest \"%s\"\n", file);
+	fclose(f);
+	free(m->hash);
+	memset(m, 0, sizeof(*m));
+	return -1;
+}
+
+static int manifest_save(const char *file, struct manifest *m)
+{
+	char *tmp;
+	unsigned int i, j;
+	FILE *f;
+	int rc = 0;
+
+	if (asprintf(&tmp, "%s.tmp", file) < 0)
+		return -1;
+
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror("Failed to create manifest");
+		free(tmp);
+		return -1;
+	}
+
+	fprintf(f, MANIFEST_MAGIC "\nstart 0x%08x\nblock 0x%08x\n",
+			m->start, m->block);
+	for (i = 0; i < m->count; i++) {
+		for (j = 0; j < SHA256_DIGEST_SIZE; j++)
+			fprintf(f, "%02x", m->hash[i][j]);
+		fprintf(f, "\n");
+	}
+
+	if (fclose(f) || rename(tmp, file)) {
+		perror("Failed to write manifest");
+		unlink(tmp);
+		rc = -1;
+	}
+	free(tmp);
+
+	return rc;
+}
+
+/*
+ * Only write the erase blocks of the image that differ from what's on the
+ * flash. Without a manifest each block is read and compared. With a
+ * manifest that matches the range being programmed, blocks whose hash
+ * hasn't changed aren't even read. Only the blocks written are verified,
+ * so the manifest must be kept with the flash it describes. It is removed
+ * before the first write and only saved again once everything has been
+ * written, so a failed run can't leave one that no longer matches.
+ */
+static int program_delta(struct blocklevel_device *bl, int fd,
+		uint32_t start, uint32_t size, uint32_t *actual_size)
+{
+	struct manifest old = { 0 }, new = { 0 };
+	uint8_t *buf = NULL, *flash_buf = NULL;
+	uint32_t granule, pos = start, len, done, changed = 0;
+	bool use_manifest = false, manifest_gone = false, eof;
+	ssize_t n = 0;
+	int rc;
+
+	rc = blocklevel_get_info(bl, NULL, NULL, &granule);
+	if (rc) {
+		fprintf(stderr, "Error %d getting flash info\n", rc);
+		return rc;
+	}
+	/* Files have byte sized erase blocks, hash something sensible */
+	if (granule < DELTA_MIN_BLOCK)
+		granule = DELTA_MIN_BLOCK;
+
+	if (manifest_file && !manifest_load(manifest_file, &old)) {
+		use_manifest = old.start == start && old.block == granule;
+		if (!use_manifest)
+			fprintf(stderr, "Manifest \"%s\" is for a different"
+				" range, reading the flash instead\n",
+				manifest_file);
+	}
+	new.start = start;
+	new.block = granule;
+
+	buf = malloc(granule);
+	flash_buf = malloc(granule);
+	if (!buf || !flash_buf) {
+		fprintf(stderr, "Failed to allocate erase block buffers\n");
+		rc = 1;
+		goto out;
+	}
+
+	while (size) {
+		uint8_t (*hash)[SHA256_DIGEST_SIZE];
+		bool differs;
+
+		/* Up to the end of this erase block */
+		len = granule - (pos & (granule - 1));
+		if (len > size)
+			len = size;
+
+		for (done = 0; done < len; done += n) {
+			n = read(fd, buf + done, len - done);
+			if (n <= 0)
+				break;
+		}
+		if (n < 0) {
+			perror("Error reading file");
+			rc = 1;
+			goto out;
+		}
+		if (!done)
+			break;
+		eof = done < len;
+		len = done;
+
+		hash = realloc(new.hash, (new.count + 1) * sizeof(*new.hash));
+		if (!hash) {
+			fprintf(stderr, "Failed to allocate manifest\n");
+			rc = 1;
+			goto out;
+		}
+		new.hash = hash;
+		sha256(buf, len, new.hash[new.count]);
+
+		if (use_manifest && new.count < old.count) {
+			differs = memcmp(new.hash[new.count],
+					old.hash[new.count], SHA256_DIGEST_SIZE);
+		} else {
+			rc = blocklevel_read(bl, pos, flash_buf, len);
+			if (rc) {
+				fprintf(stderr, "Flash read error %d for"
+					" block at 0x%08x\n", rc, pos);
+				goto out;
+			}
+			differs = memcmp(flash_buf, buf, len);
+		}
+		new.count++;
+
+		if (differs) {
+			if (manifest_file && !manifest_gone) {
+				if (unlink(manifest_file) && errno != ENOENT) {
+					perror("Failed to remove old manifest");
+					rc = 1;
+					goto out;
+				}
+				manifest_gone = true;
+			}
+			rc = blocklevel_smart_write(bl, pos, buf, len);
+			if (rc) {
+				fprintf(stderr, "Flash write error %d for"
+					" block at 0x%08x\n", rc, pos);
+				goto out;
+			}
+			rc = blocklevel_read(bl, pos, flash_buf, len);
+			if (rc || memcmp(flash_buf, buf, len)) {
+				fprintf(stderr, "Verification failed for"
+					" block at 0x%08x\n", pos);
+				rc = rc ?: FLASH_ERR_VERIFY_FAILURE;
+				goto out;
+			}
+			changed++;
+		}
+
+		pos += len;
+		size -= len;
+		*actual_size += len;
+		progress_tick(*actual_size >> 8);
+		if (eof)
+			break;
+	}
+
+	/* program_file() ends the line */
+	printf("\n%u of %u blocks changed", changed, new.count);
+
+	if (manifest_file && manifest_save(manifest_file, &new))
+		rc = 1;
+out:
+	free(old.hash);
+	free(new.hash);
+	free(flash_buf);
+	free(buf);
+	return rc;
+}
+
 static int program_file(struct blocklevel_device *bl,
 		const char *file, uint32_t start, uint32_t size,
 		struct ffs_handle *ffsh, int ffs_index)
 {
+	struct timespec t_start, t_end;
 	bool confirm;
 	int fd, rc = 0;
 	uint32_t actual_size = 0;
+	uint64_t usecs;
 
 	fd = open(file, O_RDONLY);
 	if (fd == -1) {
@@ -430,6 +868,16 @@ static int program_file(struct blocklevel_device *bl,
 
 	printf("Programming & Verifying...\n");
 	progress_init(size >> 8);
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	if (pipelined || delta) {
+		if (pipelined)
+			rc = program_pipelined(bl, fd, start, size, &actual_size);
+		else
+			rc = program_delta(bl, fd, start, size, &actual_size);
+		if (rc)
+			goto out;
+		size = 0;
+	}
 	while(size) {
 		ssize_t len;
 
@@ -460,6 +908,16 @@ static int program_file(struct blocklevel_device *bl,
 	}
 	progress_end();
 
+	if (pipelined || delta) {
+		clock_gettime(CLOCK_MONOTONIC, &t_end);
+		usecs = (t_end.tv_sec - t_start.tv_sec) * 1000000ull +
+			(t_end.tv_nsec - t_start.tv_nsec) / 1000;
+		printf("Programmed %u bytes in %" PRIu64 ".%03" PRIu64
+		       "s (%.2f MB/s)\n", actual_size, usecs / 1000000,
+		       (usecs / 1000) % 1000,
+		       usecs ? (double)actual_size / usecs : 0.0);
+	}
+
 	/* If this is a flash partition, adjust its size */
 	if (ffsh && ffs_index >= 0) {
 		printf("Updating actual size in partition header...\n");
@@ -677,6 +1135,20 @@ static void print_help(const char *pname)
 	printf("\t\tthe specified size (whatever is smaller). If used in\n");
 	printf("\t\tconjunction with any erase command, the erase will\n");
 	printf("\t\ttake place first.\n\n");
+	printf("\t--pipeline\n");
+	printf("\t\tUsed with -p. Read the file ahead in another thread,\n");
+	printf("\t\tonly erase and write the erase blocks that differ and\n");
+	printf("\t\tverify each chunk after starting the next one. -e\n");
+	printf("\t\tisn't needed. Reports the programming speed.\n\n");
+	printf("\t--delta\n");
+	printf("\t\tUsed with -p. Only erase and write the erase blocks\n");
+	printf("\t\tthat differ from what is on the flash, and only verify\n");
+	printf("\t\tthose. -e isn't needed.\n\n");
+	printf("\t--manifest=file\n");
+	printf("\t\tUsed with --delta. Keep the hash of each erase block\n");
+	printf("\t\tprogrammed in file, and use it next time instead of\n");
+	printf("\t\treading the flash. Only use it if nothing else writes\n");
+	printf("\t\tthat part of the flash.\n\n");
 	printf("\t-t, --tune\n");
 	printf("\t\tJust tune the flash controller & access size\n");
 	printf("\t\tMust be used in conjuction with --direct\n");
@@ -737,6 +1209,9 @@ int main(int argc, char *argv[])
 			{"side",	required_argument,	NULL,	'S'},
 			{"toc",		required_argument,	NULL,	'T'},
 			{"clear",   no_argument,        NULL,   'c'},
+			{"pipeline",	no_argument,		NULL,	'L'},
+			{"delta",	no_argument,		NULL,	'x'},
+			{"manifest",	required_argument,	NULL,	'X'},
 			{NULL,	    0,                  NULL,    0 }
 		};
 		int c, oidx = 0;
@@ -839,6 +1314,15 @@ int main(int argc, char *argv[])
 		case 'c':
 			do_clear = true;
 			break;
+		case 'L':
+			pipelined = true;
+			break;
+		case 'x':
+			delta = true;
+			break;
+		case 'X':
+			manifest_file = optarg;
+			break;
 		case 'm':
 			print_detail = true;
 			if (optarg) {
@@ -900,6 +1384,19 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
+	if (pipelined && delta) {
+		fprintf(stderr, "--pipeline and --delta are mutually"
+			" exclusive !\n");
+		rc = 1;
+		goto out;
+	}
+
+	if (manifest_file && !delta) {
+		fprintf(stderr, "--manifest requires --delta\n");
+		rc = 1;
+		goto out;
+	}
+
 	/* 4B not supported on BMC flash */
 	if (enable_4B && bmc_flash) {
 		fprintf(stderr, "--enable-4B not supported on BMC flash !\n");
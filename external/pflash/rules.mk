@@ -7,7 +7,7 @@ LIBFLASH_SRC	:= $(addprefix libflash/,$(LIBFLASH_FILES))
 CCAN_FILES	:= list.c
 CCAN_OBJS	:= $(addprefix ccan-list-, $(CCAN_FILES:.c=.o))
 CCAN_SRC	:= $(addprefix ccan/list/,$(CCAN_FILES))
-PFLASH_OBJS	:= pflash.o progress.o version.o common-arch_flash.o
+PFLASH_OBJS	:= pflash.o progress.o sha256.o version.o common-arch_flash.o
 OBJS		:= $(PFLASH_OBJS) $(LIBFLASH_OBJS) $(CCAN_OBJS)
 EXE     	:= pflash
 sbindir		= $(prefix)/sbin
@@ -51,5 +51,5 @@ $(CCAN_OBJS): ccan-list-%.o: ccan/list/%.c | links
 	$(Q_CC)$(CC) $(CFLAGS) -c $< -o $@
 
 $(EXE): $(OBJS)
-	$(Q_CC)$(CC) $(LDFLAGS) $(CFLAGS) $^ -lrt -o $@
+	$(Q_CC)$(CC) $(LDFLAGS) $(CFLAGS) $^ -lrt -lpthread -o $@
 
@@ -16,6 +16,7 @@
 
 #include <err.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -28,6 +29,12 @@
 #include "../../ccan/endian/endian.h"
 #include "../../ccan/short_types/short_types.h"
 #include <trace_types.h>
+#include <mem-map.h>
+
+/* skiboot image, to find the format strings of prlog traces */
+static char *image;
+static size_t image_size;
+static u64 image_base = SKIBOOT_BASE;
 
 /* Handles trace from debugfs (one record at a time) or file */ 
 static bool get_trace(int fd, union trace *t, int *len)
@@ -150,17 +157,158 @@ static void dump_uart(struct trace_uart *t)
 	}
 }
 
+static void load_image(const char *path)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		err(1, "Opening %s", path);
+	image_size = st.st_size;
+	image = malloc(image_size + 1);
+	if (!image)
+		err(1, "Allocating %zu bytes", image_size);
+	if (read(fd, image, image_size) != (ssize_t)image_size)
+		err(1, "Reading %s", path);
+	/* Make sure the last string is terminated */
+	image[image_size] = '\0';
+	close(fd);
+}
+
+/* Print one conversion the way skiboot's vsnprintf() would */
+static void print_prlog_arg(const char *spec, int speclen, u64 val,
+			    const char *data, unsigned int dlen)
+{
+	char fmt[32];
+	int i, n = 0, bits = 32;
+	char conv = spec[speclen - 1];
+
+	fmt[n++] = '%';
+	for (i = 0; i < speclen - 1 && n < sizeof(fmt) - 4; i++) {
+		switch (spec[i]) {
+		case 'l':
+		case 'z':
+			bits = 64;
+			break;
+		case 'h':
+			bits = bits == 16 ? 8 : 16;
+			break;
+		default:
+			fmt[n++] = spec[i];
+		}
+	}
+	if (bits < 64)
+		val &= (1ull << bits) - 1;
+
+	switch (conv) {
+	case 'd':
+	case 'i':
+		if (bits < 64 && (val & (1ull << (bits - 1))))
+			val |= ~((1ull << bits) - 1);
+		strcpy(fmt + n, "lld");
+		printf(fmt, (long long)val);
+		break;
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	case 'O':
+		fmt[n++] = 'l';
+		fmt[n++] = 'l';
+		fmt[n++] = conv == 'O' ? 'o' : conv;
+		fmt[n] = '\0';
+		printf(fmt, (unsigned long long)val);
+		break;
+	case 'p':
+		printf("0x%llx", (unsigned long long)val);
+		break;
+	case 'c':
+		putchar((int)val);
+		break;
+	case 's':
+		if (val >= dlen || !memchr(data + val, 0, dlen - val)) {
+			printf("(bad string)");
+			break;
+		}
+		strcpy(fmt + n, "s");
+		printf(fmt, data + val);
+		break;
+	}
+}
+
+static void dump_prlog(struct trace_prlog *t)
+{
+	unsigned int dlen = t->hdr.len_div_8 * 8 -
+		offsetof(struct trace_prlog, data);
+	u64 addr = be64_to_cpu(t->fmt);
+	const char *data = (const char *)t->data;
+	const char *fmt, *spec;
+	unsigned int i, arg = 0;
+
+	printf("PRLOG [%d] ", t->level);
+	if (!image || addr < image_base || addr - image_base >= image_size) {
+		printf("fmt=0x%016"PRIx64, addr);
+		for (i = 0; i < t->nargs && i * 8 < dlen; i++)
+			printf(" 0x%"PRIx64, be64_to_cpu(t->data[i]));
+		printf("\n");
+		return;
+	}
+
+	fmt = image + (addr - image_base);
+	while (*fmt) {
+		if (*fmt != '%') {
+			putchar(*fmt++);
+			continue;
+		}
+		spec = fmt;
+		do {
+			fmt++;
+		} while (*fmt && !strchr("diuxXpcsoO%", *fmt));
+		if (!*fmt)
+			break;
+		if (*fmt == '%') {
+			putchar('%');
+		} else if (arg < t->nargs && arg * 8 < dlen) {
+			print_prlog_arg(spec + 1, fmt - spec,
+					be64_to_cpu(t->data[arg]), data, dlen);
+			arg++;
+		}
+		fmt++;
+	}
+	if (fmt == image + (addr - image_base) || fmt[-1] != '\n')
+		printf("\n");
+}
+
+static void usage(void)
+{
+	errx(1, "Usage: dump_trace [-s skiboot.lid [-b base]] [file]");
+}
+
 int main(int argc, char *argv[])
 {
-	int fd, len = 0;
+	int fd, len = 0, c;
 	union trace t;
 	const char *in = "/sys/kernel/debug/powerpc/opal-trace";
 
-	if (argc > 2)
-		errx(1, "Usage: dump_trace [file]");
+	while ((c = getopt(argc, argv, "s:b:")) != -1) {
+		switch (c) {
+		case 's':
+			load_image(optarg);
+			break;
+		case 'b':
+			image_base = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc - optind > 1)
+		usage();
 
-	if (argv[1])
-		in = argv[1];
+	if (optind < argc)
+		in = argv[optind];
 	fd = open(in, O_RDONLY);
 	if (fd < 0)
 		err(1, "Opening %s", in);
@@ -188,6 +336,9 @@ int main(int argc, char *argv[])
 		case TRACE_UART:
 			dump_uart(&t.uart);
 			break;
+		case TRACE_PRLOG:
+			dump_prlog(&t.prlog);
+			break;
 		default:
 			printf("UNKNOWN(%u) CPU %u length %u\n",
 			       t.hdr.type, be16_to_cpu(t.hdr.cpu),
@@ -20,19 +20,55 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "xscom.h"
 
 static void print_usage(int code)
 {
 	printf("usage: getscom [-c|--chip chip-id] [-b|--list-bits] addr\n");
+	printf("       getscom [-c|--chip chip-id] -f|--file file\n");
 	printf("       getscom -l|--list-chips\n");
 	printf("       getscom -v|--version\n");
 	printf("\n");
 	printf("       NB: --list-bits shows which PPC bits are set\n");
+	printf("           --file reads a list of \"[chip-id] addr\" lines,\n");
+	printf("           \"-\" for stdin\n");
 	exit(code);
 }
 
+static int bulk_read(const char *file, uint32_t chip_id)
+{
+	struct xscom_op *ops;
+	FILE *f = stdin;
+	int i, count, failed;
+
+	if (strcmp(file, "-")) {
+		f = fopen(file, "r");
+		if (!f) {
+			perror("Failed to open list file");
+			exit(1);
+		}
+	}
+	count = xscom_batch_parse(f, chip_id, false, &ops);
+	if (f != stdin)
+		fclose(f);
+	if (count < 0)
+		exit(1);
+
+	failed = xscom_batch(ops, count);
+	for (i = 0; i < count; i++) {
+		printf("%08x %016" PRIx64 " ", ops[i].chip_id, ops[i].addr);
+		if (ops[i].rc)
+			printf("error %d\n", ops[i].rc);
+		else
+			printf("%016" PRIx64 "\n", ops[i].val);
+	}
+	free(ops);
+
+	return failed ? 1 : 0;
+}
+
 static void print_chip_info(uint32_t chip_id)
 {
 	uint64_t f000f, cfam_id;
@@ -91,6 +127,7 @@ int main(int argc, char *argv[])
 	bool list_chips = false;
 	bool no_work = false;
 	bool list_bits = false;
+	const char *file = NULL;
 	int rc;
 
 	while(1) {
@@ -100,10 +137,11 @@ int main(int argc, char *argv[])
 			{"help",	no_argument,		NULL,	'h'},
 			{"version",	no_argument,		NULL,	'v'},
 			{"list-bits",	no_argument,		NULL,	'b'},
+			{"file",	required_argument,	NULL,	'f'},
 		};
 		int c, oidx = 0;
 
-		c = getopt_long(argc, argv, "-c:bhlv", long_opts, &oidx);
+		c = getopt_long(argc, argv, "-c:bf:hlv", long_opts, &oidx);
 		if (c == EOF)
 			break;
 		switch(c) {
@@ -122,6 +160,9 @@ int main(int argc, char *argv[])
 		case 'b':
 			list_bits = true;
 			break;
+		case 'f':
+			file = optarg;
+			break;
 		case 'v':
 			printf("xscom utils version %s\n", version);
 			exit(0);
@@ -130,7 +171,7 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	if (addr == -1ull)
+	if (addr == -1ull && !file)
 		no_work = true;
 	if (no_work && !list_chips) {
 		fprintf(stderr, "Invalid or missing address\n");
@@ -151,6 +192,8 @@ int main(int argc, char *argv[])
 		return 0;
 	if (chip_id == 0xffffffff)
 		chip_id = def_chip;
+	if (file)
+		return bulk_read(file, chip_id);
 
 	rc = xscom_read(chip_id, addr, &val);
 	if (rc) {
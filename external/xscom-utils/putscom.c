@@ -20,19 +20,52 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "xscom.h"
 
 static void print_usage(int code)
 {
 	printf("usage: putscom [-c|--chip chip-id] [-b|--list-bits] addr value\n");
+	printf("       putscom [-c|--chip chip-id] -f|--file file\n");
 	printf("       putscom -v|--version\n");
 	printf("\n");
 	printf("       NB: --list-bits shows which PPC bits are set\n");
+	printf("           --file reads a list of \"[chip-id] addr value\"\n");
+	printf("           lines, \"-\" for stdin\n");
 	exit(code);
 	exit(code);
 }
 
+static int bulk_write(const char *file, uint32_t chip_id)
+{
+	struct xscom_op *ops;
+	FILE *f = stdin;
+	int i, count, failed;
+
+	if (strcmp(file, "-")) {
+		f = fopen(file, "r");
+		if (!f) {
+			perror("Failed to open list file");
+			exit(1);
+		}
+	}
+	count = xscom_batch_parse(f, chip_id, true, &ops);
+	if (f != stdin)
+		fclose(f);
+	if (count < 0)
+		exit(1);
+
+	failed = xscom_batch(ops, count);
+	for (i = 0; i < count; i++)
+		if (ops[i].rc)
+			fprintf(stderr, "Error %d writing XSCOM %08x %016" PRIx64
+				"\n", ops[i].rc, ops[i].chip_id, ops[i].addr);
+	free(ops);
+
+	return failed ? 1 : 0;
+}
+
 extern const char version[];
 
 int main(int argc, char *argv[])
@@ -41,6 +74,7 @@ int main(int argc, char *argv[])
 	uint32_t def_chip, chip_id = 0xffffffff;
 	bool got_addr = false, got_val = false;
 	bool list_bits = false;
+	const char *file = NULL;
 	int rc;
 
 	while(1) {
@@ -48,10 +82,11 @@ int main(int argc, char *argv[])
 			{"chip",	required_argument,	NULL,	'c'},
 			{"help",	no_argument,		NULL,	'h'},
 			{"version",	no_argument,		NULL,	'v'},
+			{"file",	required_argument,	NULL,	'f'},
 		};
 		int c, oidx = 0;
 
-		c = getopt_long(argc, argv, "-c:bhv", long_opts, &oidx);
+		c = getopt_long(argc, argv, "-c:bf:hv", long_opts, &oidx);
 		if (c == EOF)
 			break;
 		switch(c) {
@@ -70,6 +105,9 @@ int main(int argc, char *argv[])
 		case 'b':
 			list_bits = true;
 			break;
+		case 'f':
+			file = optarg;
+			break;
 		case 'v':
 			printf("xscom utils version %s\n", version);
 			exit(0);
@@ -81,7 +119,7 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	if (!got_addr || !got_val) {
+	if (!file && (!got_addr || !got_val)) {
 		fprintf(stderr, "Invalid or missing address/value\n");
 		print_usage(1);
 	}
@@ -93,6 +131,8 @@ int main(int argc, char *argv[])
 	}
 	if (chip_id == 0xffffffff)
 		chip_id = def_chip;
+	if (file)
+		return bulk_write(file, chip_id);
 
 	rc = xscom_write(chip_id, addr, val);
 	if (rc) {
@@ -179,6 +179,157 @@ int xscom_write(uint32_t chip_id, uint64_t addr, uint64_t val)
 	return 0;
 }
 
+/*
+ * Runs of direct accesses to consecutive registers of the same chip are
+ * done with a single read or write of the debugfs file, which the kernel
+ * turns into one OPAL call per register without going back to userspace.
+ */
+#define XSCOM_BATCH_RUN	512
+
+/* Set once the kernel rejects multi register accesses */
+static bool xscom_no_runs;
+
+/* Returns the number of entries done, or -errno if none were */
+static int xscom_batch_run(struct xscom_chip *c, struct xscom_op *ops,
+			   int count)
+{
+	uint64_t buf[XSCOM_BATCH_RUN];
+	uint64_t base = xscom_mangle_addr(ops[0].addr);
+	ssize_t rc;
+	int i, n;
+
+	if (ops[0].write) {
+		for (i = 0; i < count; i++)
+			buf[i] = ops[i].val;
+		rc = pwrite64(c->fd, buf, count * 8, base);
+	} else
+		rc = pread64(c->fd, buf, count * 8, base);
+	if (rc < 0)
+		return -errno;
+
+	/* Entries up to the first failure are done */
+	n = rc / 8;
+	for (i = 0; i < n; i++) {
+		if (!ops[i].write)
+			ops[i].val = buf[i];
+		ops[i].rc = 0;
+	}
+	return n;
+}
+
+int xscom_batch(struct xscom_op *ops, int count)
+{
+	int i = 0, j, done, failed = 0;
+	bool einval;
+
+	while (i < count) {
+		struct xscom_op *op = &ops[i];
+		struct xscom_chip *c = xscom_find_chip(op->chip_id);
+
+		if (!c) {
+			op->rc = -ENODEV;
+			failed++;
+			i++;
+			continue;
+		}
+
+		/* Find how many following entries can go in the same access */
+		for (j = 1; i + j < count && j < XSCOM_BATCH_RUN; j++) {
+			struct xscom_op *next = &op[j];
+
+			if (next->chip_id != op->chip_id ||
+			    next->write != op->write ||
+			    xscom_mangle_addr(next->addr) !=
+			    xscom_mangle_addr(op->addr) + j * 8)
+				break;
+		}
+
+		done = (j > 1 && !xscom_no_runs) ? xscom_batch_run(c, op, j) : 0;
+		einval = done == -EINVAL;
+		if (done < 0)
+			done = 0;
+		i += done;
+		if (done == j)
+			continue;
+
+		/*
+		 * Redo the first entry that didn't complete on its own, both
+		 * to get its error and in case the kernel doesn't do multiple
+		 * registers per access, then carry on with the rest.
+		 */
+		op = &ops[i];
+		if (op->write)
+			op->rc = xscom_write(op->chip_id, op->addr, op->val);
+		else
+			op->rc = xscom_read(op->chip_id, op->addr, &op->val);
+
+		/*
+		 * A bad address gets EINVAL too, only give up on runs if the
+		 * register a run failed on is fine on its own.
+		 */
+		if (op->rc)
+			failed++;
+		else if (einval)
+			xscom_no_runs = true;
+		i++;
+	}
+
+	return failed;
+}
+
+/*
+ * Parse a list of accesses, one per line: "[chip-id] addr" for reads and
+ * "[chip-id] addr value" for writes, all in hex. Empty lines and lines
+ * starting with '#' are ignored.
+ */
+int xscom_batch_parse(FILE *f, uint32_t def_chip, bool write,
+		      struct xscom_op **opsp)
+{
+	struct xscom_op *ops = NULL, *op;
+	int count = 0, alloc = 0, line = 0, n, i;
+	uint64_t v[3];
+	char buf[256], *p, *end;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		for (p = buf; isspace(*p); p++)
+			;
+		if (!*p || *p == '#')
+			continue;
+
+		for (n = 0; *p && n < 3; n++) {
+			v[n] = strtoull(p, &end, 16);
+			if (end == p)
+				break;
+			for (p = end; isspace(*p); p++)
+				;
+		}
+		if (*p || n < (write ? 2 : 1) || n > (write ? 3 : 2)) {
+			fprintf(stderr, "Invalid access at line %d\n", line);
+			free(ops);
+			return -1;
+		}
+
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			ops = realloc(ops, alloc * sizeof(*ops));
+			assert(ops);
+		}
+		op = &ops[count++];
+		memset(op, 0, sizeof(*op));
+		op->write = write;
+		op->chip_id = def_chip;
+		i = 0;
+		if (n == (write ? 3 : 2))
+			op->chip_id = v[i++];
+		op->addr = v[i++];
+		if (write)
+			op->val = v[i];
+	}
+	*opsp = ops;
+	return count;
+}
+
 int xscom_read_ex(uint32_t ex_target_id, uint64_t addr, uint64_t *val)
 {
 	uint32_t chip_id = ex_target_id >> 4;;
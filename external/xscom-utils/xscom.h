@@ -18,10 +18,26 @@
 #define __XSCOM_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 
 extern int xscom_read(uint32_t chip_id, uint64_t addr, uint64_t *val);
 extern int xscom_write(uint32_t chip_id, uint64_t addr, uint64_t val);
 
+/* One access of a batch, rc is filled in by xscom_batch() */
+struct xscom_op {
+	uint32_t	chip_id;
+	bool		write;
+	uint64_t	addr;
+	uint64_t	val;
+	int		rc;
+};
+
+/* Returns the number of failed entries */
+extern int xscom_batch(struct xscom_op *ops, int count);
+extern int xscom_batch_parse(FILE *f, uint32_t def_chip, bool write,
+			     struct xscom_op **opsp);
+
 extern int xscom_read_ex(uint32_t ex_target_id, uint64_t addr, uint64_t *val);
 extern int xscom_write_ex(uint32_t ex_target_id, uint64_t addr, uint64_t val);
 
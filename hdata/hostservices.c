@@ -47,7 +47,7 @@ static void merge_property(const struct dt_node *src_root,
 	}
 
 	/* Append src to dst. */
-	dt_resize_property(&dst, dst->len + src->len);
+	dt_resize_property(dst_root, &dst, dst->len + src->len);
 	memcpy(dst->prop + dst->len, src->prop, src->len);
 	dst->len += src->len;
 }
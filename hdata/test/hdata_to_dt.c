@@ -22,6 +22,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 #include <mem_region-malloc.h>
 
 #include <interrupts.h>
@@ -249,10 +250,152 @@ static void dump_hdata_fdt(struct dt_node *root)
 	free(fdt_blob);
 }
 
+static void check_expanded(const struct dt_node *a, const struct dt_node *b)
+{
+	const struct dt_property *pa, *pb;
+	const struct dt_node *ca, *cb;
+
+	assert(!strcmp(a->name, b->name));
+	/* dt_add_property() takes the phandle as raw fdt bytes */
+	assert(cpu_to_fdt32(a->phandle) == b->phandle);
+
+	pb = list_top(&b->properties, struct dt_property, list);
+	list_for_each(&a->properties, pa, list) {
+		if (strstarts(pa->name, DT_PRIVATE))
+			continue;
+		assert(pb);
+		assert(!strcmp(pa->name, pb->name));
+		assert(pa->len == pb->len);
+		assert(!memcmp(pa->prop, pb->prop, pa->len));
+		pb = pb->list.next == &b->properties.n ? NULL :
+			list_entry(pb->list.next, struct dt_property, list);
+	}
+	assert(!pb);
+
+	cb = list_top(&b->children, struct dt_node, list);
+	list_for_each(&a->children, ca, list) {
+		assert(cb);
+		check_expanded(ca, cb);
+		cb = cb->list.next == &b->children.n ? NULL :
+			list_entry(cb->list.next, struct dt_node, list);
+	}
+	assert(!cb);
+}
+
+/* Time flattening the tree, and check the result expands back to it */
+static void bench_hdata_fdt(struct dt_node *root)
+{
+	struct timespec start, end;
+	const int loops = 100;
+	struct dt_node *copy;
+	void *fdt_blob;
+	unsigned long ns;
+	int i;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	for (i = 0; i < loops; i++) {
+		fdt_blob = create_dtb(root, false);
+		assert(fdt_blob);
+		if (i < loops - 1)
+			free(fdt_blob);
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1000000000ul +
+		end.tv_nsec - start.tv_nsec;
+
+	assert(fdt_check_header(fdt_blob) == 0);
+	copy = dt_new_root("");
+	assert(dt_expand_node(copy, fdt_blob, 0) >= 0);
+	check_expanded(root, copy);
+	dt_free(copy);
+
+	fprintf(stderr, "flattened %u byte tree in %lu us\n",
+		fdt_totalsize(fdt_blob), ns / loops / 1000);
+	free(fdt_blob);
+}
+
+static const struct dt_node *delta_fragment(const struct dt_node *delta,
+					     u32 target)
+{
+	const struct dt_node *frag;
+
+	dt_for_each_child(delta, frag)
+		if (dt_prop_get_u32(frag, "target") == target)
+			return frag;
+	return NULL;
+}
+
+/* Change the parsed tree and check the delta the OS would get */
+static void check_dt_delta(void)
+{
+	struct dt_node *old, *gone, *new, *delta;
+	const struct dt_node *frag, *ov;
+	unsigned long saved_top = top_of_ram;
+	u32 gone_phandle;
+	int64_t size;
+	void *blob;
+
+	old = dt_new(dt_root, "delta-old");
+	dt_add_property_string(old, "a", "a");
+	dt_add_property_string(old, "b", "b");
+	gone = dt_new_addr(old, "gone", 1);
+	gone_phandle = gone->phandle;
+
+	dt_delta_init();
+	assert(dt_journal_gen() == 0);
+
+	new = dt_new(dt_root, "delta-new");
+	dt_add_property_string(new, "compatible", "test");
+	dt_add_property_cells(dt_new_addr(new, "child", 1), "reg", 1);
+	dt_check_del_prop(old, "a");
+	dt_add_property_string(old, "c", "c");
+	dt_free(gone);
+	assert(dt_journal_gen() == 7);
+
+	top_of_ram = ~0ul;
+	assert(opal_get_device_tree_delta(8, 0, 0) == OPAL_PARAMETER);
+	size = opal_get_device_tree_delta(0, 0, 0);
+	assert(size > 0);
+	blob = malloc(size);
+	assert(opal_get_device_tree_delta(0, (u64)blob, size - 1) == OPAL_NO_MEM);
+	assert(opal_get_device_tree_delta(0, (u64)blob, size) == OPAL_SUCCESS);
+	top_of_ram = saved_top;
+
+	delta = dt_new_root("");
+	assert(dt_expand_node(delta, blob, 0) >= 0);
+	free(blob);
+	assert(dt_prop_get_u64(delta, "ibm,dt-generation") == 7);
+	assert(dt_prop_get_u32(delta, "ibm,deleted-phandles") == gone_phandle);
+
+	/* The new subtree hangs off the root, phandles and all */
+	frag = delta_fragment(delta, dt_root->phandle);
+	assert(frag);
+	ov = dt_find_by_path((struct dt_node *)frag, "__overlay__/delta-new");
+	assert(ov);
+	assert(dt_has_node_property(ov, "compatible", "test"));
+	ov = dt_find_by_path((struct dt_node *)ov, "child@1");
+	assert(ov && dt_prop_get_u32(ov, "reg") == 1);
+
+	/* The old node has one property less and one more */
+	frag = delta_fragment(delta, old->phandle);
+	assert(frag);
+	assert(dt_has_node_property(frag, "ibm,deleted-properties", "a"));
+	ov = dt_find_by_path((struct dt_node *)frag, "__overlay__");
+	assert(dt_has_node_property(ov, "c", "c"));
+	assert(!dt_find_property(ov, "b"));
+	dt_free(delta);
+
+	/* Nothing new since */
+	dt_delta_init();
+	dt_free(new);
+	dt_free(old);
+}
+
 int main(int argc, char *argv[])
 {
 	int fd, r, i = 0, opt_count = 0;
 	bool verbose = false, quiet = false, new_spira = false, blobs = false;
+	bool bench = false, delta = false;
 
 	while (argv[++i]) {
 		if (strcmp(argv[i], "-v") == 0) {
@@ -267,6 +410,12 @@ int main(int argc, char *argv[])
 		} else if (strcmp(argv[i], "-b") == 0) {
 			blobs = true;
 			opt_count++;
+		} else if (strcmp(argv[i], "-t") == 0) {
+			bench = true;
+			opt_count++;
+		} else if (strcmp(argv[i], "-d") == 0) {
+			delta = true;
+			opt_count++;
 		} else if (strcmp(argv[i], "-7") == 0) {
 			fake_pvr = PVR_P7;
 			proc_gen = proc_gen_p7;
@@ -298,6 +447,8 @@ int main(int argc, char *argv[])
 		     "	-v Verbose\n"
 		     "	-q Quiet mode\n"
 		     "	-b Keep blobs in the output\n"
+		     "	-t Time flattening the tree (on stderr)\n"
+		     "	-d Check device tree deltas\n"
 		     "\n"
 		     "  -7 Force PVR to POWER7\n"
 		     "  -8 Force PVR to POWER8\n"
@@ -383,6 +534,12 @@ int main(int argc, char *argv[])
 	if (!blobs)
 		squash_blobs(dt_root);
 
+	if (bench)
+		bench_hdata_fdt(dt_root);
+
+	if (delta)
+		check_dt_delta();
+
 	if (!quiet)
 		dump_hdata_fdt(dt_root);
 
@@ -452,5 +452,6 @@ void fsp_elog_write_init(void)
 	elog_init();
 
 	/* Add a poller */
-	opal_add_poller(elog_timeout_poll, NULL);
+	/* Commit timeouts are in seconds, no need to look all the time */
+	opal_add_poller_interval(elog_timeout_poll, NULL, 100);
 }
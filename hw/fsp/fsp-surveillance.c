@@ -220,7 +220,8 @@ void fsp_init_surveillance(void)
 	 * poller list has no locking so we don't want to play with it
 	 * at runtime.
 	 */
-	opal_add_poller(fsp_surv_poll, NULL);
+	/* The heartbeat goes out every 60s */
+	opal_add_poller_interval(fsp_surv_poll, NULL, 1000);
 
 	/* Register for the reset/reload event */
 	fsp_register_client(&fsp_surv_client_rr, FSP_MCLASS_RR_EVENT);
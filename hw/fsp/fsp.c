@@ -2237,7 +2237,8 @@ void fsp_opl(void)
 	}
 
 	/* Initiate the timeout poller */
-	opal_add_poller(fsp_timeout_poll, NULL);
+	/* Message timeouts have a 30s granularity */
+	opal_add_poller_interval(fsp_timeout_poll, NULL, 1000);
 
 	/* Tell FSP we are in standby */
 	prlog(PR_INFO, "INIT: Sending HV Functional: Standby...\n");
@@ -459,7 +459,7 @@ static void npu2_append_phandle(struct dt_node *dn,
 
 	/* Need to append to the properties */
 	len = prop->len + sizeof(*npu_phandles);
-	dt_resize_property(&prop, len);
+	dt_resize_property(dn, &prop, len);
 	prop->len = len;
 
 	npu_phandles = (uint32_t *)prop->prop;
@@ -95,13 +95,13 @@ void p8_sbe_update_timer_expiry(uint64_t new_target)
 
 	do {
 		/* Grab generation and spin if odd */
-		_xscom_lock();
+		_xscom_lock(sbe_timer_chip);
 		for (;;) {
 			rc = _xscom_read(sbe_timer_chip, 0xE0006, &gen, false);
 			if (rc) {
 				prerror("SLW: Error %lld reading tmr gen "
 					" count\n", rc);
-				_xscom_unlock();
+				_xscom_unlock(sbe_timer_chip);
 				return;
 			}
 			if (!(gen & 1))
@@ -126,7 +126,7 @@ void p8_sbe_update_timer_expiry(uint64_t new_target)
 				 */
 				prerror("SLW: timer stuck, falling back to OPAL pollers. You will likely have slower I2C and may have experienced increased jitter.\n");
 				prlog(PR_DEBUG, "SLW: Stuck with odd generation !\n");
-				_xscom_unlock();
+				_xscom_unlock(sbe_timer_chip);
 				sbe_has_timer = false;
 				p8_sbe_dump_timer_ffdc();
 				return;
@@ -136,7 +136,7 @@ void p8_sbe_update_timer_expiry(uint64_t new_target)
 		rc = _xscom_write(sbe_timer_chip, 0x5003A, req, false);
 		if (rc) {
 			prerror("SLW: Error %lld writing tmr request\n", rc);
-			_xscom_unlock();
+			_xscom_unlock(sbe_timer_chip);
 			return;
 		}
 
@@ -145,10 +145,10 @@ void p8_sbe_update_timer_expiry(uint64_t new_target)
 		if (rc) {
 			prerror("SLW: Error %lld re-reading tmr gen "
 				" count\n", rc);
-			_xscom_unlock();
+			_xscom_unlock(sbe_timer_chip);
 			return;
 		}
-		_xscom_unlock();
+		_xscom_unlock(sbe_timer_chip);
 	} while(gen != gen2);
 
 	/* Check if the timer is working. If at least 1ms has elapsed
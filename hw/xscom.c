@@ -56,12 +56,38 @@ static struct {
 /*
  * Locking notes:
  *
- * We used to have a per-target lock. However due to errata HW822317
- * we can have issues on the issuer side if multiple threads try to
- * send XSCOMs simultaneously (HMER responses get mixed up), so just
- * use a global lock instead
+ * Each chip has its own XSCOM lock, chip->xscom_lock, serializing the
+ * accesses targeting that chip, including multi-step sequences such as
+ * indirect accesses and the clearing of its error registers on reset.
+ *
+ * Due to errata HW822317 we can have issues on the issuer side if
+ * multiple threads try to send XSCOMs simultaneously (HMER responses
+ * get mixed up), and a failed access leaves the issuer stuck until the
+ * engine is reset. So each single access, retries and error recovery
+ * included, is also done with the chip->xscom_issue_lock of the chip
+ * we are running on. That one is only taken inside a target lock and
+ * is never held across more than one access, so accesses to different
+ * chips still mostly run in parallel where a global lock used to
+ * serialize all of them.
+ *
+ * Both locks are named after their chip so that OPAL_LOCK_PROFILE
+ * reports the contention on each of them separately.
  */
-static struct lock xscom_lock = LOCK_UNLOCKED;
+static inline struct proc_chip *xscom_issuer(void)
+{
+	struct proc_chip *chip = get_chip(this_cpu()->chip_id);
+
+	/* A thread whose chip_id isn't set up yet, go by its PIR */
+	if (!chip)
+		chip = get_chip(pir_to_chip_id(this_cpu()->pir));
+	assert(chip);
+	return chip;
+}
+
+static inline void xscom_lock_chip(struct proc_chip *chip)
+{
+	lock_caller(&chip->xscom_lock, chip->xscom_lock_name);
+}
 
 static inline void *xscom_addr(uint32_t gcid, uint32_t pcb_addr)
 {
@@ -93,6 +119,10 @@ static uint64_t xscom_wait_done(void)
 	return mfspr(SPR_HMER);
 }
 
+/*
+ * Called with the issue lock held, which also covers the register we
+ * reset on our own chip.
+ */
 static void xscom_reset(uint32_t gcid, bool need_delay)
 {
 	u64 hmer;
@@ -327,12 +357,16 @@ static int __xscom_read(uint32_t gcid, uint32_t pcb_addr, uint64_t *val)
 	uint64_t hmer;
 	int64_t ret, retries;
 	int64_t xscom_clear_retries = XSCOM_CLEAR_MAX_RETRIES;
+	struct proc_chip *issuer;
 
 	if (!xscom_gcid_ok(gcid)) {
 		prerror("%s: invalid XSCOM gcid 0x%x\n", __func__, gcid);
 		return OPAL_PARAMETER;
 	}
 
+	issuer = xscom_issuer();
+	lock_caller(&issuer->xscom_issue_lock, issuer->xscom_issue_name);
+
 	for (retries = 0; retries <= XSCOM_BUSY_MAX_RETRIES; retries++) {
 		/* Clear status bits in HMER (HMER is special
 		 * writing to it *ands* bits
@@ -346,8 +380,10 @@ static int __xscom_read(uint32_t gcid, uint32_t pcb_addr, uint64_t *val)
 		hmer = xscom_wait_done();
 
 		/* Check for error */
-		if (!(hmer & SPR_HMER_XSCOM_FAIL))
+		if (!(hmer & SPR_HMER_XSCOM_FAIL)) {
+			unlock(&issuer->xscom_issue_lock);
 			return OPAL_SUCCESS;
+		}
 
 		/* Handle error and possibly eventually retry */
 		ret = xscom_handle_error(hmer, gcid, pcb_addr, false, retries,
@@ -355,6 +391,7 @@ static int __xscom_read(uint32_t gcid, uint32_t pcb_addr, uint64_t *val)
 		if (ret != OPAL_BUSY)
 			break;
 	}
+	unlock(&issuer->xscom_issue_lock);
 
 	/* Do not print error message for multicast SCOMS */
 	if (xscom_is_multicast_addr(pcb_addr) && ret == OPAL_XSCOM_CHIPLET_OFF)
@@ -379,12 +416,16 @@ static int __xscom_write(uint32_t gcid, uint32_t pcb_addr, uint64_t val)
 	uint64_t hmer;
 	int64_t ret, retries = 0;
 	int64_t xscom_clear_retries = XSCOM_CLEAR_MAX_RETRIES;
+	struct proc_chip *issuer;
 
 	if (!xscom_gcid_ok(gcid)) {
 		prerror("%s: invalid XSCOM gcid 0x%x\n", __func__, gcid);
 		return OPAL_PARAMETER;
 	}
 
+	issuer = xscom_issuer();
+	lock_caller(&issuer->xscom_issue_lock, issuer->xscom_issue_name);
+
 	for (retries = 0; retries <= XSCOM_BUSY_MAX_RETRIES; retries++) {
 		/* Clear status bits in HMER (HMER is special
 		 * writing to it *ands* bits
@@ -398,8 +439,10 @@ static int __xscom_write(uint32_t gcid, uint32_t pcb_addr, uint64_t val)
 		hmer = xscom_wait_done();
 
 		/* Check for error */
-		if (!(hmer & SPR_HMER_XSCOM_FAIL))
+		if (!(hmer & SPR_HMER_XSCOM_FAIL)) {
+			unlock(&issuer->xscom_issue_lock);
 			return OPAL_SUCCESS;
+		}
 
 		/* Handle error and possibly eventually retry */
 		ret = xscom_handle_error(hmer, gcid, pcb_addr, true, retries,
@@ -407,6 +450,7 @@ static int __xscom_write(uint32_t gcid, uint32_t pcb_addr, uint64_t val)
 		if (ret != OPAL_BUSY)
 			break;
 	}
+	unlock(&issuer->xscom_issue_lock);
 
 	/* Do not print error message for multicast SCOMS */
 	if (xscom_is_multicast_addr(pcb_addr) && ret == OPAL_XSCOM_CHIPLET_OFF)
@@ -575,14 +619,17 @@ static uint32_t xscom_decode_chiplet(uint32_t partid, uint64_t *pcb_addr)
 	return gcid;
 }
 
-void _xscom_lock(void)
+void _xscom_lock(uint32_t gcid)
 {
-	lock(&xscom_lock);
+	struct proc_chip *chip = get_chip(gcid);
+
+	assert(chip);
+	xscom_lock_chip(chip);
 }
 
-void _xscom_unlock(void)
+void _xscom_unlock(uint32_t gcid)
 {
-	unlock(&xscom_lock);
+	unlock(&get_chip(gcid)->xscom_lock);
 }
 
 /*
@@ -590,6 +637,7 @@ void _xscom_unlock(void)
  */
 int _xscom_read(uint32_t partid, uint64_t pcb_addr, uint64_t *val, bool take_lock)
 {
+	struct proc_chip *chip;
 	uint32_t gcid;
 	int rc;
 
@@ -627,9 +675,13 @@ int _xscom_read(uint32_t partid, uint64_t pcb_addr, uint64_t *val, bool take_loc
 		return OPAL_PARAMETER;
 	}
 
-	/* HW822317 requires us to do global locking */
+	chip = get_chip(gcid);
+	if (!chip) {
+		prerror("%s: invalid XSCOM gcid 0x%x\n", __func__, gcid);
+		return OPAL_PARAMETER;
+	}
 	if (take_lock)
-		lock(&xscom_lock);
+		xscom_lock_chip(chip);
 
 	/* Direct vs indirect access */
 	if (pcb_addr & XSCOM_ADDR_IND_FLAG)
@@ -639,7 +691,7 @@ int _xscom_read(uint32_t partid, uint64_t pcb_addr, uint64_t *val, bool take_loc
 
 	/* Unlock it */
 	if (take_lock)
-		unlock(&xscom_lock);
+		unlock(&chip->xscom_lock);
 	return rc;
 }
 
@@ -647,6 +699,7 @@ opal_call(OPAL_XSCOM_READ, xscom_read, 3);
 
 int _xscom_write(uint32_t partid, uint64_t pcb_addr, uint64_t val, bool take_lock)
 {
+	struct proc_chip *chip;
 	uint32_t gcid;
 	int rc;
 
@@ -672,9 +725,13 @@ int _xscom_write(uint32_t partid, uint64_t pcb_addr, uint64_t val, bool take_loc
 		return OPAL_PARAMETER;
 	}
 
-	/* HW822317 requires us to do global locking */
+	chip = get_chip(gcid);
+	if (!chip) {
+		prerror("%s: invalid XSCOM gcid 0x%x\n", __func__, gcid);
+		return OPAL_PARAMETER;
+	}
 	if (take_lock)
-		lock(&xscom_lock);
+		xscom_lock_chip(chip);
 
 	/* Direct vs indirect access */
 	if (pcb_addr & XSCOM_ADDR_IND_FLAG)
@@ -684,11 +741,91 @@ int _xscom_write(uint32_t partid, uint64_t pcb_addr, uint64_t val, bool take_loc
 
 	/* Unlock it */
 	if (take_lock)
-		unlock(&xscom_lock);
+		unlock(&chip->xscom_lock);
 	return rc;
 }
 opal_call(OPAL_XSCOM_WRITE, xscom_write, 3);
 
+/*
+ * Run a vector of accesses, taking the lock of the target chip once for
+ * each run of entries on the same chip rather than for every register.
+ * Runs are capped at XSCOM_BATCH_RUN entries and end at a failed access
+ * (which may have spent a while retrying), so other users of the chip
+ * get a look in. Centaur accesses go through their own locking (and FSI,
+ * which may itself XSCOM), so they are done without any chip lock held.
+ * Each entry gets its own return code, the call returns OPAL_PARTIAL if
+ * any of them failed.
+ */
+#define XSCOM_BATCH_RUN	16
+
+static struct proc_chip *xscom_partid_chip(uint32_t partid)
+{
+	switch (partid >> 28) {
+	case 0: /* Normal processor chip */
+		return get_chip(partid);
+	case 4: /* EX chiplet */
+		return get_chip((partid & 0x0fffffff) >> 4);
+	default:
+		return NULL;
+	}
+}
+
+static int64_t opal_xscom_batch(struct opal_xscom_batch_op *ops,
+				uint64_t count)
+{
+	struct proc_chip *locked = NULL, *chip;
+	bool failed = false;
+	uint64_t i, val;
+	uint32_t partid;
+	unsigned int run = 0;
+	int rc;
+
+	if (!count || count > OPAL_XSCOM_BATCH_MAX || !opal_addr_valid(ops))
+		return OPAL_PARAMETER;
+
+	for (i = 0; i < count; i++) {
+		struct opal_xscom_batch_op *op = &ops[i];
+
+		/* Unknown chips are left to _xscom_read/write to reject */
+		partid = be32_to_cpu(op->partid);
+		chip = xscom_partid_chip(partid);
+		if (chip != locked || run >= XSCOM_BATCH_RUN) {
+			if (locked)
+				unlock(&locked->xscom_lock);
+			if (chip)
+				xscom_lock_chip(chip);
+			locked = chip;
+			run = 0;
+		}
+		run++;
+
+		switch (be32_to_cpu(op->op)) {
+		case OPAL_XSCOM_BATCH_READ:
+			rc = _xscom_read(partid, be64_to_cpu(op->addr), &val,
+					 !locked);
+			op->value = cpu_to_be64(val);
+			break;
+		case OPAL_XSCOM_BATCH_WRITE:
+			rc = _xscom_write(partid, be64_to_cpu(op->addr),
+					  be64_to_cpu(op->value), !locked);
+			break;
+		default:
+			rc = OPAL_PARAMETER;
+		}
+		op->rc = cpu_to_be64(rc);
+		if (rc) {
+			failed = true;
+			run = XSCOM_BATCH_RUN;
+		}
+	}
+
+	if (locked)
+		unlock(&locked->xscom_lock);
+
+	return failed ? OPAL_PARTIAL : OPAL_SUCCESS;
+}
+opal_call(OPAL_XSCOM_BATCH, opal_xscom_batch, 2);
+
 /*
  * Perform a xscom read-modify-write.
  */
@@ -891,6 +1028,13 @@ void xscom_init(void)
 
 		chip->xscom_base = dt_translate_address(xn, 0, NULL);
 
+		init_fair_lock(&chip->xscom_lock);
+		snprintf(chip->xscom_lock_name, sizeof(chip->xscom_lock_name),
+			 "xscom chip 0x%x", gcid);
+		snprintf(chip->xscom_issue_name,
+			 sizeof(chip->xscom_issue_name),
+			 "xscom issue chip 0x%x", gcid);
+
 		/* Grab processor type and EC level */
 		xscom_init_chip_info(chip);
 
@@ -919,18 +1063,31 @@ void xscom_init(void)
 
 void xscom_used_by_console(void)
 {
-	xscom_lock.in_con_path = true;
+	struct proc_chip *chip;
 
 	/*
-	 * Some other processor might hold it without having
+	 * Some other processor might hold them without having
 	 * disabled the console locally so let's make sure that
-	 * is over by taking/releasing the lock ourselves
+	 * is over by taking/releasing the locks ourselves
 	 */
-	lock(&xscom_lock);
-	unlock(&xscom_lock);
+	for_each_chip(chip) {
+		chip->xscom_lock.in_con_path = true;
+		chip->xscom_issue_lock.in_con_path = true;
+		xscom_lock_chip(chip);
+		unlock(&chip->xscom_lock);
+		lock(&chip->xscom_issue_lock);
+		unlock(&chip->xscom_issue_lock);
+	}
 }
 
 bool xscom_ok(void)
 {
-	return !lock_held_by_me(&xscom_lock);
+	struct proc_chip *chip;
+
+	for_each_chip(chip) {
+		if (lock_held_by_me(&chip->xscom_lock) ||
+		    lock_held_by_me(&chip->xscom_issue_lock))
+			return false;
+	}
+	return true;
 }
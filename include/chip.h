@@ -179,6 +179,10 @@ struct proc_chip {
 
 	/* Used by hw/xscom.c */
 	uint64_t		xscom_base;
+	struct lock		xscom_lock;	/* Accesses to this chip */
+	struct lock		xscom_issue_lock; /* Accesses from this chip */
+	char			xscom_lock_name[24];
+	char			xscom_issue_name[32];
 
 	/* Used by hw/lpc.c */
 	struct lpcm		*lpc;
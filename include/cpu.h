@@ -86,6 +86,10 @@ struct cpu_thread {
 	struct list_head		job_queue;
 	uint32_t			job_count;
 	bool				job_has_no_return;
+	bool				in_job;
+
+	/* Per-CPU free object magazines for malloc, see core/malloc.c */
+	struct slab_magazines		*slab_mags;
 	/*
 	 * Per-core mask tracking for threads in HMI handler and
 	 * a cleanup done bit.
@@ -281,6 +285,28 @@ static inline struct cpu_job *cpu_queue_job(struct cpu_thread *cpu,
 }
 
 
+/*
+ * A set of jobs that can be waited for as a whole. Jobs queued in a
+ * group are freed by the job engine once complete, the caller only
+ * waits for the group. Queueing with a NULL cpu lets any CPU run (or
+ * steal) the job.
+ */
+struct cpu_job_group {
+	uint32_t			pending;
+};
+
+static inline void init_cpu_job_group(struct cpu_job_group *group)
+{
+	group->pending = 0;
+}
+
+extern bool cpu_queue_job_group(struct cpu_job_group *group,
+				struct cpu_thread *cpu, const char *name,
+				void (*func)(void *data), void *data);
+
+/* Wait for all jobs in a group, running some of them if we can */
+extern void cpu_wait_job_group(struct cpu_job_group *group);
+
 /* Poll job status, returns true if completed */
 extern bool cpu_poll_job(struct cpu_job *job);
 
@@ -296,6 +322,8 @@ extern void cpu_process_jobs(void);
 extern void cpu_process_local_jobs(void);
 /* Check if there's any job pending */
 bool cpu_check_jobs(struct cpu_thread *cpu);
+/* Idle CPU: take a job queued behind a busy CPU's current one */
+extern bool cpu_steal_job(struct cpu_thread *cpu);
 
 /* OPAL sreset vector in place at 0x100 */
 void cpu_set_sreset_enable(bool sreset_enabled);
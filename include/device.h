@@ -29,8 +29,14 @@
  * This is trivially flattened into an fdt.
  *
  * Note that the add_* routines will make a copy of the name if it's not
- * a read-only string (ie. usually a string literal).
+ * a read-only string (ie. usually a string literal). Copies are interned,
+ * so nodes sharing a property name share the one copy.
+ *
+ * Nodes with many properties or children get a hash index over them
+ * (built on demand) so that lookups by name don't walk the lists.
  */
+struct dt_index;
+
 struct dt_property {
 	struct list_node list;
 	const char *name;
@@ -45,6 +51,10 @@ struct dt_node {
 	struct list_head children;
 	struct dt_node *parent;
 	u32 phandle;
+	u32 num_props;
+	u32 num_children;
+	struct dt_index *prop_index;
+	struct dt_index *child_index;
 };
 
 /* This is shared with device_tree.c .. make it static when
@@ -85,6 +95,14 @@ struct dt_node *dt_new_2addr(struct dt_node *parent, const char *name,
 			     uint64_t unit_addr0, uint64_t unit_addr1);
 struct dt_node *dt_new_check(struct dt_node *parent, const char *name);
 
+/*
+ * Low level variant, with a NULL parent it creates a root. Scratch trees
+ * that are only built to be flattened pass phandle = false, so they don't
+ * use up phandles the live tree may need at the same time.
+ */
+struct dt_node *__dt_new(struct dt_node *parent, const char *name,
+			 bool phandle);
+
 /* Copy node to new parent, including properties and subnodes */
 struct dt_node *dt_copy(struct dt_node *node, struct dt_node *parent);
 
@@ -139,7 +157,8 @@ void dt_del_property(struct dt_node *node, struct dt_property *prop);
 void dt_check_del_prop(struct dt_node *node, const char *name);
 
 /* Warning: moves *prop! */
-void dt_resize_property(struct dt_property **prop, size_t len);
+void dt_resize_property(struct dt_node *node, struct dt_property **prop,
+			size_t len);
 
 void dt_property_set_cell(struct dt_property *prop, u32 index, u32 val);
 u32 dt_property_get_cell(const struct dt_property *prop, u32 index);
@@ -269,6 +288,43 @@ struct dt_node *__dt_find_by_name_addr(struct dt_node *parent, const char *name,
 struct dt_node *dt_find_by_name_addr(struct dt_node *parent, const char *name,
 				uint64_t addr);
 
+/*
+ * Journal of changes to the tree under dt_root, started once the OS has
+ * been handed its copy of the tree so it can later ask for just what
+ * changed (see OPAL_GET_DEVICE_TREE_DELTA). Each change gets the next
+ * generation number, the last DT_JOURNAL_SIZE are kept.
+ */
+enum dt_change_type {
+	DT_CHANGE_NODE_ADD,	/* node (and any subtree) attached */
+	DT_CHANGE_NODE_DEL,	/* node (and any subtree) freed */
+	DT_CHANGE_PROP_ADD,
+	DT_CHANGE_PROP_DEL,
+};
+
+struct dt_change {
+	u64 gen;
+	enum dt_change_type type;
+	u32 phandle;		/* the node, or the property's node */
+	const char *name;	/* property name for property changes */
+};
+
+#define DT_JOURNAL_SIZE	1024
+
+/* (Re)start the journal at generation 0, calling notify on each change */
+void dt_journal_start(void (*notify)(u64 gen));
+
+/* Last generation recorded */
+u64 dt_journal_gen(void);
+
+/*
+ * The change with generation gen, NULL if not (or no longer) recorded.
+ * Hold dt_journal_lock() to keep the ring from moving underneath.
+ */
+const struct dt_change *dt_journal_get(u64 gen);
+
+void dt_journal_lock(void);
+void dt_journal_unlock(void);
+
 /* phandle fixup helper */
 void dt_adjust_subtree_phandle(struct dt_node *subtree,
 				const char** (get_properties_to_fix)(struct dt_node *n));
@@ -29,12 +29,21 @@ struct lock {
 	 */
 	uint64_t lock_val;
 
+	/* Ticket lock state, only used by fair locks: the next ticket to
+	 * hand out in the top 32-bit and the one being served in the
+	 * bottom 32-bit
+	 */
+	uint64_t tickets;
+
 	/*
 	 * Set to true if lock is involved in the console flush path
 	 * in which case taking it will suspend console flushing
 	 */
 	bool in_con_path;
 
+	/* Hand the lock out in the order it was requested */
+	bool fair;
+
 	/* file/line of lock owner */
 	const char *owner;
 
@@ -48,6 +57,13 @@ struct lock {
  */
 #define LOCK_UNLOCKED	{ 0 }
 
+/* A fair lock queues waiters by ticket rather than letting whoever wins
+ * the cache line race take it. It costs an extra atomic on unlock, so
+ * only use it for global locks that see heavy contention from many
+ * threads, where unfairness turns into OPAL call tail latency.
+ */
+#define LOCK_UNLOCKED_FAIR	{ .fair = true }
+
 /* Note vs. libc and locking:
  *
  * The printf() family of
@@ -76,6 +92,11 @@ static inline void init_lock(struct lock *l)
 	*l = (struct lock)LOCK_UNLOCKED;
 }
 
+static inline void init_fair_lock(struct lock *l)
+{
+	*l = (struct lock)LOCK_UNLOCKED_FAIR;
+}
+
 #define LOCK_CALLER	__FILE__ ":" stringify(__LINE__)
 
 #define try_lock(l)		try_lock_caller(l, LOCK_CALLER)
@@ -105,4 +126,8 @@ extern void dump_locks_list(void);
 /* Clean all locks held by CPU (and warn if any) */
 extern void drop_my_locks(bool warn);
 
+/* Per call site lock statistics, see OPAL_LOCK_PROFILE */
+extern void lock_profile_start(void);
+extern void lock_profile_dump(void);
+
 #endif /* __LOCK_H */
@@ -35,6 +35,10 @@ void *__memalign(size_t boundary, size_t size, const char *location) __warn_unus
 #define free(ptr) __free(ptr, __location__)
 #define memalign(boundary, size) __memalign(boundary, size, __location__)
 
+/* Small object front-end for malloc(), enabled once CPUs are set up */
+void malloc_slab_init(void);
+void malloc_slab_dump_allocs(void);
+
 void *__local_alloc(unsigned int chip, size_t size, size_t align,
 		    const char *location) __warn_unused_result;
 #define local_alloc(chip_id, size, align)	\
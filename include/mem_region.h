@@ -41,6 +41,9 @@ enum mem_region_type {
 	REGION_OS,
 };
 
+/* Free blocks are kept in lists by log2 of their size in longs */
+#define MEM_REGION_FREE_LISTS	64
+
 /* An area of physical memory. */
 struct mem_region {
 	struct list_node list;
@@ -48,7 +51,8 @@ struct mem_region {
 	uint64_t start, len;
 	struct dt_node *node;
 	enum mem_region_type type;
-	struct list_head free_list;
+	struct list_head free_list[MEM_REGION_FREE_LISTS];
+	uint64_t free_list_map;	/* Non-empty free lists */
 	struct lock free_list_lock;
 };
 
@@ -224,7 +224,14 @@
 #define OPAL_PCI_SET_PBCQ_TUNNEL_BAR		165
 #define OPAL_HANDLE_HMI2			166
 #define OPAL_NX_COPROC_INIT			167
-#define OPAL_LAST				167
+#define OPAL_LOCK_PROFILE			168
+#define OPAL_POLLER_STATS			169
+#define OPAL_GET_DEVICE_TREE_DELTA		170
+#define OPAL_XSCOM_BATCH			171
+#define OPAL_FLASH_CANCEL			172
+#define OPAL_GET_MSGS				173
+#define OPAL_REGISTER_MSG_RING			174
+#define OPAL_LAST				174
 
 #define QUIESCE_HOLD			1 /* Spin all calls at entry */
 #define QUIESCE_REJECT			2 /* Fail all calls with OPAL_BUSY */
@@ -545,6 +552,7 @@ enum opal_msg_type {
 	OPAL_MSG_DPO		= 5,
 	OPAL_MSG_PRD		= 6,
 	OPAL_MSG_OCC		= 7,
+	OPAL_MSG_DT_UPDATE	= 8,	/* params[0] = dt generation */
 	OPAL_MSG_TYPE_MAX,
 };
 
@@ -554,6 +562,21 @@ struct opal_msg {
 	__be64 params[8];
 };
 
+/*
+ * Message ring in host memory, see OPAL_REGISTER_MSG_RING. OPAL
+ * produces at head and the host consumes at tail. Both indices are free
+ * running, a message lives in msgs[index & (nr_msgs - 1)].
+ */
+struct opal_msg_ring {
+	__be64 head;		/* Written by OPAL */
+	__be64 tail;		/* Written by the host */
+	__be32 nr_msgs;		/* Set by OPAL, a power of 2 */
+	__be32 reserved;
+	__be64 overflows;	/* Messages left for OPAL_GET_MSG instead */
+	__be64 reserved2[12];
+	struct opal_msg msgs[];
+};
+
 /* System parameter permission */
 enum OpalSysparamPerm {
 	OPAL_SYSPARAM_READ  = 0x1,
@@ -1312,6 +1335,59 @@ enum {
 	OPAL_PCI_P2P_TARGET	= 1,
 };
 
+/* "op" argument options for OPAL_LOCK_PROFILE */
+enum {
+	OPAL_LOCK_PROFILE_STOP	= 0,
+	OPAL_LOCK_PROFILE_START	= 1,
+	OPAL_LOCK_PROFILE_RESET	= 2,
+	OPAL_LOCK_PROFILE_DUMP	= 3,
+	OPAL_LOCK_PROFILE_READ	= 4,
+};
+
+/* Per lock() call site statistics returned by OPAL_LOCK_PROFILE_READ */
+struct opal_lock_stat {
+	char	owner[64];
+	__be64	acquired;
+	__be64	contended;
+	__be64	spin_tb;	/* Total timebase ticks spent spinning */
+	__be64	max_spin_tb;	/* Longest single spin */
+};
+
+/* "op" argument options for OPAL_POLLER_STATS */
+enum {
+	OPAL_POLLER_STATS_RESET	= 0,
+	OPAL_POLLER_STATS_DUMP	= 1,
+	OPAL_POLLER_STATS_READ	= 2,
+};
+
+/* Per poller statistics returned by OPAL_POLLER_STATS_READ */
+struct opal_poller_stat {
+	char	name[64];
+	__be64	min_interval_tb;	/* 0 if called on every run */
+	__be64	calls;
+	__be64	skipped;	/* Runs where it wasn't due yet */
+	__be64	total_tb;	/* Total timebase ticks spent in the poller */
+	__be64	max_tb;		/* Longest single call */
+};
+
+/* "op" field options for OPAL_XSCOM_BATCH entries */
+enum {
+	OPAL_XSCOM_BATCH_READ	= 0,
+	OPAL_XSCOM_BATCH_WRITE	= 1,
+};
+
+/* Maximum number of entries in a single OPAL_XSCOM_BATCH call */
+#define OPAL_XSCOM_BATCH_MAX	4096
+
+/* One access of an OPAL_XSCOM_BATCH vector */
+struct opal_xscom_batch_op {
+	__be32	partid;		/* Chip, EX chiplet or Centaur, as XSCOM_READ */
+	__be32	op;
+	__be64	addr;
+	__be64	value;		/* Written, or filled in by reads */
+	__be64	rc;		/* Per entry OPAL return code */
+};
+
 #endif /* __ASSEMBLY__ */
 
 #endif /* __OPAL_API_H */
@@ -68,8 +68,15 @@ int64_t opal_quiesce(uint32_t shutdown_type, int32_t cpu);
  * XXX TODO: Add the big RCU-ish "opal API lock" to protect us here
  * which will also be used for other things such as runtime updates
  */
-extern void opal_add_poller(void (*poller)(void *data), void *data);
+extern void __opal_add_poller(void (*poller)(void *data), void *data,
+			      unsigned int min_ms, const char *name);
+#define opal_add_poller(poller, data)					\
+	__opal_add_poller((poller), (data), 0, #poller)
+/* Same, but don't bother calling it more often than every min_ms */
+#define opal_add_poller_interval(poller, data, min_ms)			\
+	__opal_add_poller((poller), (data), (min_ms), #poller)
 extern void opal_del_poller(void (*poller)(void *data));
+extern void opal_poller_stats_dump(void);
 extern void opal_run_pollers(void);
 
 /*
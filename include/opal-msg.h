@@ -37,5 +37,6 @@ int _opal_queue_msg(enum opal_msg_type msg_type, void *data,
 			(u64[]) {__VA_ARGS__});
 
 void opal_init_msg(void);
+void opal_drop_msg_ring(void);
 
 #endif /* __OPALMSG_H */
@@ -218,6 +218,7 @@ extern int flash_start_preload_resource(enum resource_id id, uint32_t subid,
 extern int flash_resource_loaded(enum resource_id id, uint32_t idx);
 extern bool flash_reserve(void);
 extern void flash_release(void);
+extern void flash_cache_disable(void);
 #define FLASH_SUBPART_ALIGNMENT 0x1000
 #define FLASH_SUBPART_HEADER_SIZE FLASH_SUBPART_ALIGNMENT
 extern int flash_subpart_info(void *part_header, uint32_t header_len,
@@ -253,6 +254,9 @@ extern void prd_fsp_occ_load_start(u32 proc);
 /* Flatten device-tree */
 extern void *create_dtb(const struct dt_node *root, bool exclusive);
 
+/* Start journalling tree changes for OPAL_GET_DEVICE_TREE_DELTA */
+extern void dt_delta_init(void);
+
 /* Track failure in Wakup engine */
 enum wakeup_engine_states {
 	WAKEUP_ENGINE_NOT_PRESENT,
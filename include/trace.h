@@ -21,16 +21,26 @@
 #include <lock.h>
 #include <trace_types.h>
 
+/* Trace buffer space per core, split between its threads */
 #define TBUF_SZ (1024 * 1024)
 
+/* Granularity at which old entries are evicted */
+#define TBUF_SKIP_SZ 4096
+
 struct cpu_thread;
 
 /* Here's one we prepared earlier. */
 void init_boot_tracebuf(struct cpu_thread *boot_cpu);
 
 struct trace_info {
-	/* Lock for writers. */
+	/* Lock for writers, only taken if the buffer is shared. */
 	struct lock lock;
+	/* More than one cpu writes to this buffer. */
+	bool shared;
+	/* Writer's copy of tb start/end/last, in native endian. */
+	u64 start, end, last;
+	/* Offset of first record after each TBUF_SKIP_SZ boundary. */
+	u64 skip[TBUF_SZ / TBUF_SKIP_SZ];
 	/* Exposed to kernel. */
 	struct tracebuf tb;
 };
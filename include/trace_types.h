@@ -25,6 +25,7 @@
 #define TRACE_FSP_MSG	4	/* FSP message sent/received */
 #define TRACE_FSP_EVENT	5	/* FSP driver event */
 #define TRACE_UART	6	/* UART driver traces */
+#define TRACE_PRLOG	7	/* Unformatted prlog() message */
 
 /* One per cpu, plus one for NMIs */
 struct tracebuf {
@@ -120,6 +121,22 @@ struct trace_uart {
 	__be16 in_count;
 };
 
+#define TRACE_PRLOG_MAX_ARGS	8
+#define TRACE_PRLOG_DATA	128
+
+struct trace_prlog {
+	struct trace_hdr hdr;
+	__be64 fmt;	/* Address of the format string in skiboot */
+	u8 level;
+	u8 nargs;
+	u8 unused[6];
+	/*
+	 * nargs arguments followed by copies of the strings passed for %s,
+	 * whose argument is the offset of the copy from the start of data.
+	 */
+	__be64 data[TRACE_PRLOG_DATA / 8];
+};
+
 union trace {
 	struct trace_hdr hdr;
 	/* Trace types go here... */
@@ -129,6 +146,7 @@ union trace {
 	struct trace_fsp_msg fsp_msg;
 	struct trace_fsp_event fsp_evt;
 	struct trace_uart uart;
+	struct trace_prlog prlog;
 };
 
 #endif /* __TRACE_TYPES_H */
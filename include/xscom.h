@@ -224,10 +224,10 @@
  */
 
 /* Use only in select places where multiple SCOMs are time/latency sensitive */
-extern void _xscom_lock(void);
+extern void _xscom_lock(uint32_t gcid);
 extern int _xscom_read(uint32_t partid, uint64_t pcb_addr, uint64_t *val, bool take_lock);
 extern int _xscom_write(uint32_t partid, uint64_t pcb_addr, uint64_t val, bool take_lock);
-extern void _xscom_unlock(void);
+extern void _xscom_unlock(uint32_t gcid);
 
 
 /* Targeted SCOM access */
@@ -18,6 +18,30 @@ memcmp(const void *ptr1, const void *ptr2, size_t n)
 {
 	const unsigned char *p1 = ptr1;
 	const unsigned char *p2 = ptr2;
+	const unsigned long *l1, *l2;
+
+	/*
+	 * Skip over equal words when both buffers are aligned alike, the
+	 * byte loop below then finds the first difference.
+	 */
+	if (n >= 16 && (((unsigned long)p1 ^ (unsigned long)p2) & 7) == 0) {
+		while ((unsigned long)p1 & 7) {
+			if (*p1 != *p2)
+				return (*p1 - *p2);
+			p1 += 1;
+			p2 += 1;
+			n--;
+		}
+		l1 = (const unsigned long *)p1;
+		l2 = (const unsigned long *)p2;
+		while (n >= 8 && *l1 == *l2) {
+			l1 += 1;
+			l2 += 1;
+			n -= 8;
+		}
+		p1 = (const unsigned char *)l1;
+		p2 = (const unsigned char *)l2;
+	}
 
 	while (n-- > 0) {
 		if (*p1 != *p2)
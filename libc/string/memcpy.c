@@ -12,13 +12,54 @@
 
 #include "string.h"
 
+#define CACHE_LINE_SIZE 128
+
 void *
 memcpy(void *dest, const void *src, size_t n)
 {
-	char *cdest;
+	char *cdest = dest;
 	const char *csrc = src;
+	unsigned long *ldest;
+	const unsigned long *lsrc;
+	unsigned long a, b, c, d;
+	int i;
+
+	/* Word copies need the source and destination aligned alike */
+	if (n >= 16 && (((unsigned long)cdest ^ (unsigned long)csrc) & 7) == 0) {
+		while ((unsigned long)cdest & 7) {
+			*cdest++ = *csrc++;
+			n--;
+		}
+		ldest = (unsigned long *)cdest;
+		lsrc = (const unsigned long *)csrc;
+
+		/* A cache line at a time, touching the next source line */
+		while (n >= CACHE_LINE_SIZE) {
+#if defined(__powerpc__) || defined(__powerpc64__)
+			asm volatile ("dcbt 0,%0\n" : : "r"(lsrc + 16));
+#endif
+			for (i = 0; i < 4; i++) {
+				a = lsrc[0];
+				b = lsrc[1];
+				c = lsrc[2];
+				d = lsrc[3];
+				ldest[0] = a;
+				ldest[1] = b;
+				ldest[2] = c;
+				ldest[3] = d;
+				lsrc += 4;
+				ldest += 4;
+			}
+			n -= CACHE_LINE_SIZE;
+		}
+		while (n >= 8) {
+			*ldest++ = *lsrc++;
+			n -= 8;
+		}
+		cdest = (char *)ldest;
+		csrc = (const char *)lsrc;
+	}
 
-	cdest = dest;
 	while (n-- > 0) {
 		*cdest++ = *csrc++;
 	}
@@ -18,32 +18,50 @@ void *
 memset(void *dest, int c, size_t size)
 {
 	unsigned char *d = (unsigned char *)dest;
-	unsigned long big_c = 0;
+	unsigned long *ld;
+	unsigned long big_c;
 
-#if defined(__powerpc__) || defined(__powerpc64__)
-	if (size > CACHE_LINE_SIZE && c==0) {
-		while ((unsigned long long)d % CACHE_LINE_SIZE) {
+	big_c = (unsigned char)c;
+	big_c |= big_c << 8;
+	big_c |= big_c << 16;
+	big_c |= big_c << 32;
+
+	if (size >= 16) {
+		while ((unsigned long)d & 7) {
 			*d++ = (unsigned char)c;
 			size--;
 		}
-		while (size >= CACHE_LINE_SIZE) {
-			asm volatile ("dcbz 0,%0\n" : : "r"(d) : "memory");
-			d+= CACHE_LINE_SIZE;
-			size-= CACHE_LINE_SIZE;
+
+#if defined(__powerpc__) || defined(__powerpc64__)
+		/* Zero whole cache lines without reading them in first */
+		if (size > CACHE_LINE_SIZE && big_c == 0) {
+			while ((unsigned long)d % CACHE_LINE_SIZE) {
+				*((unsigned long *)d) = 0;
+				d += 8;
+				size -= 8;
+			}
+			while (size >= CACHE_LINE_SIZE) {
+				asm volatile ("dcbz 0,%0\n" : : "r"(d) : "memory");
+				d += CACHE_LINE_SIZE;
+				size -= CACHE_LINE_SIZE;
+			}
 		}
-	}
 #endif
 
-	if (c) {
-		big_c = c;
-		big_c |= (big_c << 8) | big_c;
-		big_c |= (big_c << 16) | big_c;
-		big_c |= (big_c << 32) | big_c;
-	}
-	while (size >= 8 && c == 0) {
-		*((unsigned long *)d) = big_c;
-		d+=8;
-		size-=8;
+		ld = (unsigned long *)d;
+		while (size >= 32) {
+			ld[0] = big_c;
+			ld[1] = big_c;
+			ld[2] = big_c;
+			ld[3] = big_c;
+			ld += 4;
+			size -= 32;
+		}
+		while (size >= 8) {
+			*ld++ = big_c;
+			size -= 8;
+		}
+		d = (unsigned char *)ld;
 	}
 
 	while (size-- > 0) {
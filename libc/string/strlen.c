@@ -12,17 +12,34 @@
 
 #include <string.h>
 
+#define ONES	0x0101010101010101UL
+#define HIGHS	0x8080808080808080UL
+
 size_t
 strlen(const char *s)
 {
-	size_t len = 0;
+	const char *p = s;
+	const unsigned long *w;
 
-	while (*s != 0) {
-		len += 1;
-		s += 1;
+	while ((unsigned long)p & 7) {
+		if (*p == 0)
+			return p - s;
+		p += 1;
 	}
 
-	return len;
+	/*
+	 * Look for a zero byte a word at a time. An aligned word never
+	 * crosses a page, so reading past the terminator is harmless.
+	 */
+	w = (const unsigned long *)p;
+	while (!((*w - ONES) & ~*w & HIGHS))
+		w += 1;
+
+	p = (const char *)w;
+	while (*p != 0)
+		p += 1;
+
+	return p - s;
 }
 
 size_t
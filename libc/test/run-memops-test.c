@@ -51,6 +51,9 @@ int test_strchr(const char *s, int c, char *expected);
 int test_strcasecmp(const char *s1, const char *s2, int expected);
 int test_strncasecmp(const char *s1, const char *s2, size_t n, int expected);
 int test_memmove(void *dest, const void *src, size_t n, const void *r, const void *expected, size_t expected_n);
+int test_memcpy(void *dest, const void *src, size_t n);
+size_t test_strlen(const char *s);
+void *test_memset_nocheck(void *buf, int c, size_t s);
 
 int test_memset(char* buf, int c, size_t s)
 {
@@ -101,3 +104,18 @@ int test_memmove(void *dest, const void *src, size_t n, const void *r, const voi
 		return -1;
 	return(memcmp(r, expected, expected_n) == 0);
 }
+
+int test_memcpy(void *dest, const void *src, size_t n)
+{
+	return(memcpy(dest, src, n) == dest);
+}
+
+size_t test_strlen(const char *s)
+{
+	return strlen(s);
+}
+
+void *test_memset_nocheck(void *buf, int c, size_t s)
+{
+	return memset(buf, c, s);
+}
@@ -20,6 +20,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 int test_memset(char* buf, int c, size_t s);
 int test_memchr(const void *ptr, int c, size_t n, void* expected);
@@ -29,6 +30,212 @@ int test_strchr(const char *s, int c, char *expected);
 int test_strcasecmp(const char *s1, const char *s2, int expected);
 int test_strncasecmp(const char *s1, const char *s2, size_t n, int expected);
 int test_memmove(void *dest, const void *src, size_t n, const void *r, const void *expected, size_t expected_n);
+int test_memcpy(void *dest, const void *src, size_t n);
+size_t test_strlen(const char *s);
+void *test_memset_nocheck(void *buf, int c, size_t s);
+
+#define SWEEP_SZ	512
+
+static size_t next_len(size_t n)
+{
+	/* Every small length, then strides around the unrolled loops */
+	return n < 40 ? n + 1 : n + 13;
+}
+
+static void check_memcpy(void)
+{
+	static unsigned char src[SWEEP_SZ], dst[SWEEP_SZ];
+	size_t so, doff, n, i;
+
+	for (so = 0; so < 16; so++) {
+		for (doff = 0; doff < 16; doff++) {
+			for (n = 0; n < SWEEP_SZ - 16; n = next_len(n)) {
+				for (i = 0; i < SWEEP_SZ; i++) {
+					src[i] = i * 7 + so;
+					dst[i] = 0xaa;
+				}
+				assert(test_memcpy(dst + doff, src + so, n));
+				for (i = 0; i < SWEEP_SZ; i++) {
+					if (i < doff || i >= doff + n)
+						assert(dst[i] == 0xaa);
+					else
+						assert(dst[i] == src[so + i - doff]);
+				}
+			}
+		}
+	}
+}
+
+static void check_memset(void)
+{
+	static char buf[SWEEP_SZ];
+	static const int vals[] = { 0, 0x5a, 0x17f };
+	size_t off, n, i, v;
+
+	for (v = 0; v < sizeof(vals) / sizeof(vals[0]); v++) {
+		for (off = 0; off < 16; off++) {
+			for (n = 0; n < SWEEP_SZ - 16; n = next_len(n)) {
+				memset(buf, 0x33, sizeof(buf));
+				assert(test_memset(buf + off, vals[v] & 0x7f, n) == 0);
+				for (i = 0; i < off; i++)
+					assert(buf[i] == 0x33);
+				for (i = off + n; i < SWEEP_SZ; i++)
+					assert(buf[i] == 0x33);
+			}
+		}
+	}
+}
+
+static void check_memcmp(void)
+{
+	static unsigned char a[SWEEP_SZ], b[SWEEP_SZ];
+	size_t ao, bo, n, k;
+
+	for (k = 0; k < SWEEP_SZ; k++)
+		a[k] = b[k] = (k * 3) & 0x7f;
+
+	for (ao = 0; ao < 16; ao++) {
+		for (bo = 0; bo < 16; bo++) {
+			if (ao != bo && ((ao ^ bo) & 7) != 0)
+				continue;
+			for (n = 0; n < SWEEP_SZ - 16; n = next_len(n)) {
+				if (ao == bo)
+					assert(test_memcmp(a + ao, b + bo, n, 0));
+				/* A single difference anywhere in the range */
+				for (k = 0; ao == bo && k < n; k = next_len(k)) {
+					b[bo + k] += 5;
+					assert(test_memcmp(a + ao, b + bo, n, -5));
+					assert(test_memcmp(b + bo, a + ao, n, 5));
+					b[bo + k] -= 5;
+				}
+			}
+		}
+	}
+}
+
+static void check_strlen(void)
+{
+	static char buf[SWEEP_SZ];
+	size_t off, n, i;
+
+	for (off = 0; off < 16; off++) {
+		for (n = 0; n < SWEEP_SZ - 16; n = next_len(n)) {
+			/* High bytes must not be mistaken for a terminator */
+			for (i = 0; i < SWEEP_SZ; i++)
+				buf[i] = (i % 3) ? 0x80 + i % 5 : 0x01;
+			buf[off + n] = 0;
+			assert(test_strlen(buf + off) == n);
+		}
+	}
+}
+
+/* Byte at a time versions, to compare throughput against */
+static void ref_memcpy(void *dest, const void *src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+
+	while (n--)
+		*d++ = *s++;
+}
+
+static void ref_memset(void *dest, int c, size_t n)
+{
+	char *d = dest;
+
+	while (n--)
+		*d++ = c;
+}
+
+static int ref_memcmp(const void *ptr1, const void *ptr2, size_t n)
+{
+	const unsigned char *p1 = ptr1, *p2 = ptr2;
+
+	for (; n--; p1++, p2++)
+		if (*p1 != *p2)
+			return *p1 - *p2;
+	return 0;
+}
+
+static size_t ref_strlen(const char *s)
+{
+	size_t len = 0;
+
+	while (s[len])
+		len++;
+	return len;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define BENCH_SZ	(1024 * 1024)
+#define BENCH_LOOPS	16
+
+static void report(const char *name, double ref, double t)
+{
+	double mb = (double)BENCH_SZ * BENCH_LOOPS / (1024 * 1024);
+
+	printf("%-8s byte loop %8.1f MB/s, libc %8.1f MB/s (x%.1f)\n",
+	       name, mb / ref, mb / t, ref / t);
+}
+
+static void bench_memops(void)
+{
+	char *a = malloc(BENCH_SZ + 1), *b = malloc(BENCH_SZ + 1);
+	double t, ref;
+	int i;
+
+	assert(a && b);
+	ref_memset(a, 'x', BENCH_SZ + 1);
+	ref_memset(b, 'x', BENCH_SZ + 1);
+	a[BENCH_SZ] = b[BENCH_SZ] = 0;
+
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		ref_memcpy(a, b, BENCH_SZ);
+	ref = now() - t;
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		test_memcpy(a, b, BENCH_SZ);
+	report("memcpy", ref, now() - t);
+
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		ref_memset(a, 0, BENCH_SZ);
+	ref = now() - t;
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		test_memset_nocheck(a, 0, BENCH_SZ);
+	report("memset", ref, now() - t);
+
+	ref_memset(a, 'x', BENCH_SZ);
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		assert(ref_memcmp(a, b, BENCH_SZ) == 0);
+	ref = now() - t;
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		assert(test_memcmp(a, b, BENCH_SZ, 0));
+	report("memcmp", ref, now() - t);
+
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		assert(ref_strlen(a) == BENCH_SZ);
+	ref = now() - t;
+	t = now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		assert(test_strlen(a) == BENCH_SZ);
+	report("strlen", ref, now() - t);
+
+	free(a);
+	free(b);
+}
 
 int main(void)
 {
@@ -98,5 +305,12 @@ int main(void)
 	free(buf);
 	free(buf2);
 
+	check_memcpy();
+	check_memset();
+	check_memcmp();
+	check_strlen();
+
+	bench_memops();
+
 	return 0;
 }
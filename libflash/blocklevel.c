@@ -92,6 +92,291 @@ static int release(struct blocklevel_device *bl)
 	return rc;
 }
 
+/*
+ * Read cache of erase block sized pages. The pages are few enough that
+ * a linear scan for lookups and LRU eviction is cheaper than anything
+ * cleverer.
+ */
+/* Backends like files have byte sized erase blocks */
+#define BLOCKLEVEL_CACHE_MIN_PAGE	0x1000
+
+struct blocklevel_cache_page {
+	uint64_t pos;
+	uint64_t last_used;
+	bool valid;
+};
+
+struct blocklevel_cache {
+	uint32_t page_size;
+	uint32_t npages;
+	uint32_t readahead;
+	uint64_t total_size;
+	uint64_t tick;
+	/* Bumped by invalidation so a fill racing with it isn't kept */
+	uint64_t generation;
+	/* Where the last read ended, to spot sequential reads */
+	uint64_t next_pos;
+	struct blocklevel_cache_page *pages;
+	char *data;
+
+	/* Kept for small ECC reads and writes rather than a malloc each */
+	void *bounce;
+	uint64_t bounce_len;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t readaheads;
+	uint64_t bypassed;
+};
+
+static char *cache_page_data(struct blocklevel_cache *c,
+		struct blocklevel_cache_page *page)
+{
+	return c->data + (page - c->pages) * c->page_size;
+}
+
+static struct blocklevel_cache_page *cache_find(struct blocklevel_cache *c,
+		uint64_t pos)
+{
+	uint32_t i;
+
+	for (i = 0; i < c->npages; i++)
+		if (c->pages[i].valid && c->pages[i].pos == pos)
+			return &c->pages[i];
+	return NULL;
+}
+
+static int cache_fill(struct blocklevel_device *bl, uint64_t pos,
+		struct blocklevel_cache_page **pagep)
+{
+	struct blocklevel_cache *c = bl->cache;
+	struct blocklevel_cache_page *page = &c->pages[0];
+	uint64_t len = c->page_size;
+	uint64_t generation = c->generation;
+	uint32_t i;
+	int rc;
+
+	for (i = 0; i < c->npages && page->valid; i++) {
+		if (!c->pages[i].valid || c->pages[i].last_used < page->last_used)
+			page = &c->pages[i];
+	}
+
+	/* The last page may be short */
+	if (pos + len > c->total_size)
+		len = c->total_size - pos;
+
+	page->valid = false;
+	rc = bl->read(bl, pos, cache_page_data(c, page), len);
+	if (rc)
+		return rc;
+
+	page->pos = pos;
+	page->last_used = ++c->tick;
+	page->valid = generation == c->generation;
+	*pagep = page;
+
+	return 0;
+}
+
+static void cache_invalidate_range(struct blocklevel_device *bl, uint64_t pos,
+		uint64_t len)
+{
+	struct blocklevel_cache *c = bl->cache;
+	uint32_t i;
+
+	if (!c)
+		return;
+
+	c->generation++;
+	for (i = 0; i < c->npages; i++) {
+		if (c->pages[i].pos < pos + len &&
+				c->pages[i].pos + c->page_size > pos)
+			c->pages[i].valid = false;
+	}
+}
+
+static int cache_read(struct blocklevel_device *bl, uint64_t pos, void *out,
+		uint64_t len)
+{
+	struct blocklevel_cache *c = bl->cache;
+	struct blocklevel_cache_page *page;
+	bool sequential = pos == c->next_pos;
+	uint64_t off, chunk, run, ra_pos;
+	char *buf = out;
+	uint32_t i;
+	int rc;
+
+	c->next_pos = pos + len;
+
+	while (len) {
+		off = pos & (c->page_size - 1);
+		chunk = len < c->page_size - off ? len : c->page_size - off;
+		page = cache_find(c, pos - off);
+
+		/* Pass whole missing pages straight to the caller */
+		if (!page && !off && chunk == c->page_size) {
+			for (run = c->page_size; run + c->page_size <= len; run += c->page_size)
+				if (cache_find(c, pos + run))
+					break;
+			rc = bl->read(bl, pos, buf, run);
+			if (rc)
+				return rc;
+			c->bypassed += run / c->page_size;
+			pos += run;
+			buf += run;
+			len -= run;
+			continue;
+		}
+
+		if (page) {
+			c->hits++;
+			page->last_used = ++c->tick;
+		} else {
+			rc = cache_fill(bl, pos - off, &page);
+			if (rc)
+				return rc;
+			c->misses++;
+
+			/*
+			 * Failing to read ahead isn't an error, the pages
+			 * just won't be there
+			 */
+			for (i = 1; sequential && i <= c->readahead; i++) {
+				struct blocklevel_cache_page *ra;
+
+				ra_pos = pos - off + i * c->page_size;
+				if (ra_pos >= c->total_size)
+					break;
+				if (cache_find(c, ra_pos))
+					continue;
+				if (cache_fill(bl, ra_pos, &ra))
+					break;
+				c->readaheads++;
+			}
+		}
+
+		memcpy(buf, cache_page_data(c, page) + off, chunk);
+		pos += chunk;
+		buf += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+int blocklevel_cache_init(struct blocklevel_device *bl, uint32_t npages,
+		uint32_t readahead)
+{
+	struct blocklevel_cache *c;
+	uint64_t total_size;
+	uint32_t granule;
+	int rc;
+
+	if (!bl || !bl->read || bl->cache || !npages) {
+		errno = EINVAL;
+		return FLASH_ERR_PARM_ERROR;
+	}
+
+	rc = blocklevel_get_info(bl, NULL, &total_size, &granule);
+	if (rc)
+		return rc;
+
+	/* Pages are addressed by masking the offset */
+	if (!granule || (granule & (granule - 1))) {
+		FL_ERR("%s: erase granule 0x%08x isn't a power of 2\n",
+				__func__, granule);
+		errno = EINVAL;
+		return FLASH_ERR_PARM_ERROR;
+	}
+	if (granule < BLOCKLEVEL_CACHE_MIN_PAGE)
+		granule = BLOCKLEVEL_CACHE_MIN_PAGE;
+
+	/* Read ahead mustn't evict the page it was triggered by */
+	if (readahead >= npages)
+		readahead = npages - 1;
+
+	c = malloc(sizeof(*c));
+	if (!c)
+		goto nomem;
+	memset(c, 0, sizeof(*c));
+	c->pages = malloc(npages * sizeof(*c->pages));
+	c->data = malloc((uint64_t)npages * granule);
+	if (!c->pages || !c->data)
+		goto nomem;
+	memset(c->pages, 0, npages * sizeof(*c->pages));
+
+	c->page_size = granule;
+	c->npages = npages;
+	c->readahead = readahead;
+	c->total_size = total_size;
+	c->next_pos = -1ull;
+	bl->cache = c;
+
+	FL_DBG("%s: %u pages of 0x%08x, read ahead %u\n", __func__, npages,
+			granule, readahead);
+	return 0;
+
+nomem:
+	if (c) {
+		free(c->pages);
+		free(c);
+	}
+	errno = ENOMEM;
+	return FLASH_ERR_MALLOC_FAILED;
+}
+
+void blocklevel_cache_invalidate(struct blocklevel_device *bl)
+{
+	if (bl)
+		cache_invalidate_range(bl, 0, -1ull);
+}
+
+void blocklevel_cache_free(struct blocklevel_device *bl)
+{
+	struct blocklevel_cache *c;
+
+	if (!bl || !bl->cache)
+		return;
+
+	c = bl->cache;
+	FL_DBG("%s: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+			" read ahead, %" PRIu64 " bypassed\n", __func__,
+			c->hits, c->misses, c->readaheads, c->bypassed);
+	bl->cache = NULL;
+	free(c->bounce);
+	free(c->data);
+	free(c->pages);
+	free(c);
+}
+
+/*
+ * Bounce buffers for ECC protected accesses. With a cache the buffer for
+ * small accesses is kept around, large ones aren't worth holding on to.
+ */
+static void *ecc_bounce_get(struct blocklevel_device *bl, uint64_t len)
+{
+	struct blocklevel_cache *c = bl->cache;
+	void *buf;
+
+	if (!c || len > c->page_size)
+		return malloc(len);
+
+	if (c->bounce_len < len) {
+		buf = realloc(c->bounce, len);
+		if (!buf)
+			return NULL;
+		c->bounce = buf;
+		c->bounce_len = len;
+	}
+	return c->bounce;
+}
+
+static void ecc_bounce_put(struct blocklevel_device *bl, void *buf)
+{
+	if (!bl->cache || buf != bl->cache->bounce)
+		free(buf);
+}
+
 int blocklevel_raw_read(struct blocklevel_device *bl, uint64_t pos, void *buf, uint64_t len)
 {
 	int rc;
@@ -106,7 +391,10 @@ int blocklevel_raw_read(struct blocklevel_device *bl, uint64_t pos, void *buf, u
 	if (rc)
 		return rc;
 
-	rc = bl->read(bl, pos, buf, len);
+	if (bl->cache)
+		rc = cache_read(bl, pos, buf, len);
+	else
+		rc = bl->read(bl, pos, buf, len);
 
 	release(bl);
 
@@ -153,7 +441,7 @@ int blocklevel_read(struct blocklevel_device *bl, uint64_t pos, void *buf, uint6
 	FL_DBG("%s: adjusted_pos: 0x%" PRIx64 ", ecc_pos: 0x%" PRIx64
 			", ecc_diff: 0x%" PRIx64 ", ecc_len: 0x%" PRIx64 "\n",
 			__func__, pos, ecc_pos, ecc_diff, ecc_len);
-	buffer = malloc(ecc_len);
+	buffer = ecc_bounce_get(bl, ecc_len);
 	if (!buffer) {
 		errno = ENOMEM;
 		rc = FLASH_ERR_MALLOC_FAILED;
@@ -174,7 +462,7 @@ int blocklevel_read(struct blocklevel_device *bl, uint64_t pos, void *buf, uint6
 	}
 
 out:
-	free(buffer);
+	ecc_bounce_put(bl, buffer);
 	return rc;
 }
 
@@ -194,6 +482,7 @@ int blocklevel_raw_write(struct blocklevel_device *bl, uint64_t pos,
 		return rc;
 
 	rc = bl->write(bl, pos, buf, len);
+	cache_invalidate_range(bl, pos, len);
 
 	release(bl);
 
@@ -243,7 +532,7 @@ int blocklevel_write(struct blocklevel_device *bl, uint64_t pos, const void *buf
 			", ecc_diff: 0x%" PRIx64 ", ecc_len: 0x%" PRIx64 "\n",
 			__func__, pos, ecc_pos, ecc_diff, ecc_len);
 
-	buffer = malloc(ecc_len);
+	buffer = ecc_bounce_get(bl, ecc_len);
 	if (!buffer) {
 		errno = ENOMEM;
 		rc = FLASH_ERR_MALLOC_FAILED;
@@ -293,7 +582,7 @@ int blocklevel_write(struct blocklevel_device *bl, uint64_t pos, const void *buf
 	rc = blocklevel_raw_write(bl, pos, buffer, ecc_len);
 
 out:
-	free(buffer);
+	ecc_bounce_put(bl, buffer);
 	return rc;
 }
 
@@ -325,6 +614,7 @@ int blocklevel_erase(struct blocklevel_device *bl, uint64_t pos, uint64_t len)
 		return rc;
 
 	rc = bl->erase(bl, pos, len);
+	cache_invalidate_range(bl, pos, len);
 
 	release(bl);
 
@@ -418,6 +708,9 @@ int blocklevel_smart_erase(struct blocklevel_device *bl, uint64_t pos, uint64_t
 		return rc;
 	}
 
+	/* Whatever happens below, the cached pages are stale */
+	cache_invalidate_range(bl, pos, len);
+
 	if (pos & bl->erase_mask) {
 		/*
 		 * base_pos and base_len are the values in the first erase
@@ -572,6 +865,9 @@ int blocklevel_smart_write(struct blocklevel_device *bl, uint64_t pos, const voi
 	if (rc)
 		goto out_free;
 
+	/* Whatever happens below, the cached pages are stale */
+	cache_invalidate_range(bl, pos, len);
+
 	while (len > 0) {
 		uint32_t erase_block = pos & ~(erase_size - 1);
 		uint32_t block_offset = pos & (erase_size - 1);
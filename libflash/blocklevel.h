@@ -34,6 +34,8 @@ enum blocklevel_flags {
 	WRITE_NEED_ERASE = 1,
 };
 
+struct blocklevel_cache;
+
 /*
  * libffs may be used with different backends, all should provide these for
  * libflash to get the information it needs
@@ -56,6 +58,9 @@ struct blocklevel_device {
 	enum blocklevel_flags flags;
 
 	struct blocklevel_range ecc_prot;
+
+	/* Optional read cache, see blocklevel_cache_init() */
+	struct blocklevel_cache *cache;
 };
 int blocklevel_raw_read(struct blocklevel_device *bl, uint64_t pos, void *buf, uint64_t len);
 int blocklevel_read(struct blocklevel_device *bl, uint64_t pos, void *buf, uint64_t len);
@@ -86,4 +91,24 @@ int blocklevel_smart_erase(struct blocklevel_device *bl, uint64_t pos, uint64_t
 /* Implemented in software at this level */
 int blocklevel_ecc_protect(struct blocklevel_device *bl, uint32_t start, uint32_t len);
 
+/*
+ * blocklevel_cache_init() puts a read cache of npages erase block sized
+ * pages in front of any backend. Least recently used pages are evicted
+ * first. When a read misses right where the previous one ended, the
+ * following readahead pages are fetched as well. Reads covering whole
+ * pages that aren't cached go straight to the backend so that big reads
+ * don't flush the cache.
+ *
+ * Writes and erases going through blocklevel invalidate the pages they
+ * touch. Anything else changing the flash behind blocklevel's back must
+ * call blocklevel_cache_invalidate().
+ *
+ * The backend's exit function releases the cache, or call
+ * blocklevel_cache_free() to turn it off.
+ */
+int blocklevel_cache_init(struct blocklevel_device *bl, uint32_t npages,
+		uint32_t readahead);
+void blocklevel_cache_invalidate(struct blocklevel_device *bl);
+void blocklevel_cache_free(struct blocklevel_device *bl);
+
 #endif /* __LIBFLASH_BLOCKLEVEL_H */
@@ -55,15 +55,43 @@ enum eccbitfields
  *
  *  These values come from the HW design of the ECC algorithm.
  */
-static uint64_t eccmatrix[] = {
-        0x0000e8423c0f99ffull,
-        0x00e8423c0f99ff00ull,
-        0xe8423c0f99ff0000ull,
-        0x423c0f99ff0000e8ull,
-        0x3c0f99ff0000e842ull,
-        0x0f99ff0000e8423cull,
-        0x99ff0000e8423c0full,
-        0xff0000e8423c0f99ull
+#define ECC_MATRIX_BIT(data, n, row) \
+	((uint8_t)(__builtin_parityll((data) & (row)) << (n)))
+
+#define ECC_MATRIX(data) (					\
+	ECC_MATRIX_BIT(data, 0, 0x0000e8423c0f99ffull) |	\
+	ECC_MATRIX_BIT(data, 1, 0x00e8423c0f99ff00ull) |	\
+	ECC_MATRIX_BIT(data, 2, 0xe8423c0f99ff0000ull) |	\
+	ECC_MATRIX_BIT(data, 3, 0x423c0f99ff0000e8ull) |	\
+	ECC_MATRIX_BIT(data, 4, 0x3c0f99ff0000e842ull) |	\
+	ECC_MATRIX_BIT(data, 5, 0x0f99ff0000e8423cull) |	\
+	ECC_MATRIX_BIT(data, 6, 0x99ff0000e8423c0full) |	\
+	ECC_MATRIX_BIT(data, 7, 0xff0000e8423c0f99ull))
+
+/*
+ * The ECC is linear: the ECC of a word is the XOR of the ECC of each of
+ * its bytes taken on their own. So rather than computing 8 parities over
+ * the whole word, look up the contribution of each byte in a table per
+ * byte position (2KB in total), computed from the matrix at build time.
+ */
+#define ECC_TABLE_4(v, shift)						\
+	ECC_MATRIX((uint64_t)(v) << (shift)),				\
+	ECC_MATRIX((uint64_t)((v) + 1) << (shift)),			\
+	ECC_MATRIX((uint64_t)((v) + 2) << (shift)),			\
+	ECC_MATRIX((uint64_t)((v) + 3) << (shift))
+#define ECC_TABLE_16(v, shift)						\
+	ECC_TABLE_4(v, shift), ECC_TABLE_4((v) + 4, shift),		\
+	ECC_TABLE_4((v) + 8, shift), ECC_TABLE_4((v) + 12, shift)
+#define ECC_TABLE_64(v, shift)						\
+	ECC_TABLE_16(v, shift), ECC_TABLE_16((v) + 16, shift),		\
+	ECC_TABLE_16((v) + 32, shift), ECC_TABLE_16((v) + 48, shift)
+#define ECC_TABLE(shift)						\
+	{ ECC_TABLE_64(0, shift), ECC_TABLE_64(64, shift),		\
+	  ECC_TABLE_64(128, shift), ECC_TABLE_64(192, shift) }
+
+static const uint8_t ecctable[8][256] = {
+	ECC_TABLE(0), ECC_TABLE(8), ECC_TABLE(16), ECC_TABLE(24),
+	ECC_TABLE(32), ECC_TABLE(40), ECC_TABLE(48), ECC_TABLE(56),
 };
 
 /**
@@ -116,15 +144,16 @@ static enum eccbitfields syndromematrix[] = {
  *  @data:	The 8 byte data to generate ECC for.
  *  @return:	The 1 byte ECC corresponding to the data.
  */
-static uint8_t eccgenerate(uint64_t data)
+static inline uint8_t eccgenerate(uint64_t data)
 {
-	int i;
-	uint8_t result = 0;
-
-	for (i = 0; i < 8; i++)
-		result |= __builtin_parityll(eccmatrix[i] & data) << i;
-
-	return result;
+	return ecctable[0][data & 0xff] ^
+		ecctable[1][(data >> 8) & 0xff] ^
+		ecctable[2][(data >> 16) & 0xff] ^
+		ecctable[3][(data >> 24) & 0xff] ^
+		ecctable[4][(data >> 32) & 0xff] ^
+		ecctable[5][(data >> 40) & 0xff] ^
+		ecctable[6][(data >> 48) & 0xff] ^
+		ecctable[7][data >> 56];
 }
 
 /**
@@ -226,7 +255,14 @@ int memcpy_from_ecc(uint64_t *dst, struct ecc64 *src, uint64_t len)
 	len >>= 3;
 
 	for (i = 0; i < len; i++) {
+		uint64_t data = src[i].data;
 		int rc;
+
+		/* Only go through the syndrome on a mismatch */
+		if (eccgenerate(be64_to_cpu(data)) == src[i].ecc) {
+			*dst++ = data;
+			continue;
+		}
 		rc = eccbyte(dst, src + i);
 		if (rc)
 			return rc;
@@ -336,7 +372,6 @@ int memcpy_from_ecc_unaligned(uint64_t *dst, struct ecc64 *src,
  */
 int memcpy_to_ecc(struct ecc64 *dst, const uint64_t *src, uint64_t len)
 {
-	struct ecc64 ecc_word;
 	uint64_t i;
 
 	if (len & 0x7) {
@@ -350,10 +385,8 @@ int memcpy_to_ecc(struct ecc64 *dst, const uint64_t *src, uint64_t len)
 	len >>= 3;
 
 	for (i = 0; i < len; i++) {
-		ecc_word.ecc = eccgenerate(be64_to_cpu(*(src + i)));
-		ecc_word.data = *(src + i);
-
-		*(dst + i) = ecc_word;
+		dst[i].data = src[i];
+		dst[i].ecc = eccgenerate(be64_to_cpu(src[i]));
 	}
 
 	return 0;
@@ -861,6 +861,7 @@ void flash_exit(struct blocklevel_device *bl)
 	/* XXX Make sure we are idle etc... */
 	if (bl) {
 		struct flash_chip *c = container_of(bl, struct flash_chip, bl);
+		blocklevel_cache_free(bl);
 		free(c->smart_buf);
 		free(c);
 	}
@@ -871,6 +872,7 @@ void flash_exit_close(struct blocklevel_device *bl, void (*close)(struct spi_fla
 	if (bl) {
 		struct flash_chip *c = container_of(bl, struct flash_chip, bl);
 		close(c->ctrl);
+		blocklevel_cache_free(bl);
 		free(c);
 	}
 }
@@ -44,6 +44,13 @@
 
 #define MBOX_DEFAULT_TIMEOUT 3 /* seconds */
 
+/*
+ * Sequential reads ask the BMC (V2 onwards) for a window bigger than the
+ * read, doubling each time the window has to move, up to this cap.
+ */
+#define MBOX_READ_AHEAD_MIN 0x10000
+#define MBOX_READ_AHEAD_MAX 0x100000
+
 #define MSG_CREATE(init_command) { .command = init_command }
 
 struct mbox_flash_data;
@@ -65,6 +72,9 @@ struct mbox_flash_data {
 	struct blocklevel_device bl;
 	uint32_t total_size;
 	uint32_t erase_granule;
+	uint32_t read_next; /* Where a sequential read would continue */
+	uint32_t read_ahead;
+	struct mbox_flash_stats stats;
 	int rc;
 	bool reboot;
 	bool pause;
@@ -156,10 +166,10 @@ static void mbox_flash_attn(uint8_t attn, void *priv);
 
 static int protocol_init(struct mbox_flash_data *mbox_flash, uint8_t shift);
 
-static int lpc_window_read(struct mbox_flash_data *mbox_flash, uint32_t pos,
+static int lpc_window_read(struct lpc_window *win, uint32_t pos,
 			   void *buf, uint32_t len)
 {
-	uint32_t off = mbox_flash->read.lpc_addr + (pos - mbox_flash->read.cur_pos);
+	uint32_t off = win->lpc_addr + (pos - win->cur_pos);
 	int rc;
 
 	prlog(PR_TRACE, "Reading at 0x%08x for 0x%08x offset: 0x%08x\n",
@@ -327,6 +337,7 @@ static int msg_send(struct mbox_flash_data *mbox_flash, struct bmc_mbox_msg *msg
 		return FLASH_ERR_AGAIN;
 	mbox_flash->busy = true;
 	mbox_flash->rc = 0;
+	mbox_flash->stats.messages++;
 	return bmc_mbox_enqueue(msg, timeout_sec);
 }
 
@@ -657,14 +668,49 @@ static int mbox_window_move(struct mbox_flash_data *mbox_flash,
 			    uint64_t pos, uint64_t len, uint64_t *size)
 {
 	struct bmc_mbox_msg msg = MSG_CREATE(command);
+	uint64_t want, end;
 	int rc;
 
 	/* Is the window currently open valid */
 	if (mbox_window_valid(win, pos, len)) {
 		*size = len;
+		if (win == &mbox_flash->read)
+			mbox_flash->stats.read_hits++;
+		else
+			mbox_flash->stats.write_hits++;
+		return 0;
+	}
+
+	/*
+	 * Use what is left of the current window before asking for another,
+	 * a large read straddling the end of the window shouldn't throw
+	 * away the part it can already reach.
+	 */
+	if (mbox_window_valid(win, pos, 1)) {
+		*size = (win->cur_pos + win->size) - pos;
+		if (win == &mbox_flash->read)
+			mbox_flash->stats.read_hits++;
+		else
+			mbox_flash->stats.write_hits++;
 		return 0;
 	}
 
+	want = len;
+	if (win == &mbox_flash->read) {
+		mbox_flash->stats.read_moves++;
+		if (pos == mbox_flash->read_next) {
+			if (mbox_flash->read_ahead < MBOX_READ_AHEAD_MIN)
+				mbox_flash->read_ahead = MBOX_READ_AHEAD_MIN;
+			else if (mbox_flash->read_ahead < MBOX_READ_AHEAD_MAX)
+				mbox_flash->read_ahead <<= 1;
+			want = MAX(want, mbox_flash->read_ahead);
+		} else {
+			mbox_flash->read_ahead = 0;
+		}
+	} else {
+		mbox_flash->stats.write_moves++;
+	}
+
 	/* V1 needs to remember where it has opened the window, note it
 	 * here.
 	 * If we're running V2 the response to the CREATE_*_WINDOW command
@@ -673,6 +719,17 @@ static int mbox_window_move(struct mbox_flash_data *mbox_flash,
 	win->cur_pos = pos & ~mbox_flash_mask(mbox_flash);
 
 	msg_put_u16(&msg, 0, bytes_to_blocks(mbox_flash, pos));
+	if (mbox_flash->version > 1) {
+		/*
+		 * V2 lets us ask for a window size, the BMC is free to give
+		 * us less. Never ask for anything past the end of the flash.
+		 */
+		end = ALIGN_UP(pos + want, 1ULL << mbox_flash->shift);
+		if (mbox_flash->total_size && end > mbox_flash->total_size)
+			end = mbox_flash->total_size;
+		want = bytes_to_blocks(mbox_flash, end - win->cur_pos);
+		msg_put_u16(&msg, 2, MIN(want, 0xffffULL));
+	}
 	rc = msg_send(mbox_flash, &msg, mbox_flash->timeout);
 	if (rc) {
 		prlog(PR_ERR, "Failed to enqueue/send BMC MBOX message\n");
@@ -768,6 +825,7 @@ static int mbox_flash_write(struct blocklevel_device *bl, uint64_t pos,
 		len -= size;
 		pos += size;
 		buf += size;
+		mbox_flash->stats.write_bytes += size;
 	}
 	return rc;
 }
@@ -791,26 +849,43 @@ static int mbox_flash_read(struct blocklevel_device *bl, uint64_t pos,
 
 	prlog(PR_TRACE, "Flash read at %#" PRIx64 " for %#" PRIx64 "\n", pos, len);
 	while (len > 0) {
-		/* Move window and get a new size to read */
-		rc = mbox_window_move(mbox_flash, &mbox_flash->read,
-				      MBOX_C_CREATE_READ_WINDOW, pos,
-				      len, &size);
-		if (rc)
-			return rc;
+		struct lpc_window *win = &mbox_flash->read;
+
+		/*
+		 * The BMC only gives us one window at a time. Reading from a
+		 * write window is permitted from V2 onwards so don't close
+		 * it just to read back what is already mapped, this keeps
+		 * read-modify-write cycles from bouncing between windows.
+		 */
+		if (mbox_flash->version > 1 &&
+		    mbox_window_valid(&mbox_flash->write, pos, 1)) {
+			win = &mbox_flash->write;
+			size = MIN(len, (win->cur_pos + win->size) - pos);
+			mbox_flash->stats.read_hits++;
+		} else {
+			/* Move window and get a new size to read */
+			rc = mbox_window_move(mbox_flash, win,
+					      MBOX_C_CREATE_READ_WINDOW, pos,
+					      len, &size);
+			if (rc)
+				return rc;
+		}
 
  		/* Perform the read for this window */
-		rc = lpc_window_read(mbox_flash, pos, buf, size);
+		rc = lpc_window_read(win, pos, buf, size);
 		if (rc)
 			return rc;
 
 		len -= size;
 		pos += size;
 		buf += size;
+		mbox_flash->read_next = pos;
+		mbox_flash->stats.read_bytes += size;
 		/*
 		 * Ensure my window is still open, if it isn't we can't trust
 		 * what we read
 		 */
-		if (!is_valid(mbox_flash, &mbox_flash->read))
+		if (!is_valid(mbox_flash, win))
 			return FLASH_ERR_AGAIN;
 	}
 	return rc;
@@ -926,6 +1001,10 @@ static void mbox_flash_attn(uint8_t attn, void *priv)
 
 	if (attn & MBOX_ATTN_ACK_MASK)
 		mbox_flash->ack = true;
+	/* The BMC may have changed the flash under us */
+	if (attn & (MBOX_ATTN_BMC_REBOOT | MBOX_ATTN_BMC_FLASH_LOST))
+		blocklevel_cache_invalidate(&mbox_flash->bl);
+
 	if (attn & MBOX_ATTN_BMC_REBOOT) {
 		mbox_flash->reboot = true;
 		mbox_flash->read.open = false;
@@ -1161,11 +1240,30 @@ int mbox_flash_init(struct blocklevel_device **bl)
 	return 0;
 }
 
+void mbox_flash_get_stats(struct blocklevel_device *bl,
+			  struct mbox_flash_stats *stats)
+{
+	struct mbox_flash_data *mbox_flash;
+
+	mbox_flash = container_of(bl, struct mbox_flash_data, bl);
+	*stats = mbox_flash->stats;
+}
+
 void mbox_flash_exit(struct blocklevel_device *bl)
 {
 	struct mbox_flash_data *mbox_flash;
 	if (bl) {
 		mbox_flash = container_of(bl, struct mbox_flash_data, bl);
+		prlog(PR_DEBUG, "read: %" PRIu64 " hits %" PRIu64 " moves %"
+		      PRIu64 " bytes, write: %" PRIu64 " hits %" PRIu64
+		      " moves %" PRIu64 " bytes, %" PRIu64 " messages\n",
+		      mbox_flash->stats.read_hits, mbox_flash->stats.read_moves,
+		      mbox_flash->stats.read_bytes,
+		      mbox_flash->stats.write_hits,
+		      mbox_flash->stats.write_moves,
+		      mbox_flash->stats.write_bytes,
+		      mbox_flash->stats.messages);
+		blocklevel_cache_free(bl);
 		free(mbox_flash);
 	}
 }
@@ -17,9 +17,22 @@
 #ifndef __LIBFLASH_MBOX_FLASH_H
 #define __LIBFLASH_MBOX_FLASH_H
 
+/* Counters kept by mbox-flash, a "move" asks the BMC for a new window */
+struct mbox_flash_stats {
+	uint64_t read_hits;
+	uint64_t read_moves;
+	uint64_t read_bytes;
+	uint64_t write_hits;
+	uint64_t write_moves;
+	uint64_t write_bytes;
+	uint64_t messages;
+};
+
 int mbox_flash_lock(struct blocklevel_device *bl, uint64_t pos, uint64_t len);
 int mbox_flash_init(struct blocklevel_device **bl);
 void mbox_flash_exit(struct blocklevel_device *bl);
+void mbox_flash_get_stats(struct blocklevel_device *bl,
+			  struct mbox_flash_stats *stats);
 #endif /* __LIBFLASH_MBOX_FLASH_H */
 
 
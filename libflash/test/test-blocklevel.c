@@ -125,6 +125,199 @@ static void print_ptr(void *ptr, int len)
 	putchar('\n');
 }
 
+#define CACHE_FLASH_SIZE	0x10000
+#define CACHE_ERASE_SIZE	0x1000
+
+static char *cache_flash;
+static int cache_backend_reads;
+
+static int bl_cache_read(struct blocklevel_device *bl __unused, uint64_t pos,
+		void *buf, uint64_t len)
+{
+	if (pos + len > CACHE_FLASH_SIZE)
+		return FLASH_ERR_PARM_ERROR;
+
+	cache_backend_reads++;
+	memcpy(buf, cache_flash + pos, len);
+
+	return 0;
+}
+
+static int bl_cache_write(struct blocklevel_device *bl __unused, uint64_t pos,
+		const void *buf, uint64_t len)
+{
+	if (pos + len > CACHE_FLASH_SIZE)
+		return FLASH_ERR_PARM_ERROR;
+
+	memcpy(cache_flash + pos, buf, len);
+
+	return 0;
+}
+
+static int bl_cache_erase(struct blocklevel_device *bl __unused, uint64_t pos,
+		uint64_t len)
+{
+	if (pos + len > CACHE_FLASH_SIZE)
+		return FLASH_ERR_PARM_ERROR;
+
+	memset(cache_flash + pos, 0xff, len);
+
+	return 0;
+}
+
+static int bl_cache_get_info(struct blocklevel_device *bl __unused,
+		const char **name, uint64_t *total_size, uint32_t *erase_granule)
+{
+	if (name)
+		*name = "cache test";
+	if (total_size)
+		*total_size = CACHE_FLASH_SIZE;
+	if (erase_granule)
+		*erase_granule = CACHE_ERASE_SIZE;
+
+	return 0;
+}
+
+#define CACHE_CHECK(cond) do {						\
+	if (!(cond)) {							\
+		ERR("Cache test failed: %s line: %d\n", #cond, __LINE__);	\
+		goto out;						\
+	}								\
+} while (0)
+
+static int test_cache(void)
+{
+	struct blocklevel_device bl_mem = { 0 };
+	struct blocklevel_device *bl = &bl_mem;
+	uint64_t ecc_data[16], ecc_back[16];
+	char *buf = NULL;
+	int i, reads, rc = 1;
+
+	bl->read = &bl_cache_read;
+	bl->write = &bl_cache_write;
+	bl->erase = &bl_cache_erase;
+	bl->get_info = &bl_cache_get_info;
+	bl->erase_mask = CACHE_ERASE_SIZE - 1;
+
+	cache_flash = malloc(CACHE_FLASH_SIZE);
+	buf = malloc(CACHE_FLASH_SIZE);
+	if (!cache_flash || !buf) {
+		ERR("Couldn't malloc cache test buffers\n");
+		goto out;
+	}
+	for (i = 0; i < CACHE_FLASH_SIZE; i++)
+		cache_flash[i] = random();
+
+	CACHE_CHECK(blocklevel_cache_init(bl, 0, 0) != 0);
+	CACHE_CHECK(blocklevel_cache_init(bl, 4, 1) == 0);
+	CACHE_CHECK(blocklevel_cache_init(bl, 4, 1) != 0);
+
+	/* Repeated small reads of the same page only read it once */
+	cache_backend_reads = 0;
+	for (i = 0; i < 10; i++) {
+		CACHE_CHECK(blocklevel_read(bl, 0x10 + i, buf, 0x20) == 0);
+		CACHE_CHECK(memcmp(buf, cache_flash + 0x10 + i, 0x20) == 0);
+	}
+	CACHE_CHECK(cache_backend_reads == 1);
+
+	/* A read straddling two pages only misses on the second */
+	CACHE_CHECK(blocklevel_read(bl, 0xff8, buf, 0x10) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0xff8, 0x10) == 0);
+	CACHE_CHECK(cache_backend_reads == 2);
+
+	/* Crossing into a new page sequentially reads the next one ahead */
+	CACHE_CHECK(blocklevel_read(bl, 0x2000, buf, 0x800) == 0);
+	CACHE_CHECK(blocklevel_read(bl, 0x2800, buf + 0x800, 0x900) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0x2000, 0x1100) == 0);
+	CACHE_CHECK(cache_backend_reads == 5);
+	CACHE_CHECK(blocklevel_read(bl, 0x3100, buf, 0x1000) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0x3100, 0x1000) == 0);
+	CACHE_CHECK(cache_backend_reads == 5);
+	CACHE_CHECK(bl->cache->readaheads == 1);
+
+	/* Whole pages go around the cache in one read and evict nothing */
+	reads = cache_backend_reads;
+	CACHE_CHECK(blocklevel_read(bl, 0x8000, buf, 0x4000) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0x8000, 0x4000) == 0);
+	CACHE_CHECK(cache_backend_reads == reads + 1);
+	CACHE_CHECK(blocklevel_read(bl, 0x3000, buf, 0x1800) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0x3000, 0x1800) == 0);
+	CACHE_CHECK(cache_backend_reads == reads + 1);
+
+	/* Writes and erases replace what's cached */
+	CACHE_CHECK(blocklevel_write(bl, 0x3010, "cached", 6) == 0);
+	CACHE_CHECK(blocklevel_read(bl, 0x3000, buf, 0x20) == 0);
+	CACHE_CHECK(memcmp(buf + 0x10, "cached", 6) == 0);
+	CACHE_CHECK(blocklevel_erase(bl, 0x3000, 0x1000) == 0);
+	CACHE_CHECK(blocklevel_read(bl, 0x3000, buf, 0x20) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0x3000, 0x20) == 0);
+	CACHE_CHECK(buf[0x10] == (char)0xff);
+	CACHE_CHECK(blocklevel_read(bl, 0x2ff0, buf, 0x20) == 0);
+	CACHE_CHECK(blocklevel_smart_write(bl, 0x2ffc, "smart", 5) == 0);
+	CACHE_CHECK(blocklevel_read(bl, 0x2ff0, buf, 0x20) == 0);
+	CACHE_CHECK(memcmp(buf + 0xc, "smart", 5) == 0);
+	CACHE_CHECK(blocklevel_smart_erase(bl, 0x2ff0, 0x20) == 0);
+	CACHE_CHECK(blocklevel_read(bl, 0x2ff0, buf, 0x20) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0x2ff0, 0x20) == 0);
+
+	/* Changes made behind blocklevel's back need an invalidate */
+	CACHE_CHECK(blocklevel_read(bl, 0x5000, buf, 0x10) == 0);
+	cache_flash[0x5000] ^= 0xff;
+	blocklevel_cache_invalidate(bl);
+	CACHE_CHECK(blocklevel_read(bl, 0x5000, buf, 0x10) == 0);
+	CACHE_CHECK(memcmp(buf, cache_flash + 0x5000, 0x10) == 0);
+
+	/* ECC protected accesses go through the cache too */
+	CACHE_CHECK(blocklevel_ecc_protect(bl, 0xc000, 0x1000) == 0);
+	for (i = 0; i < 16; i++)
+		ecc_data[i] = random();
+	CACHE_CHECK(blocklevel_smart_write(bl, 0xc000, ecc_data,
+				sizeof(ecc_data)) == 0);
+	CACHE_CHECK(blocklevel_read(bl, 0xc000, ecc_back, sizeof(ecc_back)) == 0);
+	CACHE_CHECK(memcmp(ecc_data, ecc_back, sizeof(ecc_data)) == 0);
+	CACHE_CHECK(blocklevel_write(bl, 0xc008, ecc_data, 8) == 0);
+	CACHE_CHECK(blocklevel_read(bl, 0xc000, ecc_back, sizeof(ecc_back)) == 0);
+	CACHE_CHECK(ecc_back[1] == ecc_data[0]);
+	free(bl->ecc_prot.prot);
+	bl->ecc_prot.prot = NULL;
+	bl->ecc_prot.n_prot = bl->ecc_prot.total_prot = 0;
+
+	/* Random accesses always match the backend */
+	for (i = 0; i < 5000; i++) {
+		uint64_t pos = random() % CACHE_FLASH_SIZE;
+		uint64_t len = 1 + random() % (CACHE_FLASH_SIZE - pos);
+
+		if (len > 3 * CACHE_ERASE_SIZE)
+			len = 1 + random() % (3 * CACHE_ERASE_SIZE);
+		switch (random() % 8) {
+		case 0:
+			memset(buf, random(), len);
+			CACHE_CHECK(blocklevel_write(bl, pos, buf, len) == 0);
+			break;
+		case 1:
+			pos &= ~(uint64_t)(CACHE_ERASE_SIZE - 1);
+			CACHE_CHECK(blocklevel_erase(bl, pos, CACHE_ERASE_SIZE) == 0);
+			break;
+		default:
+			CACHE_CHECK(blocklevel_read(bl, pos, buf, len) == 0);
+			CACHE_CHECK(memcmp(buf, cache_flash + pos, len) == 0);
+		}
+	}
+	printf("Cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+			" read ahead, %" PRIu64 " bypassed\n", bl->cache->hits,
+			bl->cache->misses, bl->cache->readaheads,
+			bl->cache->bypassed);
+
+	blocklevel_cache_free(bl);
+	CACHE_CHECK(!bl->cache);
+	rc = 0;
+out:
+	blocklevel_cache_free(bl);
+	free(cache_flash);
+	free(buf);
+	return rc;
+}
+
 int main(void)
 {
 	struct blocklevel_device bl_mem = { 0 };
@@ -687,6 +880,8 @@ int main(void)
 		goto out;
 	}
 
+	rc = test_cache();
+
 out:
 	free(buf);
 	free(data);
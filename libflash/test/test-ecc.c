@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #include <libflash/ecc.h>
 
@@ -364,6 +365,163 @@ struct ecc64 ecc_data[] = {
 
 };
 
+/* The original matrix based eccgenerate(), to check the tables against */
+static uint64_t eccmatrix[] = {
+	0x0000e8423c0f99ffull,
+	0x00e8423c0f99ff00ull,
+	0xe8423c0f99ff0000ull,
+	0x423c0f99ff0000e8ull,
+	0x3c0f99ff0000e842ull,
+	0x0f99ff0000e8423cull,
+	0x99ff0000e8423c0full,
+	0xff0000e8423c0f99ull
+};
+
+static uint8_t eccgenerate_ref(uint64_t data)
+{
+	int i;
+	uint8_t result = 0;
+
+	for (i = 0; i < 8; i++)
+		result |= __builtin_parityll(eccmatrix[i] & data) << i;
+
+	return result;
+}
+
+static uint64_t rand64(void)
+{
+	return ((uint64_t)random() << 62) ^ ((uint64_t)random() << 31) ^
+		random();
+}
+
+#define BENCH_WORDS	(1 << 20)
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Check the table driven code bit for bit against the matrix one */
+static void test_tables(void)
+{
+	struct ecc64 *ecc;
+	uint64_t *data, *out;
+	uint64_t v;
+	int i, j, bit;
+
+	printf("Checking ECC tables against the ECC matrix\n");
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 256; j++) {
+			v = (uint64_t)j << (i * 8);
+			if (eccgenerate(v) != eccgenerate_ref(v)) {
+				ERR("ECC table mismatch for 0x%016lx\n", v);
+				exit(1);
+			}
+		}
+	}
+	for (i = 0; i < 1000000; i++) {
+		v = rand64();
+		if (eccgenerate(v) != eccgenerate_ref(v)) {
+			ERR("ECC mismatch for 0x%016lx\n", v);
+			exit(1);
+		}
+	}
+
+	data = malloc(4096 * sizeof(*data));
+	out = malloc(4096 * sizeof(*out));
+	ecc = malloc(ecc_buffer_size(4096 * sizeof(*data)));
+	if (!data || !out || !ecc) {
+		ERR("malloc failed during ecc table test\n");
+		exit(1);
+	}
+	for (i = 0; i < 4096; i++)
+		data[i] = rand64();
+	if (memcpy_to_ecc(ecc, data, 4096 * sizeof(*data))) {
+		ERR("memcpy_to_ecc failed on random data\n");
+		exit(1);
+	}
+	for (i = 0; i < 4096; i++) {
+		if (ecc[i].data != data[i] ||
+		    ecc[i].ecc != eccgenerate_ref(be64toh(data[i]))) {
+			ERR("memcpy_to_ecc mismatch on word %d\n", i);
+			exit(1);
+		}
+	}
+
+	/* Flip one random bit in some words, they must all be corrected */
+	for (i = 0; i < 4096; i += 61) {
+		bit = random() % 72;
+		if (bit < 64)
+			ecc[i].data ^= htobe64(1ull << bit);
+		else
+			ecc[i].ecc ^= 1 << (bit - 64);
+	}
+	if (memcpy_from_ecc(out, ecc, 4096 * sizeof(*out)) ||
+	    memcmp(out, data, 4096 * sizeof(*out))) {
+		ERR("memcpy_from_ecc didn't correct random bit flips\n");
+		exit(1);
+	}
+
+	/* Two bit flips in a word are uncorrectable */
+	ecc[100].data ^= htobe64(0x11);
+	if (memcpy_from_ecc(out, ecc, 4096 * sizeof(*out)) != UE) {
+		ERR("memcpy_from_ecc didn't catch a double bit flip\n");
+		exit(1);
+	}
+
+	free(ecc);
+	free(out);
+	free(data);
+	printf("pass\n");
+}
+
+static void bench(void)
+{
+	struct timespec start;
+	struct ecc64 *ecc;
+	uint64_t *data;
+	double t, mb = BENCH_WORDS * 8 / 1e6;
+	uint8_t sum = 0;
+	int i;
+
+	data = malloc(BENCH_WORDS * sizeof(*data));
+	ecc = malloc(ecc_buffer_size(BENCH_WORDS * sizeof(*data)));
+	if (!data || !ecc) {
+		ERR("malloc failed during ecc benchmark\n");
+		exit(1);
+	}
+	for (i = 0; i < BENCH_WORDS; i++)
+		data[i] = rand64();
+	memset(ecc, 0, ecc_buffer_size(BENCH_WORDS * sizeof(*data)));
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	for (i = 0; i < BENCH_WORDS; i++)
+		sum ^= eccgenerate_ref(be64toh(data[i]));
+	t = elapsed(&start);
+	printf("ECC matrix encode:    %8.1f MB/s\n", mb / t);
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	memcpy_to_ecc(ecc, data, BENCH_WORDS * sizeof(*data));
+	t = elapsed(&start);
+	printf("ECC memcpy_to_ecc:    %8.1f MB/s\n", mb / t);
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+	memcpy_from_ecc(data, ecc, BENCH_WORDS * sizeof(*data));
+	t = elapsed(&start);
+	printf("ECC memcpy_from_ecc:  %8.1f MB/s\n", mb / t);
+
+	/* Keep the reference loop from being optimised away */
+	if (sum == 0x5a)
+		printf("\n");
+
+	free(ecc);
+	free(data);
+}
+
 int main(void)
 {
 	int i;
@@ -518,5 +676,9 @@ int main(void)
 		ERR("ecc_buffer_align(0, 50) not 45 -> %ld\n", ecc_buffer_align(0, 50));
 		exit(1);
 	}
+
+	test_tables();
+	bench();
+
 	return 0;
 }
@@ -23,6 +23,7 @@
 
 #include "../libflash.c"
 #include "../ecc.c"
+#include "../blocklevel.c"
 
 #define __unused		__attribute__((unused))
 
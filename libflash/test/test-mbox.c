@@ -280,6 +280,97 @@ out:
 	return rc;
 }
 
+/*
+ * Sequential reads should be served by a few growing windows and reads
+ * of a region that has an open write window shouldn't move the window.
+ */
+#define WINDOW_TEST_LEN 0x40000
+#define WINDOW_TEST_CHUNK 0x1000
+static int run_window_test(struct blocklevel_device *bl)
+{
+	struct mbox_flash_data *mbox_flash;
+	struct mbox_flash_stats before, after;
+	char *whole, *tmp;
+	uint64_t pos;
+	int rc;
+
+	mbox_flash = container_of(bl, struct mbox_flash_data, bl);
+	if (mbox_flash->version < 2)
+		return 0;
+
+	whole = malloc(WINDOW_TEST_LEN);
+	tmp = malloc(WINDOW_TEST_LEN);
+	if (!whole || !tmp) {
+		rc = 1;
+		goto out;
+	}
+
+	rc = blocklevel_read(bl, 0, whole, WINDOW_TEST_LEN);
+	if (rc) {
+		ERR("blocklevel_read(0, 0x%08x) failed with err %d\n",
+		    WINDOW_TEST_LEN, rc);
+		goto out;
+	}
+
+	/* Somewhere else first so the sequential read starts cold */
+	rc = blocklevel_read(bl, WINDOW_TEST_LEN, tmp, WINDOW_TEST_CHUNK);
+	if (rc)
+		goto out;
+
+	mbox_flash_get_stats(bl, &before);
+	for (pos = 0; pos < WINDOW_TEST_LEN; pos += WINDOW_TEST_CHUNK) {
+		rc = blocklevel_read(bl, pos, tmp + pos, WINDOW_TEST_CHUNK);
+		if (rc) {
+			ERR("blocklevel_read(0x%08x) failed with err %d\n",
+			    (unsigned int)pos, rc);
+			goto out;
+		}
+	}
+	mbox_flash_get_stats(bl, &after);
+	if (memcmp(whole, tmp, WINDOW_TEST_LEN)) {
+		ERR("%s:%d sequential read miscompare\n", __FILE__, __LINE__);
+		rc = 1;
+		goto out;
+	}
+	printf("Sequential read: %d moves, %d hits\n",
+	       (int)(after.read_moves - before.read_moves),
+	       (int)(after.read_hits - before.read_hits));
+	if (after.read_moves - before.read_moves > 6 ||
+	    after.read_hits + after.read_moves - before.read_hits -
+	    before.read_moves != WINDOW_TEST_LEN / WINDOW_TEST_CHUNK) {
+		ERR("%s:%d sequential read used too many windows\n",
+		    __FILE__, __LINE__);
+		rc = 1;
+		goto out;
+	}
+
+	/* Read back through the write window */
+	memset(tmp, 0x5a, WINDOW_TEST_CHUNK);
+	rc = blocklevel_write(bl, WINDOW_TEST_CHUNK, tmp, WINDOW_TEST_CHUNK);
+	if (rc) {
+		ERR("blocklevel_write failed with err %d\n", rc);
+		goto out;
+	}
+	mbox_flash_get_stats(bl, &before);
+	rc = blocklevel_read(bl, WINDOW_TEST_CHUNK, whole, WINDOW_TEST_CHUNK);
+	if (rc)
+		goto out;
+	mbox_flash_get_stats(bl, &after);
+	if (memcmp(whole, tmp, WINDOW_TEST_CHUNK) ||
+	    after.read_moves != before.read_moves ||
+	    after.messages != before.messages) {
+		ERR("%s:%d read of the write window moved it\n",
+		    __FILE__, __LINE__);
+		rc = 1;
+		goto out;
+	}
+
+out:
+	free(whole);
+	free(tmp);
+	return rc;
+}
+
 int main(void)
 {
 	struct blocklevel_device *bl;
@@ -301,6 +392,9 @@ int main(void)
 	/* run test */
 	mbox_flash_init(&bl);
 	rc = run_flash_test(bl);
+	if (rc)
+		goto out;
+	rc = run_window_test(bl);
 	if (rc)
 		goto out;
 	/*
@@ -314,6 +408,9 @@ int main(void)
 
 	/* Do all the tests again */
 	rc = run_flash_test(bl);
+	if (rc)
+		goto out;
+	rc = run_window_test(bl);
 	if (rc)
 		goto out;
 
@@ -323,6 +420,9 @@ int main(void)
 	rc = run_flash_test(bl);
 	if (rc)
 		goto out;
+	rc = run_window_test(bl);
+	if (rc)
+		goto out;
 
 
 	printf("Doing mbox-flash V3 tests\n");
@@ -331,6 +431,9 @@ int main(void)
 
 	/* Do all the tests again */
 	rc = run_flash_test(bl);
+	if (rc)
+		goto out;
+	rc = run_window_test(bl);
 
 
 out: